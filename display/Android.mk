@@ -30,3 +30,5 @@ LOCAL_SRC_FILES := display.cpp
 LOCAL_MODULE := display.$(TARGET_BOARD_PLATFORM)
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
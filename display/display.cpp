@@ -18,12 +18,16 @@
 #define LOG_TAG "display"
 
 #include <cutils/log.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #ifdef HAVE_ANDROID_OS      // just want PAGE_SIZE define
 #include <asm/page.h>
 #else
@@ -32,6 +36,13 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
 
 #include <hardware/display.h>
 #include <sunxi_disp_ioctl.h>
@@ -39,8 +50,21 @@
 #include <fb.h>
 
 #define MAX_DISPLAY_NUM		2
+#define MAX_BLIT_CACHE_NUM  4
+#define MAX_SOFT_THREADS    4
+#define MIRROR_STATS_FRAMES 600
 #define DEBUG_MDP_ERRORS 	1
 
+/* compare every cached display state read with the driver and log mismatches */
+#ifndef DEBUG_STATE_CHECK
+#define DEBUG_STATE_CHECK   0
+#endif
+
+/* device node root, point it at stand-in nodes to run off target */
+#ifndef SUNXI_DEV_ROOT
+#define SUNXI_DEV_ROOT      "/dev"
+#endif
+
 #define LOG_NDEBUG          0
 
 int                         g_displaymode = 0;
@@ -48,6 +72,101 @@ int                         g_masterdisplay = 0;
 struct display_output_t     g_display[MAX_DISPLAY_NUM];
 pthread_mutex_t             mode_lock;
 bool                        mutex_inited = false;
+/* g2d request for one src/dst buffer pair, valid until an fb or an output mode changes */
+struct display_blit_t
+{
+    bool                        valid;
+    int                         srcfb_id;
+    int                         srcfb_bufno;
+    int                         dstfb_id;
+    int                         dstfb_bufno;
+    g2d_stretchblt              para;
+};
+
+/* dual same mirroring, the secondary fb follows the primary from its own thread */
+struct display_mirror_t
+{
+    pthread_t                   thread;
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;
+    bool                        started;
+    bool                        quit;
+    bool                        active;
+    int                         srcfb_id;
+    int                         dstfb_id;
+    int                         front;          /* secondary buffer scanning out */
+    int                         last_src;       /* primary buffer last mirrored */
+    int                         posted;         /* caller copies since the last mirror */
+    unsigned int                frames;
+    unsigned int                dropped;
+    int64_t                     latency_sum;    /* us, primary vsync to secondary latch */
+    int64_t                     latency_max;
+};
+
+/* what the driver reports for a screen, dropped on hotplug uevents and on our own mode changes */
+struct display_state_t
+{
+    bool                        valid;
+    int                         type;           /* DISPLAY_DEVICE_* */
+    int                         tvformat;       /* DISPLAY_TVFORMAT_* */
+    int                         width;
+    int                         height;
+};
+
+/* layouts with their own row kernels, the rest goes through display_softread and display_softwrite */
+enum
+{
+    DISPLAY_SOFT_OTHER = 0,
+    DISPLAY_SOFT_RGB565,
+    DISPLAY_SOFT_XRGB8888,
+    DISPLAY_SOFT_ARGB8888,
+    DISPLAY_SOFT_XBGR8888,
+    DISPLAY_SOFT_ABGR8888,
+};
+
+/* pixel layout of an fb as the cpu sees it */
+struct display_softfmt_t
+{
+    int                         bpp;
+    int                         offset[4];  /* r, g, b, a */
+    int                         length[4];
+    int                         layout;     /* DISPLAY_SOFT_* */
+};
+
+/* rows [y0, y1) of a software fb copy, one per thread */
+struct display_softcopy_t
+{
+    const unsigned char         *src;
+    int                         src_stride;
+    int                         src_w;
+    int                         src_h;
+    struct display_softfmt_t    src_fmt;
+    unsigned char               *dst;
+    int                         dst_stride;
+    int                         dst_w;
+    int                         dst_h;
+    struct display_softfmt_t    dst_fmt;
+    bool                        bilinear;
+    int                         y0;
+    int                         y1;
+};
+
+/* cpu fb copy workers, started by the first soft copy and kept until close */
+struct display_softpool_t
+{
+    pthread_mutex_t             lock;
+    pthread_cond_t              start;
+    pthread_cond_t              done;
+    bool                        started;
+    bool                        quit;
+    pthread_t                   thread[MAX_SOFT_THREADS];
+    int                         threads;        /* bands per copy, the caller copies band 0 */
+    int                         next;           /* band the next starting worker takes */
+    unsigned int                generation;     /* bumped for each copy handed to the workers */
+    int                         pending;        /* workers still copying their band */
+    struct display_softcopy_t   job[MAX_SOFT_THREADS];
+};
+
 /** State information for each device instance */
 struct display_context_t 
 {
@@ -55,6 +174,21 @@ struct display_context_t
     int                         mFD_fb[MAX_DISPLAY_NUM];
     int		                    mFD_disp;
     int                         mFD_mp;
+    pthread_mutex_t             copy_lock;      /* held over display_copyfb, guards blit and blit_next */
+    struct display_blit_t       blit[MAX_BLIT_CACHE_NUM];
+    int                         blit_next;
+    void                        *fb_addr[MAX_DISPLAY_NUM];  /* cpu mapping for the soft copy */
+    size_t                      fb_size[MAX_DISPLAY_NUM];
+    struct display_softpool_t   soft;
+    struct display_mirror_t     mirror;
+    pthread_mutex_t             state_lock;
+    struct display_state_t      state[MAX_DISPLAY_NUM];
+    bool                        hpd_valid;
+    int                         hpd;
+    bool                        uevent_started;     /* state is only cached while uevents are heard */
+    int                         uevent_fd;
+    int                         uevent_wake[2];
+    pthread_t                   uevent_thread;
 };
 
 struct display_fbpara_t
@@ -103,7 +237,7 @@ struct display_module_t HAL_MODULE_INFO_SYM =
       
 /*
 **********************************************************************************************************************
-*                                               display_gethdmistatus
+*                                               display_readhdmistatus
 *
 * author:           
 *
@@ -118,7 +252,7 @@ struct display_module_t HAL_MODULE_INFO_SYM =
 * modify history: 
 **********************************************************************************************************************
 */
-static int display_gethdmistatus(struct display_device_t *dev)
+static int display_readhdmistatus(struct display_device_t *dev)
 {
     struct display_context_t* ctx = (struct display_context_t*)dev;
     
@@ -263,7 +397,7 @@ static int display_gettvdacstatus(struct display_device_t *dev)
       
 /*
 **********************************************************************************************************************
-*                                               display_getoutputtype
+*                                               display_readoutputtype
 *
 * author:           
 *
@@ -279,7 +413,7 @@ static int display_gettvdacstatus(struct display_device_t *dev)
 **********************************************************************************************************************
 */
 
-static int display_getoutputtype(struct display_device_t *dev,int displayno)
+static int display_readoutputtype(struct display_device_t *dev,int displayno)
 {
     struct display_context_t* ctx = (struct display_context_t*)dev;
     int                       ret;
@@ -316,7 +450,7 @@ static int display_getoutputtype(struct display_device_t *dev,int displayno)
 
 /*
 **********************************************************************************************************************
-*                                               display_gettvformat
+*                                               display_readtvformat
 *
 * author:           
 *
@@ -332,7 +466,7 @@ static int display_getoutputtype(struct display_device_t *dev,int displayno)
 **********************************************************************************************************************
 */
 
-static int display_gettvformat(struct display_device_t *dev,int displayno)
+static int display_readtvformat(struct display_device_t *dev,int displayno)
 {
     struct display_context_t* ctx = (struct display_context_t*)dev;
     int                       ret;
@@ -427,6 +561,266 @@ static int display_gettvformat(struct display_device_t *dev,int displayno)
 
     return  DISPLAY_TVFORMAT_480I;
 }
+/*
+**********************************************************************************************************************
+*                                               display_state
+*
+* author:           
+*
+* date:             
+*
+* Description:      cached display state. each screen is read from the driver once and kept until a hotplug
+*                   uevent or one of our own set mode / off calls drops it, framework polling is served from
+*                   the cache. without the uevent listener every read goes to the driver as before
+*
+* parameters:       
+*
+* return:           
+* modify history: 
+**********************************************************************************************************************
+*/
+
+/* the screen's state, read from the driver when it is not cached. state_lock held */
+static struct display_state_t *display_state(struct display_context_t* ctx,int displayno)
+{
+    struct display_state_t      *state = &ctx->state[displayno];
+    unsigned long               args[4] = {0};
+
+    if(!state->valid || !ctx->uevent_started)
+    {
+        args[0]         = displayno;
+        state->type     = display_readoutputtype(&ctx->device,displayno);
+        state->tvformat = display_readtvformat(&ctx->device,displayno);
+        state->width    = ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_WIDTH,args);
+        state->height   = ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_HEIGHT,args);
+        state->valid    = true;
+    }
+
+    return  state;
+}
+
+/* displayno -1 drops every screen and the hdmi hotplug status */
+static void display_invalidatestate(struct display_context_t* ctx,int displayno)
+{
+    int                         i;
+
+    pthread_mutex_lock(&ctx->state_lock);
+    for(i = 0;i < MAX_DISPLAY_NUM;i++)
+    {
+        if(displayno < 0 || displayno == i)
+        {
+            ctx->state[i].valid = false;
+        }
+    }
+    if(displayno < 0)
+    {
+        ctx->hpd_valid = false;
+    }
+    pthread_mutex_unlock(&ctx->state_lock);
+}
+
+#if DEBUG_STATE_CHECK
+static volatile int32_t     g_state_mismatches;     /* cached reads the driver disagreed with */
+
+static void display_checkstate(int displayno,const char *what,int cached,int driver)
+{
+    if(cached != driver)
+    {
+        android_atomic_inc(&g_state_mismatches);
+        ALOGE("display%d %s cached %d, driver reports %d\n",displayno,what,cached,driver);
+    }
+}
+#endif
+
+static int display_gethdmistatus(struct display_device_t *dev)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    int                         hpd;
+
+    pthread_mutex_lock(&ctx->state_lock);
+    if(!ctx->hpd_valid || !ctx->uevent_started)
+    {
+        ctx->hpd        = display_readhdmistatus(dev);
+        ctx->hpd_valid  = true;
+    }
+    hpd = ctx->hpd;
+    pthread_mutex_unlock(&ctx->state_lock);
+
+#if DEBUG_STATE_CHECK
+    display_checkstate(0,"hdmi hpd",hpd,display_readhdmistatus(dev));
+#endif
+
+    return  hpd;
+}
+
+static int display_getoutputtype(struct display_device_t *dev,int displayno)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    int                         type;
+
+    if(displayno < 0 || displayno >= MAX_DISPLAY_NUM)
+    {
+        return  DISPLAY_DEVICE_NONE;
+    }
+
+    pthread_mutex_lock(&ctx->state_lock);
+    type = display_state(ctx,displayno)->type;
+    pthread_mutex_unlock(&ctx->state_lock);
+
+#if DEBUG_STATE_CHECK
+    display_checkstate(displayno,"output type",type,display_readoutputtype(dev,displayno));
+#endif
+
+    return  type;
+}
+
+static int display_gettvformat(struct display_device_t *dev,int displayno)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    int                         tvformat;
+
+    if(displayno < 0 || displayno >= MAX_DISPLAY_NUM)
+    {
+        return  DISPLAY_TVFORMAT_480I;
+    }
+
+    pthread_mutex_lock(&ctx->state_lock);
+    tvformat = display_state(ctx,displayno)->tvformat;
+    pthread_mutex_unlock(&ctx->state_lock);
+
+#if DEBUG_STATE_CHECK
+    display_checkstate(displayno,"tv format",tvformat,display_readtvformat(dev,displayno));
+#endif
+
+    return  tvformat;
+}
+
+/* current screen size, for the DISPLAY_DEFAULT format */
+static int display_getscnsize(struct display_context_t* ctx,int displayno,bool height)
+{
+    int                         size;
+
+    if(displayno < 0 || displayno >= MAX_DISPLAY_NUM)
+    {
+        return  -1;
+    }
+
+    pthread_mutex_lock(&ctx->state_lock);
+    size = height ? display_state(ctx,displayno)->height : display_state(ctx,displayno)->width;
+    pthread_mutex_unlock(&ctx->state_lock);
+
+#if DEBUG_STATE_CHECK
+    unsigned long               args[4] = {0};
+
+    args[0] = displayno;
+    display_checkstate(displayno,height ? "height" : "width",size,
+                       ioctl(ctx->mFD_disp,height ? DISP_CMD_SCN_GET_HEIGHT : DISP_CMD_SCN_GET_WIDTH,args));
+#endif
+
+    return  size;
+}
+
+static void display_invalidateblit(struct display_context_t* ctx);
+
+/* hdmi and tv hotplug arrive as switch uevents, anything under a switch drops the cached state and the blits */
+static void *display_ueventthread(void *data)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)data;
+    struct pollfd               fds[2];
+    char                        buf[1024];
+    int                         len;
+
+    fds[0].fd       = ctx->uevent_fd;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = ctx->uevent_wake[0];
+    fds[1].events   = POLLIN;
+
+    while(1)
+    {
+        if(poll(fds,2,-1) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if(fds[1].revents)
+        {
+            break;
+        }
+        if(!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        len = recv(ctx->uevent_fd,buf,sizeof(buf) - 1,0);
+        if(len <= 0)
+        {
+            continue;
+        }
+        buf[len] = 0;
+
+        /* the first string is action@devpath */
+        if(strstr(buf,"/switch/"))
+        {
+            ALOGV("uevent %s, display state dropped\n",buf);
+            display_invalidatestate(ctx,-1);
+            display_invalidateblit(ctx);
+        }
+    }
+
+    return  NULL;
+}
+
+static void display_startuevent(struct display_context_t* ctx)
+{
+    struct sockaddr_nl          addr;
+
+    memset(&addr,0,sizeof(addr));
+    addr.nl_family  = AF_NETLINK;
+    addr.nl_groups  = 0xffffffff;
+
+    ctx->uevent_fd = socket(PF_NETLINK,SOCK_DGRAM,NETLINK_KOBJECT_UEVENT);
+    if(ctx->uevent_fd < 0)
+    {
+        ALOGE("uevent socket fail, display state is not cached\n");
+        return;
+    }
+
+    if(bind(ctx->uevent_fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || pipe(ctx->uevent_wake) < 0)
+    {
+        ALOGE("uevent bind fail, display state is not cached\n");
+        close(ctx->uevent_fd);
+        return;
+    }
+
+    if(pthread_create(&ctx->uevent_thread,NULL,display_ueventthread,ctx) != 0)
+    {
+        ALOGE("uevent thread create fail, display state is not cached\n");
+        close(ctx->uevent_wake[0]);
+        close(ctx->uevent_wake[1]);
+        close(ctx->uevent_fd);
+        return;
+    }
+
+    ctx->uevent_started = true;
+}
+
+static void display_stopuevent(struct display_context_t* ctx)
+{
+    if(!ctx->uevent_started)
+    {
+        return;
+    }
+
+    write(ctx->uevent_wake[1],"q",1);
+    pthread_join(ctx->uevent_thread,NULL);
+    close(ctx->uevent_wake[0]);
+    close(ctx->uevent_wake[1]);
+    close(ctx->uevent_fd);
+    ctx->uevent_started = false;
+}
       
 /*
 **********************************************************************************************************************
@@ -548,120 +942,999 @@ static int get_g2dpixelformat(int red_size,int red_offset,
                               int blue_size,int blue_offset,
                               int alpha_size,int alpha_offset)
 {
-    if((red_size == 8) && (red_offset = 0)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 16)
-       && (alpha_size == 8) && (alpha_offset = 24))
+    if((red_size == 8) && (red_offset == 0)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 16)
+       && (alpha_size == 8) && (alpha_offset == 24))
     {
         return G2D_FMT_ABGR_AVUY8888;
     }
-    else if((red_size == 8) && (red_offset = 16)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 0)
-       && (alpha_size == 8) && (alpha_offset = 24))
+    else if((red_size == 8) && (red_offset == 16)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 0)
+       && (alpha_size == 8) && (alpha_offset == 24))
     {
         return G2D_FMT_ARGB_AYUV8888;
     }
-    else if((red_size == 8) && (red_offset = 8)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 24)
-       && (alpha_size == 8) && (alpha_offset = 0))
+    else if((red_size == 8) && (red_offset == 8)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 24)
+       && (alpha_size == 8) && (alpha_offset == 0))
     {
         return G2D_FMT_BGRA_VUYA8888;
     }
-    else if((red_size == 8) && (red_offset = 24)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 8)
-       && (alpha_size == 8) && (alpha_offset = 0))
+    else if((red_size == 8) && (red_offset == 24)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 8)
+       && (alpha_size == 8) && (alpha_offset == 0))
     {
         return G2D_FMT_RGBA_YUVA8888;
     }
-    else if((red_size == 8) && (red_offset = 16)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 0)
-       && (alpha_size == 0) && (alpha_offset = 24))
+    else if((red_size == 8) && (red_offset == 16)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 0)
+       && (alpha_size == 0))
     {
         return G2D_FMT_XRGB8888;
     }
-    else if((red_size == 8) && (red_offset = 8)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 24)
-       && (alpha_size == 0) && (alpha_offset = 0))
+    else if((red_size == 8) && (red_offset == 8)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 24)
+       && (alpha_size == 0))
     {
         return G2D_FMT_BGRX8888;
     }
-    else if((red_size == 8) && (red_offset = 0)
-       && (green_size == 8) && (green_offset = 8)
-       && (blue_size == 8) && (blue_offset = 16)
-       && (alpha_size == 0) && (alpha_offset = 24))
+    else if((red_size == 8) && (red_offset == 0)
+       && (green_size == 8) && (green_offset == 8)
+       && (blue_size == 8) && (blue_offset == 16)
+       && (alpha_size == 0))
     {
         return G2D_FMT_XBGR8888;
     }
-    else if((red_size == 8) && (red_offset = 24)
-       && (green_size == 8) && (green_offset = 16)
-       && (blue_size == 8) && (blue_offset = 8)
-       && (alpha_size == 0) && (alpha_offset = 0))
+    else if((red_size == 8) && (red_offset == 24)
+       && (green_size == 8) && (green_offset == 16)
+       && (blue_size == 8) && (blue_offset == 8)
+       && (alpha_size == 0))
     {
         return G2D_FMT_RGBX8888;
     }
-    else if((red_size == 5) && (red_offset = 11)
-       && (green_size == 6) && (green_offset = 5)
-       && (blue_size == 5) && (blue_offset = 0))
+    else if((red_size == 5) && (red_offset == 11)
+       && (green_size == 6) && (green_offset == 5)
+       && (blue_size == 5) && (blue_offset == 0))
     {
         return G2D_FMT_RGB565;
     }
-    else if((red_size == 5) && (red_offset = 0)
-       && (green_size == 6) && (green_offset = 5)
-       && (blue_size == 5) && (blue_offset = 11))
+    else if((red_size == 5) && (red_offset == 0)
+       && (green_size == 6) && (green_offset == 5)
+       && (blue_size == 5) && (blue_offset == 11))
     {
         return G2D_FMT_BGR565;
     }
     else 
     {
-        return G2D_FMT_RGBA_YUVA8888;
+        return -1;
+    }
+}
+
+/*
+ * g2d format and pixel sequence of an fb, from its var bitfields. source and
+ * destination are negotiated separately, g2d converts between depths.
+ */
+static int display_g2dformat(const struct fb_var_screeninfo *var,g2d_data_fmt *format,g2d_pixel_seq *seq)
+{
+    int     fmt;
+
+    if(var->bits_per_pixel != 16 && var->bits_per_pixel != 32)
+    {
+        return  -1;
+    }
+
+    fmt = get_g2dpixelformat(var->red.length,var->red.offset,
+                             var->green.length,var->green.offset,
+                             var->blue.length,var->blue.offset,
+                             var->transp.length,var->transp.offset);
+    if(fmt < 0)
+    {
+        return  -1;
+    }
+
+    *format = (g2d_data_fmt)fmt;
+    *seq    = (var->bits_per_pixel == 16) ? G2D_SEQ_P10 : G2D_SEQ_NORMAL;
+
+    return  0;
+}
+      
+static int display_copyfbsoft(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                          int dstfb_id,int dstfb_bufno);
+
+static void display_invalidateblit(struct display_context_t* ctx)
+{
+    int i;
+
+    pthread_mutex_lock(&ctx->copy_lock);
+    for(i = 0;i < MAX_BLIT_CACHE_NUM;i++)
+    {
+        ctx->blit[i].valid = false;
+    }
+    pthread_mutex_unlock(&ctx->copy_lock);
+}
+
+static int display_buildblit(struct display_context_t* ctx,int srcfb_id,int srcfb_bufno,
+                             int dstfb_id,int dstfb_bufno,g2d_stretchblt *blit_para)
+{
+	struct fb_fix_screeninfo    fix_src;
+    struct fb_fix_screeninfo    fix_dst;
+    struct fb_var_screeninfo    var_src;
+    struct fb_var_screeninfo    var_dst;
+    char               			node_src[64];
+    char               			node_dst[64];
+    unsigned int                src_width;
+    unsigned int                src_height;
+    unsigned int                dst_width;
+    unsigned int                dst_height;
+    unsigned int                addr_src;
+    unsigned int                addr_dst;
+    
+    sprintf(node_src, SUNXI_DEV_ROOT "/graphics/fb%d", srcfb_id);
+
+    if(ctx->mFD_fb[srcfb_id] == 0)
+    {
+    	ctx->mFD_fb[srcfb_id]			= open(node_src,O_RDWR,0);
+    	if(ctx->mFD_fb[srcfb_id] <= 0)
+    	{
+    		ALOGE("open fb%d fail!\n",srcfb_id);
+    		
+    		ctx->mFD_fb[srcfb_id]		= 0;
+    		
+    		return  -1;
+    	}
+	}
+
+    sprintf(node_dst, SUNXI_DEV_ROOT "/graphics/fb%d", dstfb_id);
+
+    if(ctx->mFD_fb[dstfb_id] == 0)
+    {
+    	ctx->mFD_fb[dstfb_id]			= open(node_dst,O_RDWR,0);
+    	if(ctx->mFD_fb[dstfb_id] <= 0)
+    	{
+    		ALOGE("open fb%d fail!\n",dstfb_id);
+    		
+    		ctx->mFD_fb[dstfb_id]		= 0;
+    		
+    		return  -1;
+    	}
+	}
+
+	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_FSCREENINFO,&fix_src);
+	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_VSCREENINFO,&var_src);
+	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_FSCREENINFO,&fix_dst);
+	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_VSCREENINFO,&var_dst);
+	
+	src_width   = var_src.xres;
+	src_height  = var_src.yres;
+    dst_width   = var_dst.xres;
+    dst_height  = var_dst.yres;
+    
+	addr_src = fix_src.smem_start + ((var_src.xres * (srcfb_bufno * var_src.yres) * var_src.bits_per_pixel) >> 3);
+	addr_dst = fix_dst.smem_start + ((var_dst.xres * (dstfb_bufno * var_dst.yres) * var_dst.bits_per_pixel) >> 3);
+
+    if(display_g2dformat(&var_src,&blit_para->src_image.format,&blit_para->src_image.pixel_seq) != 0
+       || display_g2dformat(&var_dst,&blit_para->dst_image.format,&blit_para->dst_image.pixel_seq) != 0)
+    {
+        ALOGE("no g2d format for fb%d (%d bpp) to fb%d (%d bpp)\n",
+              srcfb_id,var_src.bits_per_pixel,dstfb_id,var_dst.bits_per_pixel);
+        return -1;
+    }
+
+    blit_para->src_image.addr[0]     = addr_src;
+    blit_para->src_image.addr[1]     = 0;
+    blit_para->src_image.addr[2]     = 0;
+    blit_para->src_image.h           = src_height;
+    blit_para->src_image.w           = src_width;
+
+    blit_para->dst_image.addr[0]     = addr_dst;
+    blit_para->dst_image.addr[1]     = 0;
+    blit_para->dst_image.addr[2]     = 0;
+    blit_para->dst_image.h           = dst_height;
+    blit_para->dst_image.w           = dst_width;
+
+    //blit_para->dst_x                 = 0;
+    //blit_para->dst_y                 = 0;
+    blit_para->dst_rect.x            = 0;
+    blit_para->dst_rect.y            = 0;
+    blit_para->dst_rect.w            = dst_width;
+    blit_para->dst_rect.h            = dst_height;
+
+    blit_para->src_rect.x            = 0;
+    blit_para->src_rect.y            = 0;
+    blit_para->src_rect.w            = src_width;
+    blit_para->src_rect.h            = src_height;
+
+    blit_para->flag                 = G2D_BLT_NONE;
+
+    return  0;
+}
+
+/*
+**********************************************************************************************************************
+*                                               display_copyfb
+*
+* author:           
+*
+* date:             2011-7-17:11:22:54
+*
+* Description:      copy from src fb to dst fb 
+*
+* parameters:       
+*
+* return:           if success return GUI_RET_OK
+*                   if fail return the number of fail
+* modify history: 
+**********************************************************************************************************************
+*/
+
+/* in dual same mode this runs every frame, so the request is only built once per buffer pair. copy_lock held */
+static int display_copyfbg2d(struct display_context_t* ctx,int srcfb_id,int srcfb_bufno,
+                             int dstfb_id,int dstfb_bufno)
+{
+    struct display_blit_t       *blit = NULL;
+    int                         i;
+
+    if(ctx->mFD_mp == 0)
+    {
+        ctx->mFD_mp                     = open(SUNXI_DEV_ROOT "/g2d", O_RDWR, 0);
+        if(ctx->mFD_mp < 0)
+        {
+            ALOGE("open g2d driver fail!\n");
+    		
+    		ctx->mFD_mp		= 0;
+
+            return  -1;
+        }
+    }
+
+    for(i = 0;i < MAX_BLIT_CACHE_NUM;i++)
+    {
+        if(ctx->blit[i].valid
+           && ctx->blit[i].srcfb_id == srcfb_id && ctx->blit[i].srcfb_bufno == srcfb_bufno
+           && ctx->blit[i].dstfb_id == dstfb_id && ctx->blit[i].dstfb_bufno == dstfb_bufno)
+        {
+            blit = &ctx->blit[i];
+            break;
+        }
+    }
+
+    if(blit == NULL)
+    {
+        blit                = &ctx->blit[ctx->blit_next];
+        ctx->blit_next      = (ctx->blit_next + 1) % MAX_BLIT_CACHE_NUM;
+        blit->valid         = false;
+        if(display_buildblit(ctx,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,&blit->para) != 0)
+        {
+            return  -1;
+        }
+        blit->srcfb_id      = srcfb_id;
+        blit->srcfb_bufno   = srcfb_bufno;
+        blit->dstfb_id      = dstfb_id;
+        blit->dstfb_bufno   = dstfb_bufno;
+        blit->valid         = true;
+    }
+
+    if(ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)&blit->para) < 0)
+    {    
+        ALOGE("copy fb failed, copying with the cpu!\n");
+        
+        return  -1;
+    }
+
+    return  0;
+}
+
+/*
+ * the mirror thread and the callers' own copies both come through here. copy_lock keeps them
+ * from writing one fb at the same time and guards the blit cache against fb and mode changes
+ */
+static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                          int dstfb_id,int dstfb_bufno)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
+    int                         ret = 0;
+
+    pthread_mutex_lock(&ctx->copy_lock);
+    if(display_copyfbg2d(ctx,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno) != 0)
+    {
+        ret = display_copyfbsoft(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno);
+    }
+    pthread_mutex_unlock(&ctx->copy_lock);
+
+    return  ret;
+}
+
+/*
+ * 16 and 32 bpp with channels of 4 to 8 bits, what display_softread and display_softwrite
+ * expand and truncate exactly. anything else is left to g2d
+ */
+static int display_softfmt(const struct fb_var_screeninfo *var,struct display_softfmt_t *fmt)
+{
+    int         i;
+
+    if(var->bits_per_pixel != 16 && var->bits_per_pixel != 32)
+    {
+        return  -1;
+    }
+
+    fmt->bpp            = var->bits_per_pixel;
+    fmt->offset[0]      = var->red.offset;
+    fmt->length[0]      = var->red.length;
+    fmt->offset[1]      = var->green.offset;
+    fmt->length[1]      = var->green.length;
+    fmt->offset[2]      = var->blue.offset;
+    fmt->length[2]      = var->blue.length;
+    fmt->offset[3]      = var->transp.offset;
+    fmt->length[3]      = var->transp.length;
+
+    for(i = 0;i < 4;i++)
+    {
+        if(fmt->length[i] != 0 && (fmt->length[i] < 4 || fmt->length[i] > 8))
+        {
+            return  -1;
+        }
+    }
+
+    fmt->layout         = DISPLAY_SOFT_OTHER;
+    if(fmt->bpp == 16)
+    {
+        if(fmt->offset[0] == 11 && fmt->length[0] == 5 && fmt->offset[1] == 5 && fmt->length[1] == 6
+           && fmt->offset[2] == 0 && fmt->length[2] == 5 && fmt->length[3] == 0)
+        {
+            fmt->layout = DISPLAY_SOFT_RGB565;
+        }
+    }
+    else if(fmt->length[0] == 8 && fmt->offset[1] == 8 && fmt->length[1] == 8 && fmt->length[2] == 8
+            && (fmt->length[3] == 0 || (fmt->offset[3] == 24 && fmt->length[3] == 8)))
+    {
+        if(fmt->offset[0] == 16 && fmt->offset[2] == 0)
+        {
+            fmt->layout = fmt->length[3] ? DISPLAY_SOFT_ARGB8888 : DISPLAY_SOFT_XRGB8888;
+        }
+        else if(fmt->offset[0] == 0 && fmt->offset[2] == 16)
+        {
+            fmt->layout = fmt->length[3] ? DISPLAY_SOFT_ABGR8888 : DISPLAY_SOFT_XBGR8888;
+        }
+    }
+
+    return  0;
+}
+
+static inline uint32_t display_softread(const unsigned char *line,int x,const struct display_softfmt_t *fmt)
+{
+    uint32_t    raw;
+    uint32_t    argb = 0;
+    int         i;
+
+    if(fmt->bpp == 16)
+    {
+        raw = ((const uint16_t *)line)[x];
+    }
+    else
+    {
+        raw = ((const uint32_t *)line)[x];
+    }
+
+    // channels are expanded to 8 bits by repeating their top bits, a missing alpha reads as opaque
+    for(i = 0;i < 4;i++)
+    {
+        uint32_t    c;
+        int         len = fmt->length[i];
+
+        if(len == 0)
+        {
+            c = (i == 3) ? 0xff : 0;
+        }
+        else
+        {
+            c = (raw >> fmt->offset[i]) & ((1 << len) - 1);
+            c = (c << (8 - len)) | (c >> (2 * len - 8));
+        }
+        argb |= c << ((i == 3) ? 24 : 16 - 8 * i);
+    }
+
+    return argb;
+}
+
+static inline void display_softwrite(unsigned char *line,int x,uint32_t argb,const struct display_softfmt_t *fmt)
+{
+    uint32_t    raw = 0;
+    int         i;
+
+    for(i = 0;i < 4;i++)
+    {
+        uint32_t    c = (argb >> ((i == 3) ? 24 : 16 - 8 * i)) & 0xff;
+        int         len = fmt->length[i];
+
+        if(len == 0)
+        {
+            continue;
+        }
+        raw |= (c >> (8 - len)) << fmt->offset[i];
+    }
+
+    if(fmt->bpp == 16)
+    {
+        ((uint16_t *)line)[x] = raw;
+    }
+    else
+    {
+        ((uint32_t *)line)[x] = raw;
+    }
+}
+
+/* blend two argb pixels, w is the weight of b in 1/256 */
+static inline uint32_t display_softlerp(uint32_t a,uint32_t b,uint32_t w)
+{
+    uint32_t    rb = ((((b & 0x00ff00ff) - (a & 0x00ff00ff)) * w) >> 8) + (a & 0x00ff00ff);
+    uint32_t    ag = (((((b >> 8) & 0x00ff00ff) - ((a >> 8) & 0x00ff00ff)) * w) >> 8) + ((a >> 8) & 0x00ff00ff);
+
+    return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+/*
+ * row kernels for the layouts display_softfmt recognises. they go through argb8888 rows and
+ * give the same pixels as display_softread and display_softwrite, which stay the reference
+ * and the path for every other layout. the plain loops are left for the compiler to
+ * vectorise, the neon bodies take the whole vectors and leave the tail to them
+ */
+static void display_soft565to8888(uint32_t *dst,const uint16_t *src,int n)
+{
+    int         i = 0;
+
+#ifdef __ARM_NEON__
+    for(;i + 8 <= n;i += 8)
+    {
+        uint16x8_t  p = vld1q_u16(src + i);
+        uint8x8x4_t o;
+        uint8x8_t   r = vand_u8(vshrn_n_u16(p,8),vdup_n_u8(0xf8));
+        uint8x8_t   g = vand_u8(vshrn_n_u16(p,3),vdup_n_u8(0xfc));
+        uint8x8_t   b = vmovn_u16(vshlq_n_u16(p,3));
+
+        o.val[0]    = vorr_u8(b,vshr_n_u8(b,5));
+        o.val[1]    = vorr_u8(g,vshr_n_u8(g,6));
+        o.val[2]    = vorr_u8(r,vshr_n_u8(r,5));
+        o.val[3]    = vdup_n_u8(0xff);
+        vst4_u8((uint8_t *)(dst + i),o);
+    }
+#endif
+    for(;i < n;i++)
+    {
+        uint32_t    p = src[i];
+        uint32_t    r = (p >> 8) & 0xf8;
+        uint32_t    g = (p >> 3) & 0xfc;
+        uint32_t    b = (p << 3) & 0xf8;
+
+        dst[i] = 0xff000000 | ((r | (r >> 5)) << 16) | ((g | (g >> 6)) << 8) | (b | (b >> 5));
+    }
+}
+
+static void display_soft8888to565(uint16_t *dst,const uint32_t *src,int n)
+{
+    int         i = 0;
+
+#ifdef __ARM_NEON__
+    for(;i + 8 <= n;i += 8)
+    {
+        uint8x8x4_t p = vld4_u8((const uint8_t *)(src + i));
+        uint16x8_t  o = vshll_n_u8(p.val[2],8);
+
+        o = vsriq_n_u16(o,vshll_n_u8(p.val[1],8),5);
+        o = vsriq_n_u16(o,vshll_n_u8(p.val[0],8),11);
+        vst1q_u16(dst + i,o);
+    }
+#endif
+    for(;i < n;i++)
+    {
+        uint32_t    p = src[i];
+
+        dst[i] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+    }
+}
+
+/* swaps r and b, then keeps the bits in keep and sets set. only the alpha byte differs from ~0 and 0 */
+static void display_softswap8888(uint32_t *dst,const uint32_t *src,int n,uint32_t keep,uint32_t set)
+{
+    int         i = 0;
+
+#ifdef __ARM_NEON__
+    uint8x16_t  keep_a = vdupq_n_u8(keep >> 24);
+    uint8x16_t  set_a = vdupq_n_u8(set >> 24);
+
+    for(;i + 16 <= n;i += 16)
+    {
+        uint8x16x4_t    p = vld4q_u8((const uint8_t *)(src + i));
+        uint8x16_t      r = p.val[2];
+
+        p.val[2]    = p.val[0];
+        p.val[0]    = r;
+        p.val[3]    = vorrq_u8(vandq_u8(p.val[3],keep_a),set_a);
+        vst4q_u8((uint8_t *)(dst + i),p);
+    }
+#endif
+    for(;i < n;i++)
+    {
+        uint32_t    p = src[i];
+
+        dst[i] = ((((p >> 16) & 0xff) | (p & 0xff00ff00) | ((p & 0xff) << 16)) & keep) | set;
+    }
+}
+
+static void display_softmask8888(uint32_t *dst,const uint32_t *src,int n,uint32_t keep,uint32_t set)
+{
+    int         i = 0;
+
+#ifdef __ARM_NEON__
+    uint32x4_t  keep_q = vdupq_n_u32(keep);
+    uint32x4_t  set_q = vdupq_n_u32(set);
+
+    for(;i + 4 <= n;i += 4)
+    {
+        vst1q_u32(dst + i,vorrq_u32(vandq_u32(vld1q_u32(src + i),keep_q),set_q));
+    }
+#endif
+    for(;i < n;i++)
+    {
+        dst[i] = (src[i] & keep) | set;
+    }
+}
+
+/* display_softlerp over a row of argb pixels, w from 1 to 255 */
+static void display_softblend(uint32_t *dst,const uint32_t *a,const uint32_t *b,int n,uint32_t w)
+{
+    int         i = 0;
+
+#ifdef __ARM_NEON__
+    // a * (256 - w) + b * w fits 16 bits and rounds like the packed sum of display_softlerp
+    uint8x8_t   wa = vdup_n_u8(256 - w);
+    uint8x8_t   wb = vdup_n_u8(w);
+
+    for(;i + 4 <= n;i += 4)
+    {
+        uint8x16_t  pa = vld1q_u8((const uint8_t *)(a + i));
+        uint8x16_t  pb = vld1q_u8((const uint8_t *)(b + i));
+        uint16x8_t  lo = vmlal_u8(vmull_u8(vget_low_u8(pa),wa),vget_low_u8(pb),wb);
+        uint16x8_t  hi = vmlal_u8(vmull_u8(vget_high_u8(pa),wa),vget_high_u8(pb),wb);
+
+        vst1q_u8((uint8_t *)(dst + i),vcombine_u8(vshrn_n_u16(lo,8),vshrn_n_u16(hi,8)));
+    }
+#endif
+    for(;i < n;i++)
+    {
+        dst[i] = display_softlerp(a[i],b[i],w);
+    }
+}
+
+/* line as argb8888, in tmp unless it already is */
+static const uint32_t *display_softtoargb(const unsigned char *line,int n,int layout,uint32_t *tmp)
+{
+    switch(layout)
+    {
+        case DISPLAY_SOFT_RGB565:
+            display_soft565to8888(tmp,(const uint16_t *)line,n);
+            return tmp;
+        case DISPLAY_SOFT_XRGB8888:
+            display_softmask8888(tmp,(const uint32_t *)line,n,0xffffffff,0xff000000);
+            return tmp;
+        case DISPLAY_SOFT_XBGR8888:
+            display_softswap8888(tmp,(const uint32_t *)line,n,0xffffffff,0xff000000);
+            return tmp;
+        case DISPLAY_SOFT_ABGR8888:
+            display_softswap8888(tmp,(const uint32_t *)line,n,0xffffffff,0);
+            return tmp;
+        default:
+            return (const uint32_t *)line;
+    }
+}
+
+static void display_softfromargb(unsigned char *line,const uint32_t *argb,int n,int layout)
+{
+    switch(layout)
+    {
+        case DISPLAY_SOFT_RGB565:
+            display_soft8888to565((uint16_t *)line,argb,n);
+            break;
+        case DISPLAY_SOFT_XRGB8888:
+            display_softmask8888((uint32_t *)line,argb,n,0x00ffffff,0);
+            break;
+        case DISPLAY_SOFT_XBGR8888:
+            display_softswap8888((uint32_t *)line,argb,n,0x00ffffff,0);
+            break;
+        case DISPLAY_SOFT_ABGR8888:
+            display_softswap8888((uint32_t *)line,argb,n,0xffffffff,0);
+            break;
+        default:
+            if((const unsigned char *)argb != line)
+            {
+                memcpy(line,argb,n * 4);
+            }
+            break;
+    }
+}
+
+/* one pixel at a time through display_softread and display_softwrite, any layout */
+static void display_softcopy_ref(const struct display_softcopy_t *job)
+{
+    // 16.16 fixed point source step per destination pixel
+    uint32_t                    step_x = ((uint32_t)job->src_w << 16) / job->dst_w;
+    uint32_t                    step_y = ((uint32_t)job->src_h << 16) / job->dst_h;
+    int                         x;
+    int                         y;
+
+    for(y = job->y0;y < job->y1;y++)
+    {
+        unsigned char   *dst = job->dst + y * job->dst_stride;
+
+        if(!job->bilinear)
+        {
+            const unsigned char *src = job->src + ((y * step_y) >> 16) * job->src_stride;
+            uint32_t            sx = 0;
+
+            for(x = 0;x < job->dst_w;x++,sx += step_x)
+            {
+                display_softwrite(dst,x,display_softread(src,sx >> 16,&job->src_fmt),&job->dst_fmt);
+            }
+        }
+        else
+        {
+            uint32_t            sy = y * step_y;
+            int                 y0 = sy >> 16;
+            int                 y1 = (y0 + 1 < job->src_h) ? y0 + 1 : y0;
+            uint32_t            wy = (sy >> 8) & 0xff;
+            const unsigned char *src0 = job->src + y0 * job->src_stride;
+            const unsigned char *src1 = job->src + y1 * job->src_stride;
+            uint32_t            sx = 0;
+
+            for(x = 0;x < job->dst_w;x++,sx += step_x)
+            {
+                int         x0 = sx >> 16;
+                int         x1 = (x0 + 1 < job->src_w) ? x0 + 1 : x0;
+                uint32_t    wx = (sx >> 8) & 0xff;
+                uint32_t    top = display_softlerp(display_softread(src0,x0,&job->src_fmt),display_softread(src0,x1,&job->src_fmt),wx);
+                uint32_t    bot = display_softlerp(display_softread(src1,x0,&job->src_fmt),display_softread(src1,x1,&job->src_fmt),wx);
+
+                display_softwrite(dst,x,display_softlerp(top,bot,wy),&job->dst_fmt);
+            }
+        }
+    }
+}
+
+/* source line y scaled across to dst_w argb pixels, in out unless nearest has nothing to scale */
+static const uint32_t *display_softscale_line(const struct display_softcopy_t *job,int y,const int *xs,const uint8_t *ws,
+                                              uint32_t *line,uint32_t *out)
+{
+    const uint32_t  *src = display_softtoargb(job->src + y * job->src_stride,job->src_w,job->src_fmt.layout,line);
+    int             x;
+
+    if(ws == NULL)
+    {
+        if(job->src_w == job->dst_w)
+        {
+            return src;
+        }
+        for(x = 0;x < job->dst_w;x++)
+        {
+            out[x] = src[xs[x]];
+        }
+        return out;
+    }
+
+    for(x = 0;x < job->dst_w;x++)
+    {
+        int         x0 = xs[x];
+        int         x1 = (x0 + 1 < job->src_w) ? x0 + 1 : x0;
+
+        out[x] = display_softlerp(src[x0],src[x1],ws[x]);
+    }
+    return out;
+}
+
+/*
+ * the row kernels. every source line is converted and scaled across once, nearest repeats
+ * the destination line above it and bilinear keeps the two scaled lines it blends between
+ */
+static int display_softcopy_fast(const struct display_softcopy_t *job)
+{
+    uint32_t                    step_x = ((uint32_t)job->src_w << 16) / job->dst_w;
+    uint32_t                    step_y = ((uint32_t)job->src_h << 16) / job->dst_h;
+    int                         dst_bytes = (job->dst_w * job->dst_fmt.bpp) >> 3;
+    int                         n = job->dst_w;
+    unsigned char               *mem;
+    uint32_t                    *line;
+    uint32_t                    *scaled[2];
+    uint32_t                    *out;
+    int                         *xs;
+    uint8_t                     *ws;
+    int                         held[2] = { -1, -1 };
+    int                         x;
+    int                         y;
+
+    mem = (unsigned char *)malloc((job->src_w + 3 * n) * sizeof(uint32_t) + n * sizeof(int) + n);
+    if(mem == NULL)
+    {
+        return  -1;
+    }
+    line        = (uint32_t *)mem;
+    scaled[0]   = line + job->src_w;
+    scaled[1]   = scaled[0] + n;
+    out         = scaled[1] + n;
+    xs          = (int *)(out + n);
+    ws          = job->bilinear ? (uint8_t *)(xs + n) : NULL;
+    for(x = 0;x < n;x++)
+    {
+        xs[x] = (x * step_x) >> 16;
+        if(ws)
+        {
+            ws[x] = ((x * step_x) >> 8) & 0xff;
+        }
+    }
+
+    for(y = job->y0;y < job->y1;y++)
+    {
+        unsigned char   *dst = job->dst + y * job->dst_stride;
+        uint32_t        sy = y * step_y;
+        int             y0 = sy >> 16;
+        int             y1 = (y0 + 1 < job->src_h) ? y0 + 1 : y0;
+        uint32_t        wy = (sy >> 8) & 0xff;
+
+        if(!job->bilinear)
+        {
+            if(y > job->y0 && held[0] == y0)
+            {
+                memcpy(dst,dst - job->dst_stride,dst_bytes);
+            }
+            else
+            {
+                display_softfromargb(dst,display_softscale_line(job,y0,xs,ws,line,out),n,job->dst_fmt.layout);
+                held[0] = y0;
+            }
+            continue;
+        }
+
+        if(held[0] != y0)
+        {
+            if(held[1] == y0)
+            {
+                uint32_t    *t = scaled[0];
+
+                scaled[0]   = scaled[1];
+                scaled[1]   = t;
+                held[1]     = held[0];
+            }
+            else
+            {
+                display_softscale_line(job,y0,xs,ws,line,scaled[0]);
+            }
+            held[0] = y0;
+        }
+
+        if(wy == 0)
+        {
+            display_softfromargb(dst,scaled[0],n,job->dst_fmt.layout);
+            continue;
+        }
+
+        if(held[1] != y1)
+        {
+            display_softscale_line(job,y1,xs,ws,line,scaled[1]);
+            held[1] = y1;
+        }
+        if(job->dst_fmt.layout == DISPLAY_SOFT_ARGB8888)
+        {
+            display_softblend((uint32_t *)dst,scaled[0],scaled[1],n,wy);
+        }
+        else
+        {
+            display_softblend(out,scaled[0],scaled[1],n,wy);
+            display_softfromargb(dst,out,n,job->dst_fmt.layout);
+        }
+    }
+
+    free(mem);
+
+    return  0;
+}
+
+static void *display_softcopy_rows(void *data)
+{
+    struct display_softcopy_t   *job = (struct display_softcopy_t *)data;
+    bool                        same = (job->src_fmt.bpp == job->dst_fmt.bpp)
+                                       && !memcmp(job->src_fmt.offset,job->dst_fmt.offset,sizeof(job->src_fmt.offset))
+                                       && !memcmp(job->src_fmt.length,job->dst_fmt.length,sizeof(job->src_fmt.length));
+    int                         y;
+
+    if(same && job->src_w == job->dst_w && job->src_h == job->dst_h)
+    {
+        for(y = job->y0;y < job->y1;y++)
+        {
+            memcpy(job->dst + y * job->dst_stride,job->src + y * job->src_stride,(job->dst_w * job->dst_fmt.bpp) >> 3);
+        }
+        return NULL;
+    }
+
+    if(job->src_fmt.layout == DISPLAY_SOFT_OTHER || job->dst_fmt.layout == DISPLAY_SOFT_OTHER
+       || display_softcopy_fast(job) != 0)
+    {
+        display_softcopy_ref(job);
+    }
+
+    return NULL;
+}
+
+static void *display_softworker(void *data)
+{
+    struct display_softpool_t   *pool = (struct display_softpool_t *)data;
+    unsigned int                seen = 0;
+    int                         band;
+
+    pthread_mutex_lock(&pool->lock);
+    band = ++pool->next;
+    while(1)
+    {
+        while(!pool->quit && pool->generation == seen)
+        {
+            pthread_cond_wait(&pool->start,&pool->lock);
+        }
+        if(pool->quit)
+        {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        display_softcopy_rows(&pool->job[band]);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->pending == 0)
+        {
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* pool lock held. workers that fail to start just leave fewer bands */
+static void display_softstart(struct display_softpool_t *pool)
+{
+    int     threads;
+    int     i;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > MAX_SOFT_THREADS)
+    {
+        threads = MAX_SOFT_THREADS;
+    }
+
+    pool->threads   = 1;
+    pool->next      = 0;
+    for(i = 1;i < threads;i++)
+    {
+        if(pthread_create(&pool->thread[i],NULL,display_softworker,pool) != 0)
+        {
+            break;
+        }
+        pool->threads++;
+    }
+    pool->started   = true;
+}
+
+static void display_softstop(struct display_softpool_t *pool)
+{
+    int     i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(i = 1;i < pool->threads;i++)
+    {
+        pthread_join(pool->thread[i],NULL);
+    }
+}
+
+/* splits copy into bands over the workers and copies the first one on the calling thread */
+static void display_softcopy(struct display_softpool_t *pool,const struct display_softcopy_t *copy)
+{
+    struct display_softcopy_t   first;
+    int                         i;
+
+    pthread_mutex_lock(&pool->lock);
+    if(!pool->started)
+    {
+        display_softstart(pool);
+    }
+    // the workers' bands belong to one copy at a time
+    while(pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->done,&pool->lock);
+    }
+    for(i = 0;i < pool->threads;i++)
+    {
+        pool->job[i]        = *copy;
+        pool->job[i].y0     = copy->dst_h * i / pool->threads;
+        pool->job[i].y1     = copy->dst_h * (i + 1) / pool->threads;
+    }
+    first = pool->job[0];
+    if(pool->threads > 1)
+    {
+        pool->pending = pool->threads - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    display_softcopy_rows(&first);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->done,&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static unsigned char *display_mapfb(struct display_context_t* ctx,int fb_id,struct fb_fix_screeninfo *fix)
+{
+    void    *addr;
+
+    if(ctx->fb_addr[fb_id] && ctx->fb_size[fb_id] == fix->smem_len)
+    {
+        return (unsigned char *)ctx->fb_addr[fb_id];
+    }
+
+    if(ctx->fb_addr[fb_id])
+    {
+        munmap(ctx->fb_addr[fb_id],ctx->fb_size[fb_id]);
+        ctx->fb_addr[fb_id] = NULL;
+    }
+
+    addr = mmap(NULL,fix->smem_len,PROT_READ | PROT_WRITE,MAP_SHARED,ctx->mFD_fb[fb_id],0);
+    if(addr == MAP_FAILED)
+    {
+        ALOGE("mmap fb%d fail!\n",fb_id);
+
+        return NULL;
+    }
+
+    ctx->fb_addr[fb_id] = addr;
+    ctx->fb_size[fb_id] = fix->smem_len;
+
+    return (unsigned char *)addr;
+}
+
+static void display_unmapfb(struct display_context_t* ctx,int fb_id)
+{
+    if(ctx->fb_addr[fb_id])
+    {
+        munmap(ctx->fb_addr[fb_id],ctx->fb_size[fb_id]);
+        ctx->fb_addr[fb_id] = NULL;
+        ctx->fb_size[fb_id] = 0;
     }
 }
       
-/*
-**********************************************************************************************************************
-*                                               display_copyfb
-*
-* author:           
-*
-* date:             2011-7-17:11:22:54
-*
-* Description:      copy from src fb to dst fb 
-*
-* parameters:       
-*
-* return:           if success return GUI_RET_OK
-*                   if fail return the number of fail
-* modify history: 
-**********************************************************************************************************************
-*/
-
-static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
-                          int dstfb_id,int dstfb_bufno)
+/* maps both fbs and describes the copy of one buffer into the other for display_softcopy */
+static int display_softsetup(struct display_context_t* ctx,int srcfb_id,int srcfb_bufno,
+                             int dstfb_id,int dstfb_bufno,struct display_softcopy_t *copy)
 {
-    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    
 	struct fb_fix_screeninfo    fix_src;
     struct fb_fix_screeninfo    fix_dst;
     struct fb_var_screeninfo    var_src;
     struct fb_var_screeninfo    var_dst;
-    char               			node_src[20];
-    char               			node_dst[20];
-    unsigned int                src_width;
-    unsigned int                src_height;
-    unsigned int                dst_width;
-    unsigned int                dst_height;
-    unsigned int                addr_src;
-    unsigned int                addr_dst;
-    unsigned int                size;
-    g2d_stretchblt              blit_para;
-    int                         err;
+    char               			node_src[64];
+    char               			node_dst[64];
+    unsigned char               *src;
+    unsigned char               *dst;
     
-    sprintf(node_src, "/dev/graphics/fb%d", srcfb_id);
+    sprintf(node_src, SUNXI_DEV_ROOT "/graphics/fb%d", srcfb_id);
 
     if(ctx->mFD_fb[srcfb_id] == 0)
     {
@@ -676,7 +1949,7 @@ static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bu
     	}
 	}
 
-    sprintf(node_dst, "/dev/graphics/fb%d", dstfb_id);
+    sprintf(node_dst, SUNXI_DEV_ROOT "/graphics/fb%d", dstfb_id);
 
     if(ctx->mFD_fb[dstfb_id] == 0)
     {
@@ -690,112 +1963,49 @@ static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bu
     		return  -1;
     	}
 	}
-
-    if(ctx->mFD_mp == 0)
-    {
-        ctx->mFD_mp                     = open("/dev/g2d", O_RDWR, 0);
-        if(ctx->mFD_mp < 0)
-        {
-            ALOGE("open g2d driver fail!\n");
-    		
-    		ctx->mFD_mp		= 0;
-
-            return -1;
-        }
-    }
     
 	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_FSCREENINFO,&fix_src);
 	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_VSCREENINFO,&var_src);
 	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_FSCREENINFO,&fix_dst);
 	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_VSCREENINFO,&var_dst);
-	
-	src_width   = var_src.xres;
-	src_height  = var_src.yres;
-    dst_width   = var_dst.xres;
-    dst_height  = var_dst.yres;
-    
-    //ALOGD("src_width = %d\n",src_width);
-    //ALOGD("src_height = %d\n",src_height);
-    //ALOGD("dst_width = %d\n",dst_width);
-    //ALOGD("dst_height = %d\n",dst_height);
-    
-	addr_src = fix_src.smem_start + ((var_src.xres * (srcfb_bufno * var_src.yres) * var_src.bits_per_pixel) >> 3);
-	addr_dst = fix_dst.smem_start + ((var_dst.xres * (dstfb_bufno * var_dst.yres) * var_dst.bits_per_pixel) >> 3);
-	size = (var_src.xres * var_src.yres * var_src.bits_per_pixel) >> 3;//in byte unit
-	
-	//ALOGD("addr_src = %x\n",addr_src);
-    //ALOGD("addr_dst = %x\n",addr_dst);
-    //ALOGD("size = %d\n",size);
-	switch (var_src.bits_per_pixel) 
-	{			
-    	case 16:
-    		blit_para.src_image.format      = G2D_FMT_RGB565;
-    		break;
-    		
-    	case 24:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	case 32:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	default:
-    	    ALOGE("invalid bits_per_pixel :%d\n", var_src.bits_per_pixel);
-    		return -1;
-	}
 
-    blit_para.src_image.addr[0]     = addr_src;
-    blit_para.src_image.addr[1]     = 0;
-    blit_para.src_image.addr[2]     = 0;
-    blit_para.src_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.src_image.h           = src_height;
-    blit_para.src_image.w           = src_width;
-    blit_para.src_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    blit_para.dst_image.addr[0]     = addr_dst;
-    blit_para.dst_image.addr[1]     = 0;
-    blit_para.dst_image.addr[2]     = 0;
-    blit_para.dst_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.dst_image.h           = dst_height;
-    blit_para.dst_image.w           = dst_width;
-    blit_para.dst_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    //blit_para.dst_x                 = 0;
-    //blit_para.dst_y                 = 0;
-    blit_para.dst_rect.x            = 0;
-    blit_para.dst_rect.y            = 0;
-    blit_para.dst_rect.w            = dst_width;
-    blit_para.dst_rect.h            = dst_height;
-
-    blit_para.src_rect.x            = 0;
-    blit_para.src_rect.y            = 0;
-    blit_para.src_rect.w            = src_width;
-    blit_para.src_rect.h            = src_height;
-
-    blit_para.flag                 = G2D_BLT_NONE;
-    //blit_para.flag                  = G2D_BLT_ROTATE180;
-			
-    err = ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)&blit_para);				
-    if(err < 0)		
-    {    
-        ALOGE("copy fb failed!\n");
-        
-        return  -1;      
+    if(display_softfmt(&var_src,&copy->src_fmt) != 0 || display_softfmt(&var_dst,&copy->dst_fmt) != 0)
+    {
+        ALOGE("soft copy of %d to %d bits_per_pixel not supported\n",var_src.bits_per_pixel,var_dst.bits_per_pixel);
+
+        return  -1;
+    }
+
+    src = display_mapfb(ctx,srcfb_id,&fix_src);
+    dst = display_mapfb(ctx,dstfb_id,&fix_dst);
+    if(src == NULL || dst == NULL)
+    {
+        return  -1;
     }
 
+    copy->src            = src + fix_src.line_length * srcfb_bufno * var_src.yres;
+    copy->src_stride     = fix_src.line_length;
+    copy->src_w          = var_src.xres;
+    copy->src_h          = var_src.yres;
+    copy->dst            = dst + fix_dst.line_length * dstfb_bufno * var_dst.yres;
+    copy->dst_stride     = fix_dst.line_length;
+    copy->dst_w          = var_dst.xres;
+    copy->dst_h          = var_dst.yres;
+    // whole ratios are exact with nearest, anything else is filtered
+    copy->bilinear       = (var_dst.xres % var_src.xres) || (var_dst.yres % var_src.yres);
+
     return  0;
 }
 
 /*
 **********************************************************************************************************************
-*                                               display_copyfb
+*                                               display_copyfbsoft
 *
 * author:           
 *
 * date:             2011-7-17:11:22:54
 *
-* Description:      copy from src fb to dst fb 
+* Description:      copy from src fb to dst fb with the cpu, for when g2d is not there 
 *
 * parameters:       
 *
@@ -809,132 +2019,15 @@ static int display_copyfbsoft(struct display_device_t *dev,int srcfb_id,int srcf
                           int dstfb_id,int dstfb_bufno)
 {
     struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    
-	struct fb_fix_screeninfo    fix_src;
-    struct fb_fix_screeninfo    fix_dst;
-    struct fb_var_screeninfo    var_src;
-    struct fb_var_screeninfo    var_dst;
-    char               			node_src[20];
-    char               			node_dst[20];
-    unsigned int                src_width;
-    unsigned int                src_height;
-    unsigned int                dst_width;
-    unsigned int                dst_height;
-    unsigned int                addr_src;
-    unsigned int                addr_dst;
-    unsigned int                size;
-    g2d_stretchblt              blit_para;
-    int                         err;
-    
-    sprintf(node_src, "/dev/graphics/fb%d", srcfb_id);
-
-    if(ctx->mFD_fb[srcfb_id] == 0)
-    {
-    	ctx->mFD_fb[srcfb_id]			= open(node_src,O_RDWR,0);
-    	if(ctx->mFD_fb[srcfb_id] <= 0)
-    	{
-    		ALOGE("open fb%d fail!\n",srcfb_id);
-    		
-    		ctx->mFD_fb[srcfb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
+    struct display_softcopy_t   copy;
 
-    sprintf(node_dst, "/dev/graphics/fb%d", dstfb_id);
-
-    if(ctx->mFD_fb[dstfb_id] == 0)
+    if(display_softsetup(ctx,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno,&copy) != 0)
     {
-    	ctx->mFD_fb[dstfb_id]			= open(node_dst,O_RDWR,0);
-    	if(ctx->mFD_fb[dstfb_id] <= 0)
-    	{
-    		ALOGE("open fb%d fail!\n",dstfb_id);
-    		
-    		ctx->mFD_fb[dstfb_id]		= 0;
-    		
-    		return  -1;
-    	}
-	}
-    
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_FSCREENINFO,&fix_src);
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_VSCREENINFO,&var_src);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_FSCREENINFO,&fix_dst);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_VSCREENINFO,&var_dst);
-	
-	src_width   = var_src.xres;
-	src_height  = var_src.yres;
-    dst_width   = var_dst.xres;
-    dst_height  = var_dst.yres;
-    
-    //ALOGD("src_width = %d\n",src_width);
-    //ALOGD("src_height = %d\n",src_height);
-    //ALOGD("dst_width = %d\n",dst_width);
-    //ALOGD("dst_height = %d\n",dst_height);
-    
-	addr_src = fix_src.smem_start + ((var_src.xres * (srcfb_bufno * var_src.yres) * var_src.bits_per_pixel) >> 3);
-	addr_dst = fix_dst.smem_start + ((var_dst.xres * (dstfb_bufno * var_dst.yres) * var_dst.bits_per_pixel) >> 3);
-	size = (var_src.xres * var_src.yres * var_src.bits_per_pixel) >> 3;//in byte unit
-	
-	//ALOGD("addr_src = %x\n",addr_src);
-    //ALOGD("addr_dst = %x\n",addr_dst);
-    //ALOGD("size = %d\n",size);
-	switch (var_src.bits_per_pixel) 
-	{			
-    	case 16:
-    		blit_para.src_image.format      = G2D_FMT_RGB565;
-    		break;
-    		
-    	case 24:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	case 32:
-    		blit_para.src_image.format      = G2D_FMT_RGBA_YUVA8888;
-    		break;
-    		
-    	default:
-    	    ALOGE("invalid bits_per_pixel :%d\n", var_src.bits_per_pixel);
-    		return -1;
-	}
-
-    blit_para.src_image.addr[0]     = addr_src;
-    blit_para.src_image.addr[1]     = 0;
-    blit_para.src_image.addr[2]     = 0;
-    blit_para.src_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.src_image.h           = src_height;
-    blit_para.src_image.w           = src_width;
-    blit_para.src_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    blit_para.dst_image.addr[0]     = addr_dst;
-    blit_para.dst_image.addr[1]     = 0;
-    blit_para.dst_image.addr[2]     = 0;
-    blit_para.dst_image.format      = G2D_FMT_ARGB_AYUV8888;
-    blit_para.dst_image.h           = dst_height;
-    blit_para.dst_image.w           = dst_width;
-    blit_para.dst_image.pixel_seq   = G2D_SEQ_VYUY;
-
-    //blit_para.dst_x                 = 0;
-    //blit_para.dst_y                 = 0;
-    blit_para.dst_rect.x            = 0;
-    blit_para.dst_rect.y            = 0;
-    blit_para.dst_rect.w            = dst_width;
-    blit_para.dst_rect.h            = dst_height;
-
-    blit_para.src_rect.x            = 0;
-    blit_para.src_rect.y            = 0;
-    blit_para.src_rect.w            = src_width;
-    blit_para.src_rect.h            = src_height;
-
-    blit_para.flag                 = G2D_BLT_NONE;
-			
-    err = ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)&blit_para);			
-    if(err < 0)		
-    {    
-        ALOGE("copy fb failed!\n");
-        
-        return  -1;      
+        return  -1;
     }
 
+    display_softcopy(&ctx->soft,&copy);
+
     return  0;
 }
       
@@ -960,9 +2053,9 @@ static int display_pandisplay(struct display_device_t *dev,int fb_id,int bufno)
 {
     struct 	display_context_t*  ctx = (struct display_context_t*)dev;
     struct fb_var_screeninfo    var;
-    char               node[20];
+    char               node[64];
     
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
+    sprintf(node, SUNXI_DEV_ROOT "/graphics/fb%d", fb_id);
     
     if(ctx->mFD_fb[fb_id] == 0)
     {
@@ -984,6 +2077,268 @@ static int display_pandisplay(struct display_device_t *dev,int fb_id,int bufno)
 
     return 0;
 }
+/*
+**********************************************************************************************************************
+*                                               display_mirror
+*
+* author:           
+*
+* date:             
+*
+* Description:      dual same mirroring thread. on each primary vsync the shown primary buffer is copied into
+*                   the back buffer of the secondary fb and panned, the next copy waits for the secondary
+*                   vsync that latches it so the buffer being written never scans out.
+*                   the source is the primary buffer that just started scanning out. nothing draws into it
+*                   while it is shown, but after the next primary flip it is the producer's back buffer again,
+*                   so a copy that takes longer than a primary frame can tear or mix two frames on the
+*                   secondary. g2d copies well inside a frame, the cpu copy of a large fb may not
+*
+* parameters:       
+*
+* return:           
+* modify history: 
+**********************************************************************************************************************
+*/
+
+static int64_t display_nowus(void)
+{
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+
+    return  (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void display_waitvsync(struct display_context_t* ctx,int fb_id)
+{
+    unsigned int                crtc = 0;
+
+    if(ctx->mFD_fb[fb_id] <= 0 || ioctl(ctx->mFD_fb[fb_id],FBIO_WAITFORVSYNC,&crtc) < 0)
+    {
+        usleep(16667);
+    }
+}
+
+/* buffer an fb is panned to, and how many it has */
+static int display_mirrorbufno(struct display_context_t* ctx,int fb_id,int *count)
+{
+    struct fb_var_screeninfo    var;
+
+    if(ctx->mFD_fb[fb_id] <= 0 || ioctl(ctx->mFD_fb[fb_id],FBIOGET_VSCREENINFO,&var) < 0 || var.yres == 0)
+    {
+        return  -1;
+    }
+
+    if(count)
+    {
+        *count = var.yres_virtual / var.yres;
+    }
+
+    return  var.yoffset / var.yres;
+}
+
+static void *display_mirrorthread(void *data)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)data;
+    struct display_mirror_t     *m = &ctx->mirror;
+    int64_t                     vsync_time;
+    int64_t                     latency;
+    int                         srcfb_id;
+    int                         dstfb_id;
+    int                         srcbuf;
+    int                         back;
+    int                         count = 1;
+
+    while(1)
+    {
+        pthread_mutex_lock(&m->lock);
+        while(!m->quit && !m->active)
+        {
+            pthread_cond_wait(&m->cond,&m->lock);
+        }
+        if(m->quit)
+        {
+            pthread_mutex_unlock(&m->lock);
+            break;
+        }
+        srcfb_id = m->srcfb_id;
+        dstfb_id = m->dstfb_id;
+        pthread_mutex_unlock(&m->lock);
+
+        display_waitvsync(ctx,srcfb_id);
+        vsync_time = display_nowus();
+
+        /* a mode change owns the fbs, never block it from here */
+        if(pthread_mutex_trylock(&mode_lock) != 0)
+        {
+            pthread_mutex_lock(&m->lock);
+            m->dropped++;
+            pthread_mutex_unlock(&m->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&m->lock);
+        srcbuf = display_mirrorbufno(ctx,srcfb_id,NULL);
+        if(!m->active || m->srcfb_id != srcfb_id || m->dstfb_id != dstfb_id || srcbuf < 0
+           || (srcbuf == m->last_src && m->posted == 0))
+        {
+            pthread_mutex_unlock(&m->lock);
+            pthread_mutex_unlock(&mode_lock);
+            continue;
+        }
+        if(m->posted > 1)
+        {
+            m->dropped += m->posted - 1;
+        }
+        m->posted = 0;
+        display_mirrorbufno(ctx,dstfb_id,&count);
+        back = (count > 1) ? (m->front + 1) % count : 0;
+        pthread_mutex_unlock(&m->lock);
+
+        // srcbuf stays intact only until the primary flips again, see above
+        display_copyfb(&ctx->device,srcfb_id,srcbuf,dstfb_id,back);
+        display_pandisplay(&ctx->device,dstfb_id,back);
+        pthread_mutex_unlock(&mode_lock);
+
+        display_waitvsync(ctx,dstfb_id);
+        latency = display_nowus() - vsync_time;
+
+        pthread_mutex_lock(&m->lock);
+        m->front        = back;
+        m->last_src     = srcbuf;
+        m->frames++;
+        m->latency_sum += latency;
+        if(latency > m->latency_max)
+        {
+            m->latency_max = latency;
+        }
+        if(m->frames % MIRROR_STATS_FRAMES == 0)
+        {
+            ALOGV("mirror fb%d->fb%d: %u frames, %u dropped, latency avg %lld us max %lld us\n",
+                  srcfb_id,dstfb_id,m->frames,m->dropped,
+                  (long long)(m->latency_sum / m->frames),(long long)m->latency_max);
+        }
+        pthread_mutex_unlock(&m->lock);
+    }
+
+    return  NULL;
+}
+
+/* tell the hwc, which runs in surfaceflinger, what the mode leaves of screen 1 to it */
+static void display_publishmode(void)
+{
+    static char     published[PROPERTY_VALUE_MAX];
+    char            value[PROPERTY_VALUE_MAX];
+
+    snprintf(value,sizeof(value),"%d %d",g_displaymode,g_masterdisplay);
+    if(strcmp(value,published) != 0 && property_set(DISPLAY_MODE_PROPERTY,value) == 0)
+    {
+        strcpy(published,value);
+    }
+}
+
+/* follow the current mode, called with mode_lock held after anything that changes it */
+static void display_mirrorupdate(struct display_context_t* ctx)
+{
+    struct display_mirror_t     *m = &ctx->mirror;
+    bool                        active;
+    int                         srcfb_id = 0;
+    int                         dstfb_id = 0;
+
+    display_publishmode();
+    active = (g_displaymode == DISPLAY_MODE_DUALSAME)
+             && g_display[0].isopen == DISPLAY_TRUE && g_display[1].isopen == DISPLAY_TRUE;
+    if(active)
+    {
+        srcfb_id = g_display[g_masterdisplay].fb_id;
+        dstfb_id = g_display[1 - g_masterdisplay].fb_id;
+    }
+
+    pthread_mutex_lock(&m->lock);
+    if(active && (!m->active || m->srcfb_id != srcfb_id || m->dstfb_id != dstfb_id))
+    {
+        m->srcfb_id = srcfb_id;
+        m->dstfb_id = dstfb_id;
+        m->front    = display_mirrorbufno(ctx,dstfb_id,NULL);
+        if(m->front < 0)
+        {
+            m->front = 0;
+        }
+        m->last_src = -1;
+        m->posted   = 0;
+    }
+    m->active = active;
+
+    if(active && !m->started)
+    {
+        if(pthread_create(&m->thread,NULL,display_mirrorthread,ctx) == 0)
+        {
+            m->started = true;
+        }
+        else
+        {
+            ALOGE("mirror thread create fail, secondary is not updated\n");
+            m->active  = false;
+        }
+    }
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+}
+
+static void display_mirrorstop(struct display_context_t* ctx)
+{
+    struct display_mirror_t     *m = &ctx->mirror;
+
+    pthread_mutex_lock(&m->lock);
+    m->quit     = true;
+    m->active   = false;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+
+    if(m->started)
+    {
+        pthread_join(m->thread,NULL);
+        m->started = false;
+    }
+}
+
+/* callers still post every primary frame, the mirror thread takes the pair over while it runs */
+static int display_postcopyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                              int dstfb_id,int dstfb_bufno)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    struct display_mirror_t     *m = &ctx->mirror;
+
+    pthread_mutex_lock(&m->lock);
+    if(m->active && m->srcfb_id == srcfb_id && m->dstfb_id == dstfb_id)
+    {
+        m->posted++;
+        pthread_mutex_unlock(&m->lock);
+
+        return  0;
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return  display_copyfb(dev,srcfb_id,srcfb_bufno,dstfb_id,dstfb_bufno);
+}
+
+static int display_postpandisplay(struct display_device_t *dev,int fb_id,int bufno)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)dev;
+    struct display_mirror_t     *m = &ctx->mirror;
+    bool                        mirrored;
+
+    pthread_mutex_lock(&m->lock);
+    mirrored = m->active && m->dstfb_id == fb_id;
+    pthread_mutex_unlock(&m->lock);
+
+    if(mirrored)
+    {
+        return  0;
+    }
+
+    return  display_pandisplay(dev,fb_id,bufno);
+}
       
 /*
 **********************************************************************************************************************
@@ -1125,11 +2480,7 @@ static int  display_getwidth(struct display_context_t* ctx,int displayno,int for
 
     if(format == DISPLAY_DEFAULT)
     {
-        unsigned long args[4];
-
-        args[0] = displayno;
-        
-        return ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_WIDTH,args);
+        return display_getscnsize(ctx,displayno,false);
     }
     
     return -1;
@@ -1181,11 +2532,7 @@ static int  display_getvalidwidth(struct display_context_t* ctx,int displayno,in
 
     if(format == DISPLAY_DEFAULT)
     {
-        unsigned long args[4];
-
-        args[0] = displayno;
-        
-        return ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_WIDTH,args);
+        return display_getscnsize(ctx,displayno,false);
     }
     
     return -1;
@@ -1236,11 +2583,7 @@ static int  display_getvalidwidth(struct display_context_t* ctx,int displayno,in
 
     if(format == DISPLAY_DEFAULT)
     {
-        unsigned long args[4];
-
-        args[0] = displayno;
-        
-        return ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_WIDTH,args);
+        return display_getscnsize(ctx,displayno,false);
     }
     
     return -1;
@@ -1309,11 +2652,7 @@ static int  display_getheight(struct display_context_t* ctx,int displayno,int fo
 
     if(format == DISPLAY_DEFAULT)
     {
-        unsigned long args[4];
-
-        args[0] = displayno;
-        
-        return ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_HEIGHT,args);
+        return display_getscnsize(ctx,displayno,true);
     }
     
     return -1;
@@ -1365,11 +2704,7 @@ static int  display_getvalidheight(struct display_context_t* ctx,int displayno,i
 
     if(format == DISPLAY_DEFAULT)
     {
-        unsigned long args[4];
-
-        args[0] = displayno;
-        
-        return ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_HEIGHT,args);
+        return display_getscnsize(ctx,displayno,true);
     }
     
     return -1;
@@ -1420,11 +2755,7 @@ static int  display_getvalidheight(struct display_context_t* ctx,int displayno,i
 
     if(format == DISPLAY_DEFAULT)
     {
-        unsigned long args[4];
-
-        args[0] = displayno;
-        
-        return ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_HEIGHT,args);
+        return display_getscnsize(ctx,displayno,true);
     }
     
     return -1;
@@ -1451,9 +2782,9 @@ static int  display_getvalidheight(struct display_context_t* ctx,int displayno,i
 static int  display_releasefb(struct display_context_t* ctx,int fb_id)
 {
     unsigned long arg[4];
-    char node[20];
+    char node[64];
 
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
+    sprintf(node, SUNXI_DEV_ROOT "/graphics/fb%d", fb_id);
 
     if(ctx->mFD_fb[fb_id] == 0)
     {
@@ -1470,6 +2801,8 @@ static int  display_releasefb(struct display_context_t* ctx,int fb_id)
 
     arg[0] = fb_id;
     ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
+    display_invalidateblit(ctx);
+    display_unmapfb(ctx,fb_id);
     
     return 0;
 }    
@@ -1498,7 +2831,7 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
     struct 						fb_var_screeninfo var;
     struct fb_fix_screeninfo 	fix;
     unsigned long 				arg[4];
-    char 						node[20];
+    char 						node[64];
     int							ret = -1;
     int							red_size = 8;
     int							green_size = 8;
@@ -1514,7 +2847,7 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
     __disp_colorkey_t 			ck;
     __disp_rect_t				scn_rect;
     
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
+    sprintf(node, SUNXI_DEV_ROOT "/graphics/fb%d", fb_id);
 
     if(ctx->mFD_fb[fb_id] == 0)
     {
@@ -1637,6 +2970,7 @@ static int  display_requestfb(struct display_context_t* ctx,int fb_id,struct dis
     var.blue.offset 		= blue_offset;
     
     ioctl(ctx->mFD_fb[fb_id],FBIOPUT_VSCREENINFO,&var);
+    display_invalidateblit(ctx);
     
     if(fb_para.fb_mode == FB_MODE_SCREEN1)
     {
@@ -1729,12 +3063,12 @@ static int  display_setfbrect(struct display_context_t* ctx,int displayno,int fb
     struct 						fb_var_screeninfo var;
     struct fb_fix_screeninfo 	fix;
     unsigned long 				arg[4];
-    char 						node[20];
+    char 						node[64];
     int							ret = -1;
     unsigned long 				fb_layer_hdl;
     __disp_rect_t				scn_rect;
     
-    sprintf(node, "/dev/graphics/fb%d", fb_id);
+    sprintf(node, SUNXI_DEV_ROOT "/graphics/fb%d", fb_id);
 
     if(ctx->mFD_fb[fb_id] == 0)
     {
@@ -1819,6 +3153,7 @@ static int  display_on(struct display_context_t* ctx,int displayno,int outputtyp
 	{
 		ret = ioctl(ctx->mFD_disp,DISP_CMD_VGA_ON,(unsigned long)args);
 	}
+	display_invalidatestate(ctx,displayno);
 	
 	return   ret;
 }
@@ -1866,6 +3201,7 @@ static int  display_off(struct display_context_t* ctx,int displayno,int outputty
 	{
 		ret = ioctl(ctx->mFD_disp,DISP_CMD_VGA_OFF,(unsigned long)args);
 	}
+	display_invalidatestate(ctx,displayno);
 	
 	return   ret;
 }
@@ -1955,7 +3291,7 @@ static int display_getdisplaybufid(struct display_device_t *dev, int displayno)
 {
     struct display_context_t*   ctx = (struct display_context_t*)dev;
     struct fb_var_screeninfo    var_src;
-    char               			node_src[20];
+    char               			node_src[64];
     unsigned int                fbid;
 
     
@@ -1963,7 +3299,7 @@ static int display_getdisplaybufid(struct display_device_t *dev, int displayno)
     
     fbid = g_display[displayno].fb_id;
 
-    sprintf(node_src, "/dev/graphics/fb%d", fbid);
+    sprintf(node_src, SUNXI_DEV_ROOT "/graphics/fb%d", fbid);
 
     if(ctx->mFD_fb[fbid] == 0)
     {
@@ -2038,6 +3374,9 @@ static int  display_output(struct display_context_t* ctx, int displayno, int out
 
         ret = ioctl(ctx->mFD_disp,DISP_CMD_VGA_ON,(unsigned long)arg);
     }
+    // the new mode may come with another fb size, rebuild the blits on the next copy
+    display_invalidatestate(ctx,displayno);
+    display_invalidateblit(ctx);
     
     return   ret;
 }
@@ -2499,6 +3838,7 @@ static int display_changemode(struct display_device_t *dev,int displayno,int val
             status = -1;
          }
 
+         display_mirrorupdate((struct display_context_t*)dev);
          pthread_mutex_unlock(&mode_lock);
     } 
     else 
@@ -2624,6 +3964,9 @@ static int display_getparameter(struct display_device_t *dev, int displayno, int
         case   DISPLAY_OUTPUT_TYPE:             return  g_display[displayno].type;
         case   DISPLAY_OUTPUT_ISOPEN:           return  g_display[displayno].isopen;
         case   DISPLAY_OUTPUT_HOTPLUG:          return  g_display[displayno].hotplug;
+        case   DISPLAY_MIRROR_FRAMES:           return  ctx->mirror.frames;
+        case   DISPLAY_MIRROR_DROPPED:          return  ctx->mirror.dropped;
+        case   DISPLAY_MIRROR_LATENCY:          return  ctx->mirror.frames ? (int)(ctx->mirror.latency_sum / ctx->mirror.frames) : 0;
         default:
             ALOGE("Invalid Display Parameter!\n");
 
@@ -2968,6 +4311,7 @@ static int display_requestdualsame(struct display_device_t *dev)
             }
             else
             {
+                para.bufno              = 2;
                 display_requestfb(ctx,1,&para);
             }
             g_display[i].isopen         = DISPLAY_TRUE;
@@ -3007,6 +4351,7 @@ static int display_requestdualsame(struct display_device_t *dev)
                 para.width          = min_width;
                 para.height         = min_height;
                 para.layer_mode     = DISP_LAYER_WORK_MODE_SCALER;
+                para.bufno          = 2;
 
                 display_requestfb(ctx,1,&para);
             }
@@ -3398,6 +4743,7 @@ static int display_setmode(struct display_device_t *dev,int mode,struct display_
 	        //ALOGD("display_requestmode!\n");
     	}
         
+        display_mirrorupdate(ctx);
         pthread_mutex_unlock(&mode_lock);
 
         return  ret;
@@ -3745,6 +5091,7 @@ static int display_setmasterdisplay(struct display_device_t *dev,int master)
         ret = display_duallcdsetmaster(dev,master);
     }
 
+    display_mirrorupdate((struct display_context_t*)dev);
     pthread_mutex_unlock(&mode_lock);
 
     return  ret;
@@ -3825,6 +5172,7 @@ static int display_opendev(struct display_device_t *dev,int displayno)
     {
         g_display[displayno].isopen = DISPLAY_TRUE;
     }
+    display_mirrorupdate(ctx);
 
     pthread_mutex_unlock(&mode_lock);
 
@@ -3880,6 +5228,7 @@ static int display_closedev(struct display_device_t *dev,int displayno)
     {
         g_display[displayno].isopen = DISPLAY_FALSE;
     }
+    display_mirrorupdate(ctx);
 
     pthread_mutex_unlock(&mode_lock);
 
@@ -3916,6 +5265,17 @@ static int close_display(struct hw_device_t *dev)
     struct display_context_t* ctx = (struct display_context_t*)dev;
     if (ctx) 
     {
+        display_mirrorstop(ctx);
+        pthread_mutex_destroy(&ctx->mirror.lock);
+        pthread_cond_destroy(&ctx->mirror.cond);
+        display_stopuevent(ctx);
+        pthread_mutex_destroy(&ctx->state_lock);
+        pthread_mutex_destroy(&ctx->copy_lock);
+        display_softstop(&ctx->soft);
+        pthread_mutex_destroy(&ctx->soft.lock);
+        pthread_cond_destroy(&ctx->soft.start);
+        pthread_cond_destroy(&ctx->soft.done);
+
         if(ctx->mFD_disp)
         {
             close(ctx->mFD_disp);
@@ -3928,6 +5288,7 @@ static int close_display(struct hw_device_t *dev)
 
         for(i = 0;i < MAX_DISPLAY_NUM;i++)
         {
+            display_unmapfb(ctx,i);
             if(ctx->mFD_fb[i])
             {
                 close(ctx->mFD_fb[i]);
@@ -3964,6 +5325,13 @@ static int open_display(const struct hw_module_t* module, const char* name,
     display_context_t *ctx;
     ctx = (display_context_t *)malloc(sizeof(display_context_t));
     memset(ctx, 0, sizeof(*ctx));
+    pthread_mutex_init(&ctx->mirror.lock, NULL);
+    pthread_cond_init(&ctx->mirror.cond, NULL);
+    pthread_mutex_init(&ctx->state_lock, NULL);
+    pthread_mutex_init(&ctx->copy_lock, NULL);
+    pthread_mutex_init(&ctx->soft.lock, NULL);
+    pthread_cond_init(&ctx->soft.start, NULL);
+    pthread_cond_init(&ctx->soft.done, NULL);
 
     ctx->device.common.tag          = HARDWARE_DEVICE_TAG;
     ctx->device.common.version      = 1;
@@ -3977,8 +5345,8 @@ static int open_display(const struct hw_module_t* module, const char* name,
     ctx->device.opendisplay         = display_opendev;
     ctx->device.closedisplay        = display_closedev;
     ctx->device.getdisplayparameter = display_getparameter;
-    ctx->device.copysrcfbtodstfb    = display_copyfb;
-    ctx->device.pandisplay          = display_pandisplay;
+    ctx->device.copysrcfbtodstfb    = display_postcopyfb;
+    ctx->device.pandisplay          = display_postpandisplay;
     ctx->device.request_modelock    = display_requestmodelock;
     ctx->device.release_modelock    = display_releasemodelock;
     ctx->device.setmasterdisplay    = display_setmasterdisplay;
@@ -3990,7 +5358,7 @@ static int open_display(const struct hw_module_t* module, const char* name,
     ctx->device.gethdmimaxmode		= display_gethdmimaxmode;
 
     //ALOGD("start open_display!\n");
-    ctx->mFD_disp = open("/dev/disp", O_RDWR, 0);
+    ctx->mFD_disp = open(SUNXI_DEV_ROOT "/disp", O_RDWR, 0);
     ALOGD("start open_display!ctx->mFD_disp = %x\n",ctx->mFD_disp);
     if (ctx->mFD_disp < 0) 
     {
@@ -4002,6 +5370,7 @@ static int open_display(const struct hw_module_t* module, const char* name,
 
     if (status == 0) 
     {
+        display_startuevent(ctx);
         *device = &ctx->device.common;
     } 
     else 
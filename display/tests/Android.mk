@@ -0,0 +1,61 @@
+# Copyright (C) 2008 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+LOCAL_PATH := $(call my-dir)
+
+# host tests, each includes display.cpp to reach its static helpers
+include $(CLEAR_VARS)
+LOCAL_MODULE := display_softcopy_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := display_softcopy_test.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := display_format_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := display_format_test.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := display_state_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := display_state_test.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_CFLAGS := -DDEBUG_STATE_CHECK=1
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := display_mirror_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := display_mirror_test.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+include $(BUILD_HOST_NATIVE_TEST)
+
+# times display_copyfbg2d against the cpu copy on the stand-in sunxi driver
+include $(CLEAR_VARS)
+LOCAL_MODULE := display_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := display_bench.cpp ../../hwcomposer/tests/sunxi_stub.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include $(LOCAL_PATH)/../../hwcomposer/tests
+LOCAL_CFLAGS := -DSUNXI_DEV_ROOT=\"/tmp/sunxi_stub\"
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * times the dual same copy of one fb buffer into the other screen's fb,
+ * through g2d and through the cpu, the way display_copyfb picks between
+ * them. display.cpp is included to reach the copies.
+ *
+ *     display_bench [-r repeat] [-s srcfb] [-d dstfb]
+ *
+ * linked against the sunxi stand-in driver g2d takes the time the stub's
+ * throughput gives it while the cpu copies move real pixels, so a host
+ * run compares the cpu paths with each other and with the modelled g2d,
+ * e.g. for a 1024x600 rgb565 lcd mirrored to 1080p:
+ *
+ *     SUNXI_STUB_SCREEN0=1024x600@60/16 SUNXI_STUB_SCREEN1=1920x1080@60 display_bench
+ *
+ * the rows are:
+ *
+ *     g2d         display_copyfbg2d
+ *     soft        display_copyfbsoft, the row kernels on the copy workers
+ *     soft/1      the row kernels on one thread
+ *     scalar/1    display_softread and display_softwrite on one thread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "../display.cpp"
+
+#include "sunxi_stub.h"
+
+static int64_t bench_now(void)
+{
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t bench_percentile(std::vector<int64_t> samples, int pct)
+{
+    if(samples.empty())
+    {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * pct / 100];
+}
+
+static void bench_report(const char *name, const std::vector<int64_t> &samples)
+{
+    int64_t                     total = 0;
+
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        total += samples[i];
+    }
+    printf("%-8s avg %6lld us  p50 %6lld us  p99 %6lld us  max %6lld us\n", name,
+           (long long)(samples.empty() ? 0 : total / (int64_t)samples.size() / 1000),
+           (long long)(bench_percentile(samples, 50) / 1000),
+           (long long)(bench_percentile(samples, 99) / 1000),
+           (long long)(bench_percentile(samples, 100) / 1000));
+}
+
+static const char *bench_layout(int layout)
+{
+    static const char           *names[] = { "other", "rgb565", "xrgb8888", "argb8888", "xbgr8888", "abgr8888" };
+
+    return layout >= 0 && layout < (int)(sizeof(names) / sizeof(names[0])) ? names[layout] : "?";
+}
+
+int main(int argc, char **argv)
+{
+    struct display_context_t    *ctx;
+    struct display_softcopy_t   copy;
+    std::vector<int64_t>        g2d_ns;
+    std::vector<int64_t>        soft_ns;
+    std::vector<int64_t>        one_ns;
+    std::vector<int64_t>        scalar_ns;
+    sunxi_stub_stats_t          stats;
+    int                         repeat = 20;
+    int                         srcfb = 0;
+    int                         dstfb = 1;
+    int                         opt;
+
+    while((opt = getopt(argc, argv, "r:s:d:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                repeat = std::max(1, atoi(optarg));
+                break;
+            case 's':
+                srcfb = atoi(optarg);
+                break;
+            case 'd':
+                dstfb = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r repeat] [-s srcfb] [-d dstfb]\n", argv[0]);
+                return 2;
+        }
+    }
+    if(srcfb < 0 || srcfb >= MAX_DISPLAY_NUM || dstfb < 0 || dstfb >= MAX_DISPLAY_NUM || srcfb == dstfb)
+    {
+        fprintf(stderr, "usage: %s [-r repeat] [-s srcfb] [-d dstfb]\n", argv[0]);
+        return 2;
+    }
+
+    ctx = (struct display_context_t *)calloc(1, sizeof(*ctx));
+    pthread_mutex_init(&ctx->copy_lock, NULL);
+    pthread_mutex_init(&ctx->soft.lock, NULL);
+    pthread_cond_init(&ctx->soft.start, NULL);
+    pthread_cond_init(&ctx->soft.done, NULL);
+
+    if(display_softsetup(ctx, srcfb, 0, dstfb, 0, &copy) != 0)
+    {
+        fprintf(stderr, "display_bench: cannot map fb%d and fb%d on %s\n", srcfb, dstfb, sunxi_stub_root());
+        return 1;
+    }
+    // something other than a flat colour to convert and filter
+    srand(1);
+    for(int y = 0; y < copy.src_h; y++)
+    {
+        unsigned char           *line = (unsigned char *)copy.src + y * copy.src_stride;
+
+        for(int i = 0; i < (copy.src_w * copy.src_fmt.bpp) >> 3; i++)
+        {
+            line[i] = rand() & 0xff;
+        }
+    }
+    printf("fb%d %dx%d %s to fb%d %dx%d %s, %s\n", srcfb, copy.src_w, copy.src_h, bench_layout(copy.src_fmt.layout),
+           dstfb, copy.dst_w, copy.dst_h, bench_layout(copy.dst_fmt.layout), copy.bilinear ? "bilinear" : "nearest");
+
+    sunxi_stub_reset_stats();
+    for(int r = 0; r < repeat; r++)
+    {
+        int64_t                 start;
+        int                     ret;
+
+        pthread_mutex_lock(&ctx->copy_lock);
+        start   = bench_now();
+        ret     = display_copyfbg2d(ctx, srcfb, 0, dstfb, 0);
+        if(ret == 0)
+        {
+            g2d_ns.push_back(bench_now() - start);
+        }
+        pthread_mutex_unlock(&ctx->copy_lock);
+
+        start = bench_now();
+        display_copyfbsoft(&ctx->device, srcfb, 0, dstfb, 0);
+        soft_ns.push_back(bench_now() - start);
+
+        copy.y0 = 0;
+        copy.y1 = copy.dst_h;
+        start   = bench_now();
+        display_softcopy_rows(&copy);
+        one_ns.push_back(bench_now() - start);
+
+        start = bench_now();
+        display_softcopy_ref(&copy);
+        scalar_ns.push_back(bench_now() - start);
+    }
+
+    sunxi_stub_stats(&stats);
+    bench_report("g2d", g2d_ns);
+    bench_report("soft", soft_ns);
+    bench_report("soft/1", one_ns);
+    bench_report("scalar/1", scalar_ns);
+    printf("%d copy workers, %u g2d ops\n", ctx->soft.threads, stats.g2d_ops);
+
+    display_softstop(&ctx->soft);
+    for(int i = 0; i < MAX_DISPLAY_NUM; i++)
+    {
+        display_unmapfb(ctx, i);
+        if(ctx->mFD_fb[i])
+        {
+            close(ctx->mFD_fb[i]);
+        }
+    }
+    if(ctx->mFD_mp)
+    {
+        close(ctx->mFD_mp);
+    }
+    free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * the fb layouts display_copyfb negotiates with g2d, and the pixel helpers
+ * of the cpu copy it falls back to.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "../display.cpp"
+
+/* bitfield lengths and offsets, r, g, b, a */
+static struct fb_var_screeninfo make_var(int bpp, int r_len, int r_off, int g_len, int g_off,
+                                         int b_len, int b_off, int a_len, int a_off)
+{
+    struct fb_var_screeninfo    var;
+
+    memset(&var, 0, sizeof(var));
+    var.bits_per_pixel  = bpp;
+    var.red.length      = r_len;
+    var.red.offset      = r_off;
+    var.green.length    = g_len;
+    var.green.offset    = g_off;
+    var.blue.length     = b_len;
+    var.blue.offset     = b_off;
+    var.transp.length   = a_len;
+    var.transp.offset   = a_off;
+    return var;
+}
+
+static struct display_softfmt_t make_fmt(const struct fb_var_screeninfo &var)
+{
+    struct display_softfmt_t    fmt;
+
+    EXPECT_EQ(0, display_softfmt(&var, &fmt));
+    return fmt;
+}
+
+static uint32_t read_raw(uint32_t raw, const struct display_softfmt_t &fmt)
+{
+    uint16_t                    p16 = raw;
+    uint32_t                    p32 = raw;
+
+    return display_softread(fmt.bpp == 16 ? (const unsigned char *)&p16 : (const unsigned char *)&p32, 0, &fmt);
+}
+
+static uint32_t write_raw(uint32_t argb, const struct display_softfmt_t &fmt)
+{
+    uint16_t                    p16 = 0;
+    uint32_t                    p32 = 0;
+
+    if(fmt.bpp == 16)
+    {
+        display_softwrite((unsigned char *)&p16, 0, argb, &fmt);
+        return p16;
+    }
+    display_softwrite((unsigned char *)&p32, 0, argb, &fmt);
+    return p32;
+}
+
+TEST(G2dFormatTest, MapsEveryLayout)
+{
+    static const struct
+    {
+        struct fb_var_screeninfo    var;
+        g2d_data_fmt                format;
+        g2d_pixel_seq               seq;
+    } layouts[] =
+    {
+        { make_var(32, 8, 16, 8, 8, 8, 0, 8, 24),   G2D_FMT_ARGB_AYUV8888,  G2D_SEQ_NORMAL },
+        { make_var(32, 8, 8, 8, 16, 8, 24, 8, 0),   G2D_FMT_BGRA_VUYA8888,  G2D_SEQ_NORMAL },
+        { make_var(32, 8, 0, 8, 8, 8, 16, 8, 24),   G2D_FMT_ABGR_AVUY8888,  G2D_SEQ_NORMAL },
+        { make_var(32, 8, 24, 8, 16, 8, 8, 8, 0),   G2D_FMT_RGBA_YUVA8888,  G2D_SEQ_NORMAL },
+        { make_var(32, 8, 16, 8, 8, 8, 0, 0, 0),    G2D_FMT_XRGB8888,       G2D_SEQ_NORMAL },
+        { make_var(32, 8, 8, 8, 16, 8, 24, 0, 0),   G2D_FMT_BGRX8888,       G2D_SEQ_NORMAL },
+        { make_var(32, 8, 0, 8, 8, 8, 16, 0, 0),    G2D_FMT_XBGR8888,       G2D_SEQ_NORMAL },
+        { make_var(32, 8, 24, 8, 16, 8, 8, 0, 0),   G2D_FMT_RGBX8888,       G2D_SEQ_NORMAL },
+        { make_var(16, 5, 11, 6, 5, 5, 0, 0, 0),    G2D_FMT_RGB565,         G2D_SEQ_P10 },
+        { make_var(16, 5, 0, 6, 5, 5, 11, 0, 0),    G2D_FMT_BGR565,         G2D_SEQ_P10 },
+    };
+
+    for(size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++)
+    {
+        g2d_data_fmt            format = (g2d_data_fmt)-1;
+        g2d_pixel_seq           seq = (g2d_pixel_seq)-1;
+
+        EXPECT_EQ(0, display_g2dformat(&layouts[i].var, &format, &seq)) << "layout " << i;
+        EXPECT_EQ(layouts[i].format, format) << "layout " << i;
+        EXPECT_EQ(layouts[i].seq, seq) << "layout " << i;
+    }
+}
+
+TEST(G2dFormatTest, ComparesOffsets)
+{
+    struct fb_var_screeninfo    var;
+
+    // every channel 8 bits, but a byte order g2d has no format for
+    var = make_var(32, 8, 0, 8, 16, 8, 8, 8, 24);
+    EXPECT_EQ(-1, get_g2dpixelformat(var.red.length, var.red.offset, var.green.length, var.green.offset,
+                                     var.blue.length, var.blue.offset, var.transp.length, var.transp.offset));
+
+    // the unused byte of an X format may sit anywhere
+    EXPECT_EQ(G2D_FMT_XRGB8888, get_g2dpixelformat(8, 16, 8, 8, 8, 0, 0, 24));
+    EXPECT_EQ(G2D_FMT_XRGB8888, get_g2dpixelformat(8, 16, 8, 8, 8, 0, 0, 0));
+}
+
+TEST(G2dFormatTest, RejectsWhatG2dCannotTake)
+{
+    struct fb_var_screeninfo    var;
+    g2d_data_fmt                format;
+    g2d_pixel_seq               seq;
+
+    // argb4444 is left to the cpu copy
+    var = make_var(16, 4, 8, 4, 4, 4, 0, 4, 12);
+    EXPECT_NE(0, display_g2dformat(&var, &format, &seq));
+
+    var = make_var(24, 8, 16, 8, 8, 8, 0, 0, 0);
+    EXPECT_NE(0, display_g2dformat(&var, &format, &seq));
+
+    var = make_var(8, 3, 5, 3, 2, 2, 0, 0, 0);
+    EXPECT_NE(0, display_g2dformat(&var, &format, &seq));
+}
+
+TEST(SoftPixelTest, ReadWidensChannels)
+{
+    struct display_softfmt_t    rgb565 = make_fmt(make_var(16, 5, 11, 6, 5, 5, 0, 0, 0));
+    struct display_softfmt_t    argb4444 = make_fmt(make_var(16, 4, 8, 4, 4, 4, 0, 4, 12));
+    struct display_softfmt_t    abgr8888 = make_fmt(make_var(32, 8, 0, 8, 8, 8, 16, 8, 24));
+
+    // no alpha reads as opaque, full channels stay full
+    EXPECT_EQ(0xffffffffu, read_raw(0xffff, rgb565));
+    EXPECT_EQ(0xff000000u, read_raw(0x0000, rgb565));
+    EXPECT_EQ(0xffff0000u, read_raw(0xf800, rgb565));
+    EXPECT_EQ(0xff00ff00u, read_raw(0x07e0, rgb565));
+    EXPECT_EQ(0xff0000ffu, read_raw(0x001f, rgb565));
+    // r 1, g 2, b 1 repeat their top bits into the low ones
+    EXPECT_EQ(0xff080808u, read_raw(0x0841, rgb565));
+    // r 16, g 32, b 16
+    EXPECT_EQ(0xff848284u, read_raw(0x8410, rgb565));
+
+    EXPECT_EQ(0x11223344u, read_raw(0x1234, argb4444));
+    EXPECT_EQ(0x00000000u, read_raw(0x0000, argb4444));
+
+    EXPECT_EQ(0x80123456u, read_raw(0x80563412, abgr8888));
+}
+
+TEST(SoftPixelTest, WriteTruncatesChannels)
+{
+    struct display_softfmt_t    rgb565 = make_fmt(make_var(16, 5, 11, 6, 5, 5, 0, 0, 0));
+    struct display_softfmt_t    argb4444 = make_fmt(make_var(16, 4, 8, 4, 4, 4, 0, 4, 12));
+    struct display_softfmt_t    xbgr8888 = make_fmt(make_var(32, 8, 0, 8, 8, 8, 16, 0, 0));
+
+    EXPECT_EQ(0xffffu, write_raw(0xffffffff, rgb565));
+    EXPECT_EQ(0x0000u, write_raw(0xff070307, rgb565));
+    EXPECT_EQ(0x0841u, write_raw(0x000f080f, rgb565));
+    EXPECT_EQ(0x1234u, write_raw(0x1f2f3f4f, argb4444));
+    // no alpha channel, the alpha byte is dropped
+    EXPECT_EQ(0x00563412u, write_raw(0x80123456, xbgr8888));
+}
+
+TEST(SoftPixelTest, EveryPixelRoundTrips)
+{
+    struct display_softfmt_t    rgb565 = make_fmt(make_var(16, 5, 11, 6, 5, 5, 0, 0, 0));
+    struct display_softfmt_t    argb4444 = make_fmt(make_var(16, 4, 8, 4, 4, 4, 0, 4, 12));
+    struct display_softfmt_t    xrgb1555 = make_fmt(make_var(16, 5, 10, 5, 5, 5, 0, 0, 0));
+
+    for(uint32_t raw = 0; raw < 0x10000; raw++)
+    {
+        ASSERT_EQ(raw, write_raw(read_raw(raw, rgb565), rgb565));
+        ASSERT_EQ(raw, write_raw(read_raw(raw, argb4444), argb4444));
+        ASSERT_EQ(raw & 0x7fff, write_raw(read_raw(raw, xrgb1555), xrgb1555));
+    }
+}
+
+TEST(SoftPixelTest, LerpIsPerChannel)
+{
+    EXPECT_EQ(0x12345678u, display_softlerp(0x12345678, 0x9abcdef0, 0));
+    EXPECT_EQ(0x7f7f7f7fu, display_softlerp(0x00000000, 0xffffffff, 128));
+    EXPECT_EQ(0x7f7f7f7fu, display_softlerp(0xffffffff, 0x00000000, 128));
+    EXPECT_EQ(0xfefefefeu, display_softlerp(0x00000000, 0xffffffff, 255));
+
+    srand(5);
+    for(int i = 0; i < 100000; i++)
+    {
+        uint32_t                a = ((uint32_t)rand() << 16) ^ rand();
+        uint32_t                b = ((uint32_t)rand() << 16) ^ rand();
+        uint32_t                w = rand() & 0xff;
+        uint32_t                want = 0;
+
+        // a + floor((b - a) * w / 256) on each byte, no carry or borrow between them
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            int                 ca = (a >> shift) & 0xff;
+            int                 cb = (b >> shift) & 0xff;
+            int                 d = (cb - ca) * (int)w;
+            int                 c = ca + (d >= 0 ? d / 256 : -((-d + 255) / 256));
+
+            want |= (uint32_t)c << shift;
+        }
+        ASSERT_EQ(want, display_softlerp(a, b, w)) << std::hex << a << " " << b << " " << w;
+    }
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * the dual same mirror thread. ioctl is replaced in this binary by two
+ * double buffered fbs and a g2d that only counts blits. FBIO_WAITFORVSYNC
+ * blocks until the test hands out a vblank, so the thread runs one step
+ * at a time.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "../display.cpp"
+
+#define FB_W            64
+#define FB_H            32
+#define FB_BASE(fb)     (0x10000000u * ((fb) + 1))
+
+static int                      g_disp = -1;
+static int                      g_g2d = -1;
+static int                      g_fb[MAX_DISPLAY_NUM] = {-1, -1};
+static int                      g_yoffset[MAX_DISPLAY_NUM];
+static int                      g_pans[MAX_DISPLAY_NUM];
+static int                      g_blits;
+static int                      g_blit_src;
+static int                      g_blit_dst;
+static pthread_mutex_t          g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           g_cond = PTHREAD_COND_INITIALIZER;
+static int                      g_vblank[MAX_DISPLAY_NUM];  /* handed out, not waited for yet */
+static int                      g_waits;                    /* vsync waits entered */
+static int                      g_wait_fb = -1;
+static bool                     g_stop;
+
+static int fb_of(int fd)
+{
+    for(int i = 0; i < MAX_DISPLAY_NUM; i++)
+    {
+        if(fd == g_fb[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int wait_vblank(int fb)
+{
+    pthread_mutex_lock(&g_lock);
+    g_waits++;
+    g_wait_fb = fb;
+    pthread_cond_broadcast(&g_cond);
+    while(g_vblank[fb] == 0 && !g_stop)
+    {
+        pthread_cond_wait(&g_cond, &g_lock);
+    }
+    if(g_stop)
+    {
+        pthread_mutex_unlock(&g_lock);
+        errno = EINTR;
+        return -1;
+    }
+    g_vblank[fb]--;
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list                     ap;
+    void                        *arg;
+    int                         fb = fb_of(fd);
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if(fd == g_disp && request == DISP_CMD_HDMI_OFF)
+    {
+        return 0;
+    }
+    if(fd == g_g2d && request == G2D_CMD_STRETCHBLT)
+    {
+        g2d_stretchblt          *blit = (g2d_stretchblt *)arg;
+
+        g_blits++;
+        g_blit_src = blit->src_image.addr[0] >= FB_BASE(1) ? 1 : 0;
+        g_blit_dst = blit->dst_image.addr[0] >= FB_BASE(1) ? 1 : 0;
+        return 0;
+    }
+    if(fb < 0)
+    {
+        errno = ENOTTY;
+        return -1;
+    }
+
+    switch(request)
+    {
+        case FBIOGET_VSCREENINFO:
+        {
+            struct fb_var_screeninfo    *var = (struct fb_var_screeninfo *)arg;
+
+            memset(var, 0, sizeof(*var));
+            var->xres               = FB_W;
+            var->yres               = FB_H;
+            var->xres_virtual       = FB_W;
+            var->yres_virtual       = FB_H * 2;
+            var->yoffset            = g_yoffset[fb];
+            var->bits_per_pixel     = 32;
+            var->red.offset         = 16;
+            var->red.length         = 8;
+            var->green.offset       = 8;
+            var->green.length       = 8;
+            var->blue.offset        = 0;
+            var->blue.length        = 8;
+            var->transp.offset      = 24;
+            var->transp.length      = 8;
+            return 0;
+        }
+        case FBIOGET_FSCREENINFO:
+        {
+            struct fb_fix_screeninfo    *fix = (struct fb_fix_screeninfo *)arg;
+
+            memset(fix, 0, sizeof(*fix));
+            fix->smem_start         = FB_BASE(fb);
+            fix->line_length        = FB_W * 4;
+            return 0;
+        }
+        case FBIOPAN_DISPLAY:
+            g_yoffset[fb] = ((struct fb_var_screeninfo *)arg)->yoffset;
+            g_pans[fb]++;
+            return 0;
+        case FBIO_WAITFORVSYNC:
+            return wait_vblank(fb);
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+/* one vblank on fb, returns the fb the mirror thread waits on next */
+static int vblank(int fb)
+{
+    int                         waits;
+    int                         next;
+
+    pthread_mutex_lock(&g_lock);
+    waits = g_waits;
+    g_vblank[fb]++;
+    pthread_cond_broadcast(&g_cond);
+    while(g_waits == waits)
+    {
+        pthread_cond_wait(&g_cond, &g_lock);
+    }
+    next = g_wait_fb;
+    pthread_mutex_unlock(&g_lock);
+
+    return next;
+}
+
+class MirrorTest : public ::testing::Test
+{
+protected:
+    struct display_context_t    *ctx;
+    struct display_device_t     *dev;
+
+    virtual void SetUp()
+    {
+        g_disp  = open("/dev/null", O_RDONLY);
+        g_g2d   = open("/dev/null", O_RDONLY);
+        for(int i = 0; i < MAX_DISPLAY_NUM; i++)
+        {
+            g_fb[i]         = open("/dev/null", O_RDONLY);
+            g_yoffset[i]    = 0;
+            g_pans[i]       = 0;
+            g_vblank[i]     = 0;
+        }
+        g_blits     = 0;
+        g_blit_src  = -1;
+        g_blit_dst  = -1;
+        g_waits     = 0;
+        g_wait_fb   = -1;
+        g_stop      = false;
+
+        ctx = (struct display_context_t *)calloc(1, sizeof(*ctx));
+        pthread_mutex_init(&ctx->state_lock, NULL);
+        pthread_mutex_init(&ctx->copy_lock, NULL);
+        pthread_mutex_init(&ctx->mirror.lock, NULL);
+        pthread_cond_init(&ctx->mirror.cond, NULL);
+        ctx->mFD_disp   = g_disp;
+        ctx->mFD_mp     = g_g2d;
+        for(int i = 0; i < MAX_DISPLAY_NUM; i++)
+        {
+            ctx->mFD_fb[i] = g_fb[i];
+        }
+        dev = &ctx->device;
+
+        // lcd on fb0 mirrored to hdmi on fb1
+        memset(g_display, 0, sizeof(g_display));
+        g_displaymode           = DISPLAY_MODE_DUALSAME;
+        g_masterdisplay         = 0;
+        g_display[0].type       = DISPLAY_DEVICE_LCD;
+        g_display[0].fb_id      = 0;
+        g_display[0].isopen     = DISPLAY_TRUE;
+        g_display[1].type       = DISPLAY_DEVICE_HDMI;
+        g_display[1].fb_id      = 1;
+        g_display[1].isopen     = DISPLAY_TRUE;
+    }
+
+    virtual void TearDown()
+    {
+        pthread_mutex_lock(&g_lock);
+        g_stop = true;
+        pthread_cond_broadcast(&g_cond);
+        pthread_mutex_unlock(&g_lock);
+        display_mirrorstop(ctx);
+
+        pthread_mutex_destroy(&ctx->state_lock);
+        pthread_mutex_destroy(&ctx->copy_lock);
+        pthread_mutex_destroy(&ctx->mirror.lock);
+        pthread_cond_destroy(&ctx->mirror.cond);
+        free(ctx);
+        close(g_disp);
+        close(g_g2d);
+        for(int i = 0; i < MAX_DISPLAY_NUM; i++)
+        {
+            close(g_fb[i]);
+        }
+    }
+
+    /* start the thread and wait until it waits on the primary */
+    void start()
+    {
+        pthread_mutex_lock(&mode_lock);
+        display_mirrorupdate(ctx);
+        pthread_mutex_unlock(&mode_lock);
+
+        pthread_mutex_lock(&g_lock);
+        while(g_waits == 0)
+        {
+            pthread_cond_wait(&g_cond, &g_lock);
+        }
+        pthread_mutex_unlock(&g_lock);
+    }
+
+    /* a primary vblank, and the secondary one if the thread copied */
+    int frame(int src, int dst)
+    {
+        int                     next = vblank(src);
+
+        if(next == dst)
+        {
+            next = vblank(dst);
+        }
+        return next;
+    }
+};
+
+TEST_F(MirrorTest, CopiesShownBufferToSecondaryBack)
+{
+    start();
+    EXPECT_TRUE(ctx->mirror.active);
+    EXPECT_EQ(0, g_wait_fb);
+
+    // the primary shows buffer 1, it lands in the secondary back buffer
+    g_yoffset[0] = FB_H;
+    display_postcopyfb(dev, 0, 1, 1, 0);
+    EXPECT_EQ(0, frame(0, 1));
+
+    EXPECT_EQ(1, g_blits);
+    EXPECT_EQ(0, g_blit_src);
+    EXPECT_EQ(1, g_blit_dst);
+    EXPECT_EQ(1, g_pans[1]);
+    EXPECT_EQ(FB_H, g_yoffset[1]);
+    EXPECT_EQ(1u, ctx->mirror.frames);
+
+    // the next copy goes to the other secondary buffer
+    display_postcopyfb(dev, 0, 1, 1, 0);
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(2, g_blits);
+    EXPECT_EQ(0, g_yoffset[1]);
+}
+
+TEST_F(MirrorTest, SkipsWhenNothingWasPosted)
+{
+    start();
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(1, g_blits);
+
+    // same primary buffer and no caller copy, nothing changed
+    for(int i = 0; i < 3; i++)
+    {
+        EXPECT_EQ(0, frame(0, 1));
+    }
+    EXPECT_EQ(1, g_blits);
+    EXPECT_EQ(1u, ctx->mirror.frames);
+
+    // the primary flipped without a post
+    g_yoffset[0] = FB_H;
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(2, g_blits);
+
+    // a post redraws the same buffer
+    display_postcopyfb(dev, 0, 1, 1, 0);
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(3, g_blits);
+    EXPECT_EQ(0u, ctx->mirror.dropped);
+}
+
+TEST_F(MirrorTest, CountsDroppedFrames)
+{
+    start();
+
+    // three caller copies inside one primary frame, two are never shown
+    display_postcopyfb(dev, 0, 0, 1, 0);
+    display_postcopyfb(dev, 0, 0, 1, 0);
+    display_postcopyfb(dev, 0, 0, 1, 0);
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(1, g_blits);
+    EXPECT_EQ(2u, ctx->mirror.dropped);
+
+    // a mode change holds mode_lock, the frame is dropped instead of waited for
+    display_postcopyfb(dev, 0, 0, 1, 0);
+    pthread_mutex_lock(&mode_lock);
+    EXPECT_EQ(0, vblank(0));
+    pthread_mutex_unlock(&mode_lock);
+    EXPECT_EQ(1, g_blits);
+    EXPECT_EQ(3u, ctx->mirror.dropped);
+
+    // the post is still pending and goes out on the next frame
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(2, g_blits);
+    EXPECT_EQ(2u, ctx->mirror.frames);
+    EXPECT_EQ(3u, ctx->mirror.dropped);
+}
+
+TEST_F(MirrorTest, RetargetsOnMasterSwitch)
+{
+    start();
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(1, g_blit_dst);
+
+    // hdmi becomes the master, the thread gives up the old pair at its next wakeup
+    pthread_mutex_lock(&mode_lock);
+    g_masterdisplay = 1;
+    display_mirrorupdate(ctx);
+    pthread_mutex_unlock(&mode_lock);
+    EXPECT_EQ(1, ctx->mirror.srcfb_id);
+    EXPECT_EQ(0, ctx->mirror.dstfb_id);
+    EXPECT_EQ(1, vblank(0));
+    EXPECT_EQ(1, g_blits);
+
+    EXPECT_EQ(1, frame(1, 0));
+    EXPECT_EQ(2, g_blits);
+    EXPECT_EQ(1, g_blit_src);
+    EXPECT_EQ(0, g_blit_dst);
+    EXPECT_EQ(1, g_pans[0]);
+}
+
+TEST_F(MirrorTest, StopsWhenSecondaryCloses)
+{
+    int                         waits;
+
+    start();
+    EXPECT_EQ(0, frame(0, 1));
+    EXPECT_EQ(1, g_pans[1]);
+
+    EXPECT_EQ(0, display_closedev(dev, 1));
+    EXPECT_EQ(DISPLAY_FALSE, g_display[1].isopen);
+    EXPECT_FALSE(ctx->mirror.active);
+
+    // a caller copy goes straight to g2d now, the thread parks after its wakeup
+    display_postcopyfb(dev, 0, 0, 1, 0);
+    EXPECT_EQ(2, g_blits);
+    pthread_mutex_lock(&g_lock);
+    waits = g_waits;
+    g_vblank[0]++;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    usleep(20000);
+
+    EXPECT_EQ(2, g_blits);
+    EXPECT_EQ(1, g_pans[1]);
+    EXPECT_EQ(waits, g_waits);
+}
@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * the cpu fb copy against a scalar reference. the reference works one
+ * channel of one pixel at a time and shares only the definition of the
+ * scaler with display.cpp: 16.16 source steps, 8 bit weights, channels
+ * widened by repeating their bits and narrowed by truncation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "../display.cpp"
+
+#include <vector>
+
+/* a cpu fb of w x h in fmt, with some slack after each line */
+struct test_fb
+{
+    struct display_softfmt_t    fmt;
+    int                         w;
+    int                         h;
+    int                         stride;
+    std::vector<unsigned char>  mem;
+
+    test_fb(const struct fb_var_screeninfo &var, int width, int height)
+    {
+        EXPECT_EQ(0, display_softfmt(&var, &fmt));
+        w       = width;
+        h       = height;
+        stride  = width * fmt.bpp / 8 + 12;
+        mem.assign(stride * h, 0);
+    }
+
+    uint32_t raw(int x, int y) const
+    {
+        const unsigned char     *p = &mem[y * stride + x * fmt.bpp / 8];
+
+        return fmt.bpp == 16 ? *(const uint16_t *)p : *(const uint32_t *)p;
+    }
+};
+
+static struct fb_var_screeninfo var_rgb565(void)
+{
+    struct fb_var_screeninfo    var;
+
+    memset(&var, 0, sizeof(var));
+    var.bits_per_pixel  = 16;
+    var.red.offset      = 11;
+    var.red.length      = 5;
+    var.green.offset    = 5;
+    var.green.length    = 6;
+    var.blue.length     = 5;
+    return var;
+}
+
+static struct fb_var_screeninfo var_argb8888(void)
+{
+    struct fb_var_screeninfo    var;
+
+    memset(&var, 0, sizeof(var));
+    var.bits_per_pixel  = 32;
+    var.red.offset      = 16;
+    var.red.length      = 8;
+    var.green.offset    = 8;
+    var.green.length    = 8;
+    var.blue.length     = 8;
+    var.transp.offset   = 24;
+    var.transp.length   = 8;
+    return var;
+}
+
+/* argb8888 with r and b swapped, without alpha when opaque */
+static struct fb_var_screeninfo var_abgr8888(bool opaque)
+{
+    struct fb_var_screeninfo    var = var_argb8888();
+
+    var.red.offset      = 0;
+    var.blue.offset     = 16;
+    if(opaque)
+    {
+        var.transp.offset   = 0;
+        var.transp.length   = 0;
+    }
+    return var;
+}
+
+static struct fb_var_screeninfo var_xrgb8888(void)
+{
+    struct fb_var_screeninfo    var = var_argb8888();
+
+    var.transp.offset   = 0;
+    var.transp.length   = 0;
+    return var;
+}
+
+static struct fb_var_screeninfo var_argb4444(void)
+{
+    struct fb_var_screeninfo    var;
+
+    memset(&var, 0, sizeof(var));
+    var.bits_per_pixel  = 16;
+    var.red.offset      = 8;
+    var.red.length      = 4;
+    var.green.offset    = 4;
+    var.green.length    = 4;
+    var.blue.length     = 4;
+    var.transp.offset   = 12;
+    var.transp.length   = 4;
+    return var;
+}
+
+static void fill_random(test_fb *fb, unsigned int seed)
+{
+    srand(seed);
+    for(size_t i = 0; i < fb->mem.size(); i++)
+    {
+        fb->mem[i] = rand() & 0xff;
+    }
+}
+
+/* channel i (r, g, b, a) of pixel x, y widened to 8 bits */
+static int ref_channel(const test_fb &fb, int x, int y, int i)
+{
+    int                         len = fb.fmt.length[i];
+    uint32_t                    v;
+    int                         out = 0;
+
+    if(len == 0)
+    {
+        return i == 3 ? 0xff : 0;
+    }
+    v = (fb.raw(x, y) >> fb.fmt.offset[i]) & ((1u << len) - 1);
+    // bit 7 of the result is the top bit of v, then on down v's bits, wrapping around
+    for(int bit = 0; bit < 8; bit++)
+    {
+        out |= ((v >> (len - 1 - bit % len)) & 1) << (7 - bit);
+    }
+    return out;
+}
+
+static int ref_lerp(int a, int b, int w)
+{
+    int                         d = (b - a) * w;
+
+    // floor division, d can be negative
+    return a + (d >= 0 ? d / 256 : -((-d + 255) / 256));
+}
+
+/* the destination pixel x, y as the reference scaler produces it */
+static uint32_t ref_pixel(const test_fb &src, const test_fb &dst, bool bilinear, int x, int y)
+{
+    uint32_t                    step_x = ((uint32_t)src.w << 16) / dst.w;
+    uint32_t                    step_y = ((uint32_t)src.h << 16) / dst.h;
+    uint32_t                    sx = x * step_x;
+    uint32_t                    sy = y * step_y;
+    int                         x0 = sx >> 16;
+    int                         y0 = sy >> 16;
+    int                         x1 = x0 + 1 < src.w ? x0 + 1 : x0;
+    int                         y1 = y0 + 1 < src.h ? y0 + 1 : y0;
+    int                         wx = (sx >> 8) & 0xff;
+    int                         wy = (sy >> 8) & 0xff;
+    uint32_t                    raw = 0;
+
+    for(int i = 0; i < 4; i++)
+    {
+        int                     c;
+
+        if(bilinear)
+        {
+            c = ref_lerp(ref_lerp(ref_channel(src, x0, y0, i), ref_channel(src, x1, y0, i), wx),
+                         ref_lerp(ref_channel(src, x0, y1, i), ref_channel(src, x1, y1, i), wx), wy);
+        }
+        else
+        {
+            c = ref_channel(src, x0, y0, i);
+        }
+        if(dst.fmt.length[i])
+        {
+            raw |= (uint32_t)(c >> (8 - dst.fmt.length[i])) << dst.fmt.offset[i];
+        }
+    }
+    return raw;
+}
+
+class SoftCopyTest : public ::testing::Test
+{
+protected:
+    struct display_softpool_t   pool;
+
+    virtual void SetUp()
+    {
+        memset(&pool, 0, sizeof(pool));
+        pthread_mutex_init(&pool.lock, NULL);
+        pthread_cond_init(&pool.start, NULL);
+        pthread_cond_init(&pool.done, NULL);
+    }
+
+    virtual void TearDown()
+    {
+        display_softstop(&pool);
+        pthread_mutex_destroy(&pool.lock);
+        pthread_cond_destroy(&pool.start);
+        pthread_cond_destroy(&pool.done);
+    }
+
+    void copy(const test_fb &src, test_fb *dst)
+    {
+        struct display_softcopy_t   job;
+
+        memset(&job, 0, sizeof(job));
+        job.src         = &src.mem[0];
+        job.src_stride  = src.stride;
+        job.src_w       = src.w;
+        job.src_h       = src.h;
+        job.src_fmt     = src.fmt;
+        job.dst         = &dst->mem[0];
+        job.dst_stride  = dst->stride;
+        job.dst_w       = dst->w;
+        job.dst_h       = dst->h;
+        job.dst_fmt     = dst->fmt;
+        job.bilinear    = (dst->w % src.w) || (dst->h % src.h);
+        display_softcopy(&pool, &job);
+    }
+
+    /* every destination pixel against the reference, the line slack untouched */
+    void expect_reference(const test_fb &src, const test_fb &dst)
+    {
+        bool                    bilinear = (dst.w % src.w) || (dst.h % src.h);
+        int                     wrong = 0;
+
+        for(int y = 0; y < dst.h; y++)
+        {
+            for(int x = 0; x < dst.w; x++)
+            {
+                if(dst.raw(x, y) != ref_pixel(src, dst, bilinear, x, y) && wrong++ < 5)
+                {
+                    ADD_FAILURE() << "pixel " << x << "," << y << ": 0x" << std::hex << dst.raw(x, y)
+                                  << ", reference 0x" << ref_pixel(src, dst, bilinear, x, y);
+                }
+            }
+            for(int i = dst.w * dst.fmt.bpp / 8; i < dst.stride; i++)
+            {
+                EXPECT_EQ(0, dst.mem[y * dst.stride + i]) << "line " << y;
+            }
+        }
+        EXPECT_EQ(0, wrong);
+    }
+};
+
+TEST_F(SoftCopyTest, SameLayoutCopiesLines)
+{
+    test_fb                     src(var_argb8888(), 320, 240);
+    test_fb                     dst(var_argb8888(), 320, 240);
+
+    fill_random(&src, 1);
+    copy(src, &dst);
+    for(int y = 0; y < dst.h; y++)
+    {
+        EXPECT_EQ(0, memcmp(&src.mem[y * src.stride], &dst.mem[y * dst.stride], dst.w * 4)) << "line " << y;
+    }
+}
+
+TEST_F(SoftCopyTest, WholeRatioMatchesReference)
+{
+    test_fb                     src(var_rgb565(), 160, 90);
+    test_fb                     dst(var_argb8888(), 320, 180);
+
+    fill_random(&src, 2);
+    copy(src, &dst);
+    expect_reference(src, dst);
+}
+
+TEST_F(SoftCopyTest, BilinearUpscaleMatchesReference)
+{
+    test_fb                     src(var_argb8888(), 128, 72);
+    test_fb                     dst(var_rgb565(), 192, 108);
+
+    fill_random(&src, 3);
+    copy(src, &dst);
+    expect_reference(src, dst);
+}
+
+TEST_F(SoftCopyTest, BilinearDownscaleMatchesReference)
+{
+    test_fb                     src(var_argb4444(), 200, 150);
+    test_fb                     dst(var_argb8888(), 133, 77);
+
+    fill_random(&src, 4);
+    copy(src, &dst);
+    expect_reference(src, dst);
+}
+
+TEST_F(SoftCopyTest, WorkersOutliveCopies)
+{
+    test_fb                     src(var_rgb565(), 96, 64);
+    test_fb                     dst(var_argb8888(), 150, 100);
+    int                         threads = 0;
+
+    for(int i = 0; i < 50; i++)
+    {
+        fill_random(&src, 10 + i);
+        copy(src, &dst);
+        if(i == 0)
+        {
+            threads = pool.threads;
+        }
+        expect_reference(src, dst);
+    }
+    EXPECT_EQ(threads, pool.threads);
+    EXPECT_EQ(threads > 1 ? 50u : 0u, pool.generation);
+}
+
+TEST_F(SoftCopyTest, RowKernelsMatchScalarPath)
+{
+    const struct fb_var_screeninfo  vars[] = { var_rgb565(), var_xrgb8888(), var_argb8888(),
+                                               var_abgr8888(true), var_abgr8888(false) };
+    // odd widths leave a tail after the vector bodies
+    const int                       sizes[][4] = { { 37, 21, 37, 21 }, { 37, 21, 74, 42 },
+                                                   { 37, 21, 61, 50 }, { 90, 60, 37, 23 } };
+    int                             num = sizeof(vars) / sizeof(vars[0]);
+
+    for(int i = 0; i < num; i++)
+    {
+        for(int j = 0; j < num; j++)
+        {
+            for(size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+            {
+                test_fb                     src(vars[i], sizes[k][0], sizes[k][1]);
+                test_fb                     dst(vars[j], sizes[k][2], sizes[k][3]);
+                test_fb                     ref(vars[j], sizes[k][2], sizes[k][3]);
+                struct display_softcopy_t   job;
+
+                EXPECT_NE(DISPLAY_SOFT_OTHER, src.fmt.layout);
+                fill_random(&src, 100 + i * 31 + j * 7 + k);
+                copy(src, &dst);
+
+                memset(&job, 0, sizeof(job));
+                job.src         = &src.mem[0];
+                job.src_stride  = src.stride;
+                job.src_w       = src.w;
+                job.src_h       = src.h;
+                job.src_fmt     = src.fmt;
+                job.dst         = &ref.mem[0];
+                job.dst_stride  = ref.stride;
+                job.dst_w       = ref.w;
+                job.dst_h       = ref.h;
+                job.dst_fmt     = ref.fmt;
+                job.bilinear    = (ref.w % src.w) || (ref.h % src.h);
+                job.y1          = ref.h;
+                display_softcopy_ref(&job);
+
+                // the same layout at the same size is a line copy, alpha garbage and all
+                if(i == j && src.w == dst.w && src.h == dst.h)
+                {
+                    continue;
+                }
+                EXPECT_TRUE(dst.mem == ref.mem) << "layouts " << i << " to " << j << ", size " << k;
+            }
+        }
+    }
+}
+
+TEST(SoftFormatTest, RejectsChannelsItCannotWiden)
+{
+    struct fb_var_screeninfo    var = var_argb8888();
+    struct display_softfmt_t    fmt;
+
+    EXPECT_EQ(0, display_softfmt(&var, &fmt));
+
+    // 2:10:10:10
+    var.transp.offset   = 30;
+    var.transp.length   = 2;
+    var.red.offset      = 20;
+    var.red.length      = 10;
+    var.green.offset    = 10;
+    var.green.length    = 10;
+    var.blue.length     = 10;
+    EXPECT_NE(0, display_softfmt(&var, &fmt));
+
+    // 3:3:2
+    var = var_rgb565();
+    var.red.offset      = 5;
+    var.red.length      = 3;
+    var.green.offset    = 2;
+    var.green.length    = 3;
+    var.blue.length     = 2;
+    EXPECT_NE(0, display_softfmt(&var, &fmt));
+
+    var = var_argb8888();
+    var.bits_per_pixel  = 24;
+    var.transp.length   = 0;
+    EXPECT_NE(0, display_softfmt(&var, &fmt));
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * the cached display state with DEBUG_STATE_CHECK on. ioctl is replaced in
+ * this binary by a disp driver that keeps one output per screen, so the
+ * cache can be put out of step with it the way a missed uevent would.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "../display.cpp"
+
+#if !DEBUG_STATE_CHECK
+#error display_state_test needs -DDEBUG_STATE_CHECK=1
+#endif
+
+static int                      g_fd = -1;
+static int                      g_type[MAX_DISPLAY_NUM];    /* DISP_OUTPUT_TYPE_* */
+static int                      g_tvmode[MAX_DISPLAY_NUM];  /* DISP_TV_MOD_* */
+static int                      g_width[MAX_DISPLAY_NUM];
+static int                      g_height[MAX_DISPLAY_NUM];
+static int                      g_hpd;
+static int                      g_type_reads;
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list                     ap;
+    unsigned long               *args;
+    int                         screen;
+
+    va_start(ap, request);
+    args = va_arg(ap, unsigned long *);
+    va_end(ap);
+
+    if(fd != g_fd)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    screen = args[0] < MAX_DISPLAY_NUM ? args[0] : 0;
+    switch(request)
+    {
+        case DISP_CMD_GET_OUTPUT_TYPE:
+            g_type_reads++;
+            return g_type[screen];
+        case DISP_CMD_TV_GET_MODE:
+        case DISP_CMD_HDMI_GET_MODE:
+            return g_tvmode[screen];
+        case DISP_CMD_SCN_GET_WIDTH:
+            return g_width[screen];
+        case DISP_CMD_SCN_GET_HEIGHT:
+            return g_height[screen];
+        case DISP_CMD_HDMI_GET_HPD_STATUS:
+            return g_hpd;
+        case DISP_CMD_HDMI_SET_MODE:
+            g_tvmode[screen]    = args[1];
+            g_width[screen]     = 1280;
+            g_height[screen]    = 720;
+            return 0;
+        case DISP_CMD_HDMI_ON:
+            g_type[screen]      = DISP_OUTPUT_TYPE_HDMI;
+            return 0;
+        case DISP_CMD_HDMI_OFF:
+            g_type[screen]      = DISP_OUTPUT_TYPE_NONE;
+            return 0;
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+class StateCheckTest : public ::testing::Test
+{
+protected:
+    struct display_context_t    *ctx;
+    struct display_device_t     *dev;
+
+    virtual void SetUp()
+    {
+        g_fd            = open("/dev/null", O_RDONLY);
+        g_type_reads    = 0;
+        g_hpd           = 0;
+        for(int i = 0; i < MAX_DISPLAY_NUM; i++)
+        {
+            g_type[i]   = i == 0 ? DISP_OUTPUT_TYPE_LCD : DISP_OUTPUT_TYPE_NONE;
+            g_tvmode[i] = DISP_TV_MOD_480I;
+            g_width[i]  = i == 0 ? 800 : 0;
+            g_height[i] = i == 0 ? 480 : 0;
+        }
+        g_state_mismatches = 0;
+
+        ctx = (struct display_context_t *)calloc(1, sizeof(*ctx));
+        pthread_mutex_init(&ctx->state_lock, NULL);
+        pthread_mutex_init(&ctx->copy_lock, NULL);
+        ctx->mFD_disp       = g_fd;
+        // a running listener is what enables the cache, the test drops it itself
+        ctx->uevent_started = true;
+        dev = &ctx->device;
+    }
+
+    virtual void TearDown()
+    {
+        pthread_mutex_destroy(&ctx->state_lock);
+        pthread_mutex_destroy(&ctx->copy_lock);
+        free(ctx);
+        close(g_fd);
+        g_fd = -1;
+    }
+};
+
+TEST_F(StateCheckTest, CachedReadsAgreeWithDriver)
+{
+    for(int i = 0; i < 5; i++)
+    {
+        EXPECT_EQ(DISPLAY_DEVICE_LCD, display_getoutputtype(dev, 0));
+        EXPECT_EQ(DISPLAY_DEVICE_NONE, display_getoutputtype(dev, 1));
+        EXPECT_EQ(800, display_getscnsize(ctx, 0, false));
+        EXPECT_EQ(480, display_getscnsize(ctx, 0, true));
+        EXPECT_EQ(0, display_gethdmistatus(dev));
+    }
+
+    // each screen was read into the cache once, every get was checked against the driver
+    EXPECT_EQ(2 + 10, g_type_reads);
+    EXPECT_EQ(0, g_state_mismatches);
+}
+
+TEST_F(StateCheckTest, ReportsChangesTheCacheMissed)
+{
+    EXPECT_EQ(DISPLAY_DEVICE_NONE, display_getoutputtype(dev, 1));
+    EXPECT_EQ(0, display_gethdmistatus(dev));
+
+    // hdmi plugged and switched on by someone else, the uevent is lost
+    g_hpd               = 1;
+    g_type[1]           = DISP_OUTPUT_TYPE_HDMI;
+    g_tvmode[1]         = DISP_TV_MOD_720P_60HZ;
+    g_width[1]          = 1280;
+    g_height[1]         = 720;
+
+    EXPECT_EQ(DISPLAY_DEVICE_NONE, display_getoutputtype(dev, 1));
+    EXPECT_EQ(1, g_state_mismatches);
+    EXPECT_EQ(0, display_gethdmistatus(dev));
+    EXPECT_EQ(2, g_state_mismatches);
+
+    // what the listener does on a switch uevent
+    display_invalidatestate(ctx, -1);
+    EXPECT_EQ(DISPLAY_DEVICE_HDMI, display_getoutputtype(dev, 1));
+    EXPECT_EQ(DISPLAY_TVFORMAT_720P_60HZ, display_gettvformat(dev, 1));
+    EXPECT_EQ(1280, display_getscnsize(ctx, 1, false));
+    EXPECT_EQ(720, display_getscnsize(ctx, 1, true));
+    EXPECT_EQ(1, display_gethdmistatus(dev));
+    EXPECT_EQ(2, g_state_mismatches);
+}
+
+TEST_F(StateCheckTest, OwnModeChangesStayInStep)
+{
+    EXPECT_EQ(DISPLAY_DEVICE_NONE, display_getoutputtype(dev, 1));
+    EXPECT_EQ(0, display_getscnsize(ctx, 1, false));
+
+    display_output(ctx, 1, DISPLAY_DEVICE_HDMI, DISP_TV_MOD_720P_60HZ);
+
+    EXPECT_EQ(DISPLAY_DEVICE_HDMI, display_getoutputtype(dev, 1));
+    EXPECT_EQ(DISPLAY_TVFORMAT_720P_60HZ, display_gettvformat(dev, 1));
+    EXPECT_EQ(1280, display_getscnsize(ctx, 1, false));
+    EXPECT_EQ(720, display_getscnsize(ctx, 1, true));
+    EXPECT_EQ(0, g_state_mismatches);
+}
+
+TEST_F(StateCheckTest, ReopenedScreenIsReadAgain)
+{
+    g_type[1]           = DISP_OUTPUT_TYPE_HDMI;
+    EXPECT_EQ(DISPLAY_DEVICE_HDMI, display_getoutputtype(dev, 1));
+
+    display_off(ctx, 1, DISPLAY_DEVICE_HDMI);
+    EXPECT_EQ(DISPLAY_DEVICE_NONE, display_getoutputtype(dev, 1));
+
+    // the none read after the off must not outlive the on
+    display_on(ctx, 1, DISPLAY_DEVICE_HDMI);
+    EXPECT_EQ(DISPLAY_DEVICE_HDMI, display_getoutputtype(dev, 1));
+    EXPECT_EQ(0, g_state_mismatches);
+}
+
+TEST_F(StateCheckTest, WithoutListenerEveryReadIsFresh)
+{
+    ctx->uevent_started = false;
+
+    EXPECT_EQ(DISPLAY_DEVICE_NONE, display_getoutputtype(dev, 1));
+    g_type[1] = DISP_OUTPUT_TYPE_TV;
+    EXPECT_EQ(DISPLAY_DEVICE_TV, display_getoutputtype(dev, 1));
+    g_hpd = 1;
+    EXPECT_EQ(1, display_gethdmistatus(dev));
+
+    EXPECT_EQ(4, g_type_reads);
+    EXPECT_EQ(0, g_state_mismatches);
+}
@@ -20,10 +20,14 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
-LOCAL_SHARED_LIBRARIES := liblog libutils libEGL
-LOCAL_SRC_FILES := hwcomposer.cpp
+LOCAL_SHARED_LIBRARIES := liblog libutils libcutils libsync
+LOCAL_SRC_FILES := hwcomposer.cpp hwc_vsync.cpp hwc_frame.cpp hwc_dirty.cpp
 LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
+LOCAL_C_INCLUDES += system/core/libsync
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../gralloc $(LOCAL_PATH)/../include
 LOCAL_MODULE := hwcomposer.$(TARGET_BOARD_PLATFORM)
 LOCAL_CFLAGS:= -DLOG_TAG=\"hwcomposer\"
 LOCAL_MODULE_TAGS := optional
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "hwc_dirty.h"
+
+void hwc_dirty_reset(hwc_dirty_t *dirty)
+{
+    dirty->num  = -1;
+    dirty->skip = false;
+}
+
+/*
+ * when only the buffers of overlay layers changed since the last frame,
+ * they explain the refresh and the gles layers are claimed as overlays so
+ * surfaceflinger skips composition, the fb keeps the last composed frame.
+ * anything the buffers do not tell composes in full: a geometry change,
+ * skip layers, layers without a buffer, or a refresh where no buffer
+ * changed at all, which is how an update in place shows.
+ */
+bool hwc_dirty_track(hwc_dirty_t *dirty, hwc_display_contents_1_t *list, hwc_dirty_planned_t planned, void *data)
+{
+    bool                        full = (list->flags & HWC_GEOMETRY_CHANGED)
+                                       || dirty->num != (int)list->numHwLayers
+                                       || list->numHwLayers > HWC_MAX_DIRTY_LAYER;
+    bool                        overlay_changed = false;
+    int                         gles = 0;
+
+    for(int i = 0; i < (int)list->numHwLayers && !full; i++)
+    {
+        hwc_layer_1_t           *layer = &list->hwLayers[i];
+        bool                    changed = (layer->handle != dirty->handle[i]);
+
+        if(layer->compositionType == HWC_FRAMEBUFFER_TARGET)
+        {
+            continue;
+        }
+
+        if(planned(data, i))
+        {
+            overlay_changed |= changed;
+            continue;
+        }
+
+        gles++;
+        if((layer->flags & HWC_SKIP_LAYER) || layer->handle == NULL || changed)
+        {
+            full = true;
+        }
+    }
+
+    dirty->skip = !full && gles > 0 && overlay_changed;
+
+    for(int i = 0; i < (int)list->numHwLayers; i++)
+    {
+        hwc_layer_1_t           *layer = &list->hwLayers[i];
+
+        if(i < HWC_MAX_DIRTY_LAYER)
+        {
+            dirty->handle[i] = layer->handle;
+        }
+
+        if(layer->compositionType == HWC_FRAMEBUFFER_TARGET || (layer->flags & HWC_SKIP_LAYER)
+           || planned(data, i))
+        {
+            continue;
+        }
+
+        layer->compositionType = dirty->skip ? HWC_OVERLAY : HWC_FRAMEBUFFER;
+    }
+
+    dirty->num = (list->numHwLayers > HWC_MAX_DIRTY_LAYER) ? -1 : (int)list->numHwLayers;
+    if(dirty->skip)
+    {
+        dirty->skipped++;
+    }
+
+    return dirty->skip;
+}
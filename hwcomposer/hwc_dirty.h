@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HWC_DIRTY_H__
+#define __HWC_DIRTY_H__
+
+#include <stdbool.h>
+
+#include <hardware/hwcomposer.h>
+
+#define  HWC_MAX_DIRTY_LAYER       32
+
+/* buffers of the last frame, to find frames gles does not have to compose */
+typedef struct hwc_dirty
+{
+    int                 num;            /* -1 until a frame was fully composed */
+    buffer_handle_t     handle[HWC_MAX_DIRTY_LAYER];
+    bool                skip;           /* gles composition skipped this frame */
+    uint32_t            skipped;
+} hwc_dirty_t;
+
+/* true for a layer planned on the DE */
+typedef bool (*hwc_dirty_planned_t)(void *data, int index);
+
+void hwc_dirty_reset(hwc_dirty_t *dirty);
+bool hwc_dirty_track(hwc_dirty_t *dirty, hwc_display_contents_1_t *list, hwc_dirty_planned_t planned, void *data);
+
+#endif
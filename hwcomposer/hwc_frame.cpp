@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/atomic.h>
+
+#include "hwc_frame.h"
+
+void hwc_frame_queue_reset(hwc_frame_queue_t *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->head     = 0;
+    queue->count    = 0;
+    queue->shown    = false;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void hwc_frame_queue_push(hwc_frame_queue_t *queue, const hwcqueueframepara_t *para)
+{
+    pthread_mutex_lock(&queue->lock);
+    if(queue->count == HWC_FRAME_QUEUE_LEN)
+    {
+        // the player runs ahead of the display, drop the oldest frame
+        queue->head = (queue->head + 1) % HWC_FRAME_QUEUE_LEN;
+        queue->count--;
+        queue->dropped++;
+    }
+    queue->entry[(queue->head + queue->count) % HWC_FRAME_QUEUE_LEN] = *para;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * takes the newest frame due by due, older due frames are dropped. frames
+ * without a present time are due at once. returns false and counts a
+ * repeat when nothing is due.
+ */
+bool hwc_frame_queue_pop(hwc_frame_queue_t *queue, nsecs_t due, hwcqueueframepara_t *frame)
+{
+    bool                        found = false;
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count > 0)
+    {
+        hwcqueueframepara_t     *entry = &queue->entry[queue->head];
+
+        if(entry->present_time != 0 && entry->present_time > due)
+        {
+            break;
+        }
+        if(found)
+        {
+            queue->dropped++;
+        }
+        *frame  = *entry;
+        found   = true;
+        queue->head = (queue->head + 1) % HWC_FRAME_QUEUE_LEN;
+        queue->count--;
+    }
+    if(found)
+    {
+        queue->shown = true;
+    }
+    else if(queue->shown)
+    {
+        queue->repeated++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+/* only while neither side runs, enable is cleared first */
+void hwc_frame_mailbox_reset(hwc_frame_mailbox_t *mailbox)
+{
+    mailbox->back   = 0;
+    mailbox->state  = 1;
+    mailbox->front  = 2;
+}
+
+/*
+ * player side, never blocks: the frame goes to the back slot which is then
+ * swapped with the middle one. a middle frame still unread is coalesced.
+ */
+void hwc_frame_mailbox_post(hwc_frame_mailbox_t *mailbox, const libhwclayerpara_t *para)
+{
+    int32_t                     state;
+
+    mailbox->slot[mailbox->back] = *para;
+    do
+    {
+        state = android_atomic_acquire_load(&mailbox->state);
+    } while(android_atomic_release_cas(state, mailbox->back | HWC_MAILBOX_FRESH, &mailbox->state));
+    mailbox->back = state & HWC_MAILBOX_INDEX;
+
+    android_atomic_inc(&mailbox->posted);
+    if(state & HWC_MAILBOX_FRESH)
+    {
+        android_atomic_inc(&mailbox->coalesced);
+    }
+}
+
+/*
+ * vsync thread side: the newest posted frame, or NULL when nothing was
+ * posted since the last take. the frame stays valid until the next take.
+ */
+const libhwclayerpara_t *hwc_frame_mailbox_take(hwc_frame_mailbox_t *mailbox)
+{
+    int32_t                     state;
+
+    if(!(android_atomic_acquire_load(&mailbox->state) & HWC_MAILBOX_FRESH))
+    {
+        return NULL;
+    }
+
+    do
+    {
+        state = android_atomic_acquire_load(&mailbox->state);
+    } while(android_atomic_acquire_cas(state, mailbox->front, &mailbox->state));
+    mailbox->front = state & HWC_MAILBOX_INDEX;
+
+    return &mailbox->slot[mailbox->front];
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HWC_FRAME_H__
+#define __HWC_FRAME_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <hardware/hwcomposer.h>
+#include <utils/Timers.h>
+
+#define  HWC_FRAME_QUEUE_LEN       4
+#define  HWC_MAILBOX_INDEX         3    /* mailbox state: index of the middle slot */
+#define  HWC_MAILBOX_FRESH         4    /* mailbox state: the middle slot was not read yet */
+
+/* video frames waiting for the vsync they are due on */
+typedef struct hwc_frame_queue
+{
+    bool                enable;
+    pthread_mutex_t     lock;
+    hwcqueueframepara_t entry[HWC_FRAME_QUEUE_LEN];
+    int                 head;
+    int                 count;
+    bool                shown;          /* a queued frame is on screen */
+    uint32_t            dropped;        /* frames replaced before they were shown */
+    uint32_t            repeated;       /* vsyncs that kept the previous frame */
+} hwc_frame_queue_t;
+
+void hwc_frame_queue_reset(hwc_frame_queue_t *queue);
+void hwc_frame_queue_push(hwc_frame_queue_t *queue, const hwcqueueframepara_t *para);
+bool hwc_frame_queue_pop(hwc_frame_queue_t *queue, nsecs_t due, hwcqueueframepara_t *frame);
+
+/*
+ * latest frame handed from the player to the vsync thread. a triple buffer:
+ * the player fills the back slot and swaps it with the middle one, the vsync
+ * thread swaps the middle one out when it is fresh. nobody waits.
+ */
+typedef struct hwc_frame_mailbox
+{
+    volatile int32_t    enable;
+    volatile int32_t    state;          /* HWC_MAILBOX_INDEX | HWC_MAILBOX_FRESH */
+    libhwclayerpara_t   slot[3];
+    int                 back;           /* owned by the player */
+    int                 front;          /* owned by the vsync thread */
+    volatile int32_t    posted;
+    volatile int32_t    coalesced;      /* frames replaced before the vsync thread took them */
+} hwc_frame_mailbox_t;
+
+void hwc_frame_mailbox_reset(hwc_frame_mailbox_t *mailbox);
+void hwc_frame_mailbox_post(hwc_frame_mailbox_t *mailbox, const libhwclayerpara_t *para);
+const libhwclayerpara_t *hwc_frame_mailbox_take(hwc_frame_mailbox_t *mailbox);
+
+#endif
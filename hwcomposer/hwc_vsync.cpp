@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+
+#include <fb.h>
+#include <linux/fb.h>
+
+#include "hwc_vsync.h"
+
+#ifdef __BIONIC__
+extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
+                           const struct timespec *request,
+                           struct timespec *remain);
+#endif
+
+/* refresh period of the mode programmed on the fb, false if the fb has no timing */
+static bool hwc_vsync_read_mode(int fd, nsecs_t *period)
+{
+    struct fb_var_screeninfo    var;
+    uint64_t                    htotal;
+    uint64_t                    vtotal;
+
+    if(fd < 0 || ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0 || var.pixclock == 0)
+    {
+        return false;
+    }
+
+    htotal = var.xres + var.left_margin + var.right_margin + var.hsync_len;
+    vtotal = var.yres + var.upper_margin + var.lower_margin + var.vsync_len;
+    if(var.vmode & FB_VMODE_INTERLACED)
+    {
+        vtotal >>= 1;
+    }
+
+    /* pixclock is in picoseconds */
+    *period = (nsecs_t)(htotal * vtotal * var.pixclock / 1000);
+
+    return true;
+}
+
+nsecs_t hwc_vsync_mode_period(int fd)
+{
+    nsecs_t                     period;
+
+    if(!hwc_vsync_read_mode(fd, &period))
+    {
+        return HWC_DEFAULT_VSYNC_PERIOD;
+    }
+
+    return period;
+}
+
+void hwc_vsync_init(hwc_vsync_source_t *src, int fd)
+{
+    memset(src, 0, sizeof(hwc_vsync_source_t));
+    src->fd             = fd;
+    src->hw_wait        = (fd >= 0);
+    src->mode_period    = HWC_DEFAULT_VSYNC_PERIOD;
+    src->period         = HWC_DEFAULT_VSYNC_PERIOD;
+    hwc_vsync_reset(src);
+}
+
+/*
+ * start again from the mode on the fb. without a pixclock the period is
+ * measured instead: the current one is kept until the median of the next
+ * HWC_VSYNC_LOCK_NUM hardware intervals replaces it.
+ */
+void hwc_vsync_reset(hwc_vsync_source_t *src)
+{
+    nsecs_t                     period;
+
+    src->last_hw    = 0;
+    src->lock_num   = 0;
+    src->measured   = !hwc_vsync_read_mode(src->fd, &period);
+    if(!src->measured)
+    {
+        src->mode_period    = period;
+        src->period         = period;
+    }
+}
+
+/*
+ * hwc_vsync_reset for threads other than the one in hwc_vsync_wait, which
+ * owns the source. the reset is done before its next wait.
+ */
+void hwc_vsync_request_reset(hwc_vsync_source_t *src)
+{
+    android_atomic_release_store(1, &src->reset_pending);
+}
+
+/* median of the collected intervals, a few missed vblanks do not move it */
+static nsecs_t hwc_vsync_lock_period(hwc_vsync_source_t *src)
+{
+    nsecs_t                     sorted[HWC_VSYNC_LOCK_NUM];
+    nsecs_t                     t;
+    int                         i;
+    int                         j;
+
+    memcpy(sorted, src->lock, sizeof(sorted));
+    for(i = 1; i < HWC_VSYNC_LOCK_NUM; i++)
+    {
+        t = sorted[i];
+        for(j = i; j > 0 && sorted[j - 1] > t; j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = t;
+    }
+
+    return sorted[HWC_VSYNC_LOCK_NUM / 2];
+}
+
+/*
+ * feed a hardware timestamp into the software pll. missed vblanks are folded
+ * back into a single period, and the period follows the hardware with a 1/8
+ * gain so a noisy wakeup does not move the predicted phase much.
+ */
+void hwc_vsync_track(hwc_vsync_source_t *src, nsecs_t timestamp)
+{
+    nsecs_t                     interval;
+    nsecs_t                     sample;
+    nsecs_t                     n;
+
+    if(src->last_hw != 0 && src->measured && src->lock_num < HWC_VSYNC_LOCK_NUM)
+    {
+        src->lock[src->lock_num++] = timestamp - src->last_hw;
+        if(src->lock_num == HWC_VSYNC_LOCK_NUM)
+        {
+            src->mode_period    = hwc_vsync_lock_period(src);
+            src->period         = src->mode_period;
+        }
+    }
+    else if(src->last_hw != 0)
+    {
+        interval = timestamp - src->last_hw;
+        n        = (interval + (src->period >> 1)) / src->period;
+        if(n > 0)
+        {
+            sample = interval / n;
+            if(sample > src->mode_period - (src->mode_period >> 3)
+               && sample < src->mode_period + (src->mode_period >> 3))
+            {
+                src->period += (sample - src->period) >> 3;
+            }
+            else
+            {
+                /* the mode changed under us, start again from the new mode */
+                hwc_vsync_reset(src);
+            }
+        }
+    }
+
+    src->last_hw = timestamp;
+}
+
+/* next vsync predicted from the last hardware timestamp */
+nsecs_t hwc_vsync_predict(hwc_vsync_source_t *src, nsecs_t now)
+{
+    nsecs_t                     base = src->last_hw ? src->last_hw : src->last;
+
+    if(base == 0)
+    {
+        return now + src->period;
+    }
+
+    if(base > now)
+    {
+        return base;
+    }
+
+    return base + ((now - base) / src->period + 1) * src->period;
+}
+
+nsecs_t hwc_vsync_wait(hwc_vsync_source_t *src)
+{
+    struct timespec             spec;
+    nsecs_t                     next;
+    nsecs_t                     now;
+    __u32                       arg = 0;
+    int                         err;
+
+    if(android_atomic_acquire_load(&src->reset_pending))
+    {
+        android_atomic_release_store(0, &src->reset_pending);
+        hwc_vsync_reset(src);
+    }
+
+    if(src->hw_wait)
+    {
+        if(ioctl(src->fd, FBIO_WAITFORVSYNC, &arg) == 0)
+        {
+            now = systemTime(CLOCK_MONOTONIC);
+            hwc_vsync_track(src, now);
+            src->last = now;
+
+            return now;
+        }
+
+        if(errno == ENOTTY || errno == EINVAL || errno == ENOSYS)
+        {
+            ALOGW("fb has no vsync wait (%s), using software vsync", strerror(errno));
+            src->hw_wait = false;
+        }
+    }
+
+    now  = systemTime(CLOCK_MONOTONIC);
+    next = hwc_vsync_predict(src, now);
+    if(next <= src->last)
+    {
+        next += src->period;
+    }
+
+    spec.tv_sec  = next / 1000000000;
+    spec.tv_nsec = next % 1000000000;
+
+    // the error is returned, errno is left alone
+    do {
+        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+    } while (err == EINTR);
+
+    src->last = next;
+
+    return next;
+}
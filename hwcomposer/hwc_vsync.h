@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HWC_VSYNC_H__
+#define __HWC_VSYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+#define  HWC_DEFAULT_VSYNC_PERIOD  (1000000000 / 60)
+#define  HWC_VSYNC_LOCK_NUM        7    /* hw intervals the period locks to without a mode */
+
+/* vsync timeline, locked to the display driver's vblank when it has one */
+typedef struct hwc_vsync_source
+{
+    int                 fd;
+    bool                hw_wait;        /* FBIO_WAITFORVSYNC usable on fd */
+    nsecs_t             mode_period;    /* period derived from the active mode */
+    bool                measured;       /* the fb has no pixclock, mode_period is measured */
+    int                 lock_num;       /* intervals collected while measured */
+    nsecs_t             lock[HWC_VSYNC_LOCK_NUM];
+    nsecs_t             period;         /* period measured from hw timestamps */
+    nsecs_t             last_hw;        /* last timestamp seen from the hardware */
+    nsecs_t             last;           /* last timestamp reported */
+    volatile int32_t    reset_pending;  /* hwc_vsync_request_reset, applied by the waiting thread */
+} hwc_vsync_source_t;
+
+nsecs_t hwc_vsync_mode_period(int fd);
+void hwc_vsync_init(hwc_vsync_source_t *src, int fd);
+void hwc_vsync_reset(hwc_vsync_source_t *src);
+void hwc_vsync_request_reset(hwc_vsync_source_t *src);
+void hwc_vsync_track(hwc_vsync_source_t *src, nsecs_t timestamp);
+nsecs_t hwc_vsync_predict(hwc_vsync_source_t *src, nsecs_t now);
+nsecs_t hwc_vsync_wait(hwc_vsync_source_t *src);
+
+#endif
@@ -5,17 +5,210 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
 
 #include <hardware/hwcomposer.h>
 
-#include <EGL/egl.h>
+#include <utils/Timers.h>
+
+#include "hwc_vsync.h"
+#include "hwc_frame.h"
+#include "hwc_dirty.h"
+
+/* device node root, point it at stand-in nodes to run off target */
+#ifndef SUNXI_DEV_ROOT
+#define  SUNXI_DEV_ROOT   "/dev"
+#endif
 
 #define  MAX_FBNUM        8
 #define  MAX_LAYERNUM    8
 
+#define  HWC_MAX_SCREEN            2
+#define  HWC_SCALER_NUM            2    /* DE scalers, shared by both screens */
+#define  HWC_LAYER_NUM_PER_SCN     4    /* DE layers per screen, one is held by the fb */
+#define  HWC_MAX_CANDIDATE         16
+#define  HWC_TRACE_BUCKETS         16   /* log2 microsecond latency buckets */
+#define  HWC_TRACE_CMD_SLOTS       64
+#define  HWC_TRACE_PROPERTY        "debug.hwc.trace"
+#define  HWC_LAYER_POOL_NUM        1    /* closed video layers kept requested per screen */
+#define  HWC_FB_TARGET_BPP         4    /* surfaceflinger allocates fb targets as rgba8888 */
+
+typedef enum
+{
+    HWC_PLANE_NONE      = 0,
+    HWC_PLANE_SCALER    = 1,    /* DE layer in scaler mode, yuv or scaled sources */
+} hwc_plane_type_t;
+
+typedef struct hwc_plane_assign
+{
+    int                 index;      /* index in hwLayers */
+    hwc_plane_type_t    type;
+    uint32_t            score;      /* gles fill saved, in bytes per frame */
+} hwc_plane_assign_t;
+
+typedef struct hwc_overlay_plan
+{
+    hwc_plane_assign_t  assign[HWC_LAYER_NUM_PER_SCN];
+    int                 num;
+    int                 scaler_num;
+    int                 video_index;    /* hwLayers index fed by the video layer, -1 if none */
+    uint32_t            saved;
+} hwc_overlay_plan_t;
+
+/* last geometry pushed to the video layer, to skip per frame reconfiguration */
+typedef struct hwc_geometry_cache
+{
+    bool                valid;
+    hwc_rect_t          crop;
+    hwc_rect_t          frame;
+    uint32_t            transform;
+    uint32_t            handle;
+    uint32_t            screen;
+    bool                trd_enable;
+    bool                half_enable;
+    int                 out_type;       /* output the geometry was computed for */
+    int                 out_mode;
+    uint32_t            out_width;
+    uint32_t            out_height;
+} hwc_geometry_cache_t;
+
+/* a batch of layer changes applied through the driver's command cache */
+typedef struct hwc_commit
+{
+    pthread_mutex_t     lock;           /* recursive, held from begin to end */
+    int                 depth;
+    bool                cached;         /* DISP_CMD_START_CMD_CACHE issued */
+    nsecs_t             vblank;         /* vsync the last commit was issued after */
+    uint32_t            count;
+    uint32_t            same_vblank;    /* commits issued within one vblank */
+} hwc_commit_t;
+
+/* sw_sync timeline advanced as committed frames are latched by the DE */
+typedef struct hwc_fence_timeline
+{
+    int                 fd;             /* -1 when the kernel has no sw_sync */
+    pthread_mutex_t     lock;
+    uint32_t            committed;      /* sync point of the last committed frame */
+    nsecs_t             commit_time;
+    uint32_t            signaled;       /* last sync point signalled */
+} hwc_fence_timeline_t;
+
+typedef struct hwc_trace_hist
+{
+    uint32_t            count;
+    nsecs_t             total;
+    nsecs_t             max;
+    uint32_t            bucket[HWC_TRACE_BUCKETS];
+} hwc_trace_hist_t;
+
+typedef struct hwc_trace_cmd
+{
+    int                 cmd;
+    uint32_t            errors;
+    hwc_trace_hist_t    hist;
+} hwc_trace_cmd_t;
+
+/* display driver ioctl and frame latency statistics, reported by dump */
+typedef struct hwc_trace
+{
+    bool                enable;         /* HWC_TRACE_PROPERTY, read at open */
+    pthread_mutex_t     lock;
+    hwc_trace_cmd_t     cmd[HWC_TRACE_CMD_SLOTS];
+    int                 cmd_num;
+    nsecs_t             prepare_time;
+    nsecs_t             set_time[HWC_MAX_SCREEN];
+    hwc_trace_hist_t    prepare_to_set;
+    hwc_trace_hist_t    set_to_vsync[HWC_MAX_SCREEN];
+} hwc_trace_t;
+
+/* what the driver reports for a screen, dropped on hotplug and mode changes */
+typedef struct hwc_output_state
+{
+    pthread_mutex_t     lock;
+    bool                valid;
+    int                 type;           /* DISP_OUTPUT_TYPE_* */
+    int                 mode;           /* tv or hdmi timing, 0 for other outputs */
+    uint32_t            width;
+    uint32_t            height;
+} hwc_output_state_t;
+
+/* requested but closed video layers, handed out before asking the driver */
+typedef struct hwc_layer_pool
+{
+    uint32_t            hdl[HWC_LAYER_POOL_NUM];
+    int                 num;
+    uint32_t            hits;
+    uint32_t            misses;
+} hwc_layer_pool_t;
+
+/* layer and hdmi setup a HWC_LAYER_SET3DMODE request resolves to */
+typedef struct hwc_3d_target
+{
+    int                 hdmi_mode;      /* DISP_TV_MOD_* to switch to, -1 to keep the timing */
+    int                 trd_mode;       /* source layout, fb.trd_mode */
+    bool                trd_src;
+    bool                trd_out;
+    bool                trd_enable;     /* resulting cur_3denable */
+    bool                half_enable;    /* resulting cur_half_enable */
+} hwc_3d_target_t;
+
+typedef struct hwc_3d_stats
+{
+    uint32_t            hdmi_cycles;    /* hdmi off/set mode/on sequences run */
+    uint32_t            hdmi_skipped;   /* mode switches found already in place */
+} hwc_3d_stats_t;
+
+/* video layer enhancement profile, kept across layer release and request */
+typedef struct hwc_enhance
+{
+    bool                vpp;
+    int                 luma_sharp;
+    int                 chroma_sharp;
+    int                 white_exten;
+    int                 black_exten;
+    uint32_t            hdl;            /* layer the profile was last applied to, 0 if none */
+} hwc_enhance_t;
+
+struct hwc_context_t;
+
+/* how a copied framebuffer target is written into an fb, see hwc_fb_copyfmt */
+typedef enum
+{
+    HWC_FB_COPY_NONE    = 0,    /* fb layout the copy cannot write */
+    HWC_FB_COPY_RGBA    = 1,    /* same layout as the target, rows are copied */
+    HWC_FB_COPY_BGRA    = 2,    /* red and blue swapped */
+    HWC_FB_COPY_RGB565  = 3,
+} hwc_fb_copy_t;
+
+/* fbN a display's framebuffer target is posted to */
+typedef struct hwc_fb_post
+{
+    int                     fd;
+    void                    *base;          /* mapped on the first copied post */
+    size_t                  size;
+    unsigned long           start;          /* smem_start the mapping was made of */
+    uint32_t                posts;
+    uint32_t                copies;
+    uint32_t                rejected;       /* targets the fb layout could not take */
+} hwc_fb_post_t;
+
+/* one hwc display, display N is composed on DE screen N and fbN */
+typedef struct sun4i_hwc_display
+{
+    struct hwc_context_t    *ctx;
+    int                     disp;
+    bool                    connected;
+    bool                    vsync_enabled;
+    pthread_t               vsync_thread;
+    bool                    vsync_running;  /* vsync_thread was created and is joined on close */
+    hwc_vsync_source_t      vsync;
+    hwc_fence_timeline_t    fence;
+    hwc_fb_post_t           fb;
+} sun4i_hwc_display_t;
+
 typedef struct sun4i_hwc_layer
 {
     hwc_layer_1_t            base;
@@ -49,6 +242,9 @@ typedef struct sun4i_hwc_layer
     uint32_t            screen;
     uint32_t            currenthandle;
     uint32_t            cur_frameid;
+    uint32_t            latched_frameid;    /* last frame the DE has picked up */
+    nsecs_t             frame_time;
+    bool                frame_pending;
 } sun4i_hwc_layer_1_t;
 
 typedef struct hwc_context_t
@@ -65,10 +261,27 @@ typedef struct hwc_context_t
     uint32_t                cur_3dmode;
     bool                    cur_half_enable;
     bool                    cur_3denable;
+    hwc_overlay_plan_t      plan[HWC_MAX_SCREEN];
+    hwc_geometry_cache_t    geometry[HWC_MAX_SCREEN];
+    sun4i_hwc_display_t     display[HWC_MAX_SCREEN];
+    hwc_commit_t            commit[HWC_MAX_SCREEN];
+    hwc_output_state_t      output[HWC_MAX_SCREEN];
+    hwc_layer_pool_t        pool[HWC_MAX_SCREEN];
+    hwc_3d_stats_t          trd;
+    hwc_enhance_t           enhance;
+    hwc_frame_queue_t       frame_queue;
+    hwc_frame_mailbox_t     mailbox;
+    hwc_dirty_t             dirty[HWC_MAX_SCREEN];
+    pthread_mutex_t         video_lock;     /* recursive, serialises the video layer state */
+    pthread_mutex_t         mode_lock;      /* serialises screen and 3d switches, taken before video_lock */
+    pthread_mutex_t         hdmi_lock;      /* held over an hdmi mode switch, only the trace lock is taken inside */
+    pthread_mutex_t         hotplug_lock;   /* serialises hwc_update_hotplug of the uevent and vsync threads */
+    int                     uevent_fd;      /* -1 when there is no uevent thread */
+    int                     uevent_wake[2]; /* pipe written on close, wakes the uevent thread */
+    pthread_t               uevent_thread;
+    volatile int32_t        quit;           /* set on close, the hwc threads leave their loops */
     /* our private state goes below here */
     bool                    wait_layer_open;
-    bool                    vsync_enabled;
-    pthread_t               vsync_thread;
 }sun4i_hwc_context_t;
 
 #ifdef __GNUC__
@@ -79,8 +292,4 @@ typedef struct hwc_context_t
 #define unlikely(x)     (x)
 #endif
 
-extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
-                           const struct timespec *request,
-                           struct timespec *remain);
-
 #endif
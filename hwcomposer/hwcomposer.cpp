@@ -22,31 +22,125 @@
 #include <errno.h>
 #include <time.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <pthread.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include <utils/Timers.h>
 
 #include <hardware/hwcomposer.h>
+#include <hardware/display.h>
 #include <sunxi_disp_ioctl.h>
 #include <fb.h>
-#include <EGL/egl.h>
+#include <linux/fb.h>
+#include <sync/sync.h>
+#include <sw_sync.h>
 
 #include "hwccomposer_priv.h"
+#include "gralloc_priv.h"
 
 /*****************************************************************************/
 unsigned int                    g_lcd_width        = 480;
 unsigned int                    g_lcd_height       = 800;
 unsigned int                    g_lcd_bpp          = 32;
 
-unsigned long                   args[4];
 unsigned long                     fb_layer_hdl;
 
+/* fb0 row pitch, gralloc framebuffer buffers are pages of it */
+static unsigned int             g_fb_line_length;
+
+static hwc_trace_t              g_trace = { false, PTHREAD_MUTEX_INITIALIZER };
+
+static void hwc_trace_add(hwc_trace_hist_t *hist, nsecs_t latency)
+{
+    nsecs_t                     us = latency / 1000;
+    int                         bucket = 0;
+
+    while(us > 0 && bucket < HWC_TRACE_BUCKETS - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+
+    hist->count++;
+    hist->total += latency;
+    if(latency > hist->max)
+    {
+        hist->max = latency;
+    }
+    hist->bucket[bucket]++;
+}
+
+static hwc_trace_cmd_t *hwc_trace_cmd(int cmd)
+{
+    for(int i = 0; i < g_trace.cmd_num; i++)
+    {
+        if(g_trace.cmd[i].cmd == cmd)
+        {
+            return &g_trace.cmd[i];
+        }
+    }
+
+    if(g_trace.cmd_num == HWC_TRACE_CMD_SLOTS)
+    {
+        return NULL;
+    }
+
+    g_trace.cmd[g_trace.cmd_num].cmd = cmd;
+    return &g_trace.cmd[g_trace.cmd_num++];
+}
+
+/* every display driver ioctl goes through here to be timed when tracing */
+static int hwc_ioctl(int fd, int cmd, ...)
+{
+    hwc_trace_cmd_t             *trace;
+    va_list                     ap;
+    void                        *arg;
+    nsecs_t                     start;
+    nsecs_t                     latency;
+    int                         ret;
+    int                         err;
+
+    va_start(ap, cmd);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if(!g_trace.enable)
+    {
+        return ioctl(fd, cmd, arg);
+    }
+
+    start   = systemTime(CLOCK_MONOTONIC);
+    ret     = ioctl(fd, cmd, arg);
+    err     = errno;
+    latency = systemTime(CLOCK_MONOTONIC) - start;
+
+    pthread_mutex_lock(&g_trace.lock);
+    trace = hwc_trace_cmd(cmd);
+    if(trace)
+    {
+        hwc_trace_add(&trace->hist, latency);
+        if(ret == -1)
+        {
+            trace->errors++;
+        }
+    }
+    pthread_mutex_unlock(&g_trace.lock);
+
+    errno = err;
+    return ret;
+}
+
 
 static int hwc_device_open(const struct hw_module_t* module, const char* name,
         struct hw_device_t** device);
@@ -74,7 +168,7 @@ static int hwc_open_disp(void)
 {
         int fd, tmp, ret;
 
-	fd = open("/dev/disp", O_RDWR);
+	fd = open(SUNXI_DEV_ROOT "/disp", O_RDWR);
 	if (fd < 0) {
 		ALOGE("Failed to open overlay device : %s\n", strerror(errno));
 		return -1;
@@ -98,8 +192,166 @@ static int hwc_open_disp(void)
 	return fd;
 }
 
+/* timing of the screen's output, 0 for outputs without one, -1 on error */
+static int hwc_output_read_mode(sun4i_hwc_context_t *ctx, uint32_t screen, int type)
+{
+    unsigned long               args[4] = {0};
+
+    args[0]                         = screen;
+    if(type == DISP_OUTPUT_TYPE_HDMI)
+    {
+        return hwc_ioctl(ctx->dispfd, DISP_CMD_HDMI_GET_MODE, args);
+    }
+    if(type == DISP_OUTPUT_TYPE_TV)
+    {
+        return hwc_ioctl(ctx->dispfd, DISP_CMD_TV_GET_MODE, args);
+    }
+    return 0;
+}
+
+/*
+ * query what the driver reports for the screen, with output->lock held. a
+ * failed read is not cached, the old values are kept and the next read
+ * asks the driver again.
+ */
+static void hwc_output_query(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_output_state_t          *output = &ctx->output[screen];
+    unsigned long               args[4] = {0};
+    int                         type;
+    int                         mode;
+    int                         width;
+    int                         height;
+
+    args[0]                         = screen;
+    type                            = hwc_ioctl(ctx->dispfd, DISP_CMD_GET_OUTPUT_TYPE, args);
+    mode                            = hwc_output_read_mode(ctx, screen, type);
+    width                           = hwc_ioctl(ctx->dispfd, DISP_CMD_SCN_GET_WIDTH, args);
+    height                          = hwc_ioctl(ctx->dispfd, DISP_CMD_SCN_GET_HEIGHT, args);
+    if(type < 0 || mode < 0 || width < 0 || height < 0)
+    {
+        output->valid               = false;
+        return;
+    }
+
+    output->type                    = type;
+    output->mode                    = mode;
+    output->width                   = width;
+    output->height                  = height;
+    output->valid                   = true;
+}
+
+static void hwc_invalidate_geometry(sun4i_hwc_context_t *ctx);
+
+/* next read of the screen's output state goes to the driver again */
+static void hwc_output_invalidate(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_output_state_t          *output = &ctx->output[screen];
+
+    pthread_mutex_lock(&output->lock);
+    output->valid = false;
+    pthread_mutex_unlock(&output->lock);
+
+    // the video layer window was scaled for the old output
+    hwc_invalidate_geometry(ctx);
+}
+
+static int hwc_output_type(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_output_state_t          *output = &ctx->output[screen];
+    int                         type;
+
+    pthread_mutex_lock(&output->lock);
+    if(!output->valid)
+    {
+        hwc_output_query(ctx, screen);
+    }
+    type = output->type;
+    pthread_mutex_unlock(&output->lock);
+
+    return type;
+}
+
+static void hwc_output_size(sun4i_hwc_context_t *ctx, uint32_t screen, uint32_t *width, uint32_t *height)
+{
+    hwc_output_state_t          *output = &ctx->output[screen];
+
+    pthread_mutex_lock(&output->lock);
+    if(!output->valid)
+    {
+        hwc_output_query(ctx, screen);
+    }
+    *width  = output->width;
+    *height = output->height;
+    pthread_mutex_unlock(&output->lock);
+}
+
+/* everything about the output a video layer window depends on */
+static void hwc_output_mode(sun4i_hwc_context_t *ctx, uint32_t screen, int *type, int *mode,
+                            uint32_t *width, uint32_t *height)
+{
+    hwc_output_state_t          *output = &ctx->output[screen];
+
+    pthread_mutex_lock(&output->lock);
+    if(!output->valid)
+    {
+        hwc_output_query(ctx, screen);
+    }
+    *type   = output->type;
+    *mode   = output->mode;
+    *width  = output->width;
+    *height = output->height;
+    pthread_mutex_unlock(&output->lock);
+}
+
+/*
+ * polled for hotplug and for mode changes made by the display hal, which
+ * runs in another process: only the output type and timing are read back,
+ * the screen size is queried again when either changed. returns true on a
+ * change.
+ */
+static bool hwc_output_refresh(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_output_state_t          *output = &ctx->output[screen];
+    unsigned long               args[4] = {0};
+    bool                        changed;
+    int                         type;
+    int                         mode;
+
+    args[0] = screen;
+    type    = hwc_ioctl(ctx->dispfd, DISP_CMD_GET_OUTPUT_TYPE, args);
+    mode    = hwc_output_read_mode(ctx, screen, type);
+    if(type < 0 || mode < 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&output->lock);
+    changed = !output->valid || output->type != type || output->mode != mode;
+    if(changed)
+    {
+        hwc_output_query(ctx, screen);
+    }
+    pthread_mutex_unlock(&output->lock);
+
+    if(changed)
+    {
+        // the video layer window was scaled for the old output
+        hwc_invalidate_geometry(ctx);
+    }
+
+    return changed;
+}
+
+static bool hwc_3d_set_hdmi(sun4i_hwc_context_t *ctx, uint32_t screen, uint32_t mode);
+static void hwc_update_hotplug(sun4i_hwc_context_t *ctx, int disp);
+static bool hwc_display_owned(int disp);
+static void hwc_threads_stop(sun4i_hwc_context_t *ctx);
+static void hwc_enhance_apply(sun4i_hwc_context_t *ctx, uint32_t screen, uint32_t hdl);
+
 static int hwc_setcolorkey(sun4i_hwc_context_t  *ctx)
 {
+    unsigned long               args[4] = {0};
     int                          fbfh0;
     __disp_colorkey_t             ck;
     int                         ret;
@@ -111,7 +363,7 @@ static int hwc_setcolorkey(sun4i_hwc_context_t  *ctx)
         args[1]                         = ctx->hwc_layer.currenthandle;
         args[2]                         = 0;
         args[3]                         = 0;
-        ret                             = ioctl(ctx->dispfd, DISP_CMD_LAYER_TOP,args);
+        ret                             = hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_TOP,args);
         if(ret != 0)
         {
             //open display layer failed, need send play end command, and exit
@@ -124,16 +376,16 @@ static int hwc_setcolorkey(sun4i_hwc_context_t  *ctx)
         args[1]                         = ctx->hwc_layer.currenthandle;
         if(ctx->hwc_screen == 0)  //screen0 use pixel alpha
         {
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_CK_OFF,args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_CK_OFF,args);
         }
         else  //screen1 use colorkey
         {
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_CK_ON,args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_CK_ON,args);
         }
     }
 
 
-    fbfh0 = open("/dev/graphics/fb0",O_RDWR);
+    fbfh0 = open(SUNXI_DEV_ROOT "/graphics/fb0",O_RDWR);
     if(fbfh0 < 0)
     {
         ALOGE("open fb0 fail \n ");
@@ -172,37 +424,134 @@ static int hwc_setcolorkey(sun4i_hwc_context_t  *ctx)
     ck.blue_match_rule                 = 2;
     args[0]                         = 0;
     args[1]                         = (unsigned long)&ck;
-    ioctl(ctx->dispfd,DISP_CMD_SET_COLORKEY,(void*)args);//pipe1, different with video layer's pipe
+    hwc_ioctl(ctx->dispfd,DISP_CMD_SET_COLORKEY,(void*)args);//pipe1, different with video layer's pipe
 
     args[0]                         = ctx->hwc_screen;
     args[1]                         = fb_layer_hdl;
     args[2]                         = 0;
-    ioctl(ctx->dispfd,DISP_CMD_LAYER_SET_PIPE,(void*)args);//pipe1, different with video layer's pipe
+    hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_SET_PIPE,(void*)args);//pipe1, different with video layer's pipe
 
     args[0]                         = ctx->hwc_screen;
     args[1]                         = fb_layer_hdl;
-    ioctl(ctx->dispfd,DISP_CMD_LAYER_TOP,(void*)args);
+    hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_TOP,(void*)args);
 
     args[0]                         = ctx->hwc_screen;
     args[1]                         = fb_layer_hdl;
     args[2]                         = 0xFF;
-    ioctl(ctx->dispfd,DISP_CMD_LAYER_SET_ALPHA_VALUE,(void*)args);//disable the global alpha, use the pixel's alpha
+    hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_SET_ALPHA_VALUE,(void*)args);//disable the global alpha, use the pixel's alpha
 
     args[0]                         = ctx->hwc_screen;
     args[1]                         = fb_layer_hdl;
-    ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
+    hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
 
     args[0]                            = ctx->hwc_screen;
     args[1]                         = fb_layer_hdl;
-    ioctl(ctx->dispfd,DISP_CMD_LAYER_CK_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
+    hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_CK_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
 
     ALOGI("layer open hdl:%d,ret :%d\n",(unsigned long)ctx->hwc_layer.currenthandle,ret);
 
     return 0;
 }
 
+/*
+ * video layers are parked closed in a per screen pool instead of released, so
+ * the next video session skips the request and keeps the last layer para,
+ * which hwc_setlayerpara then updates in place.
+ */
+static uint32_t hwc_pool_get(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_layer_pool_t            *pool = &ctx->pool[screen];
+    unsigned long               args[4] = {0};
+    uint32_t                    hdl;
+
+    pthread_mutex_lock(&ctx->video_lock);
+    if(pool->num > 0)
+    {
+        hdl = pool->hdl[--pool->num];
+        pool->hits++;
+    }
+    else
+    {
+        args[0] = screen;
+        hdl     = (uint32_t)hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_REQUEST, args);
+        pool->misses++;
+    }
+    pthread_mutex_unlock(&ctx->video_lock);
+
+    return hdl;
+}
+
+/* hdl must already be closed and its video stopped, 0 is ignored */
+static void hwc_pool_put(sun4i_hwc_context_t *ctx, uint32_t screen, uint32_t hdl)
+{
+    hwc_layer_pool_t            *pool = &ctx->pool[screen];
+    unsigned long               args[4] = {0};
+
+    if(hdl == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->video_lock);
+    if(pool->num < HWC_LAYER_POOL_NUM)
+    {
+        pool->hdl[pool->num++] = hdl;
+    }
+    else
+    {
+        args[0] = screen;
+        args[1] = hdl;
+        hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE, args);
+        if(ctx->enhance.hdl == hdl)
+        {
+            ctx->enhance.hdl = 0;
+        }
+    }
+    pthread_mutex_unlock(&ctx->video_lock);
+}
+
+static void hwc_pool_warm(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_layer_pool_t            *pool = &ctx->pool[screen];
+    unsigned long               args[4] = {0};
+    uint32_t                    hdl;
+
+    pthread_mutex_lock(&ctx->video_lock);
+    while(pool->num < HWC_LAYER_POOL_NUM)
+    {
+        args[0] = screen;
+        hdl     = (uint32_t)hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_REQUEST, args);
+        if(hdl == 0)
+        {
+            break;
+        }
+        pool->hdl[pool->num++] = hdl;
+    }
+    pthread_mutex_unlock(&ctx->video_lock);
+}
+
+static void hwc_pool_drain(sun4i_hwc_context_t *ctx, uint32_t screen)
+{
+    hwc_layer_pool_t            *pool = &ctx->pool[screen];
+    unsigned long               args[4] = {0};
+
+    pthread_mutex_lock(&ctx->video_lock);
+    while(pool->num > 0)
+    {
+        args[0] = screen;
+        args[1] = pool->hdl[--pool->num];
+        hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE, args);
+        if(ctx->enhance.hdl == args[1])
+        {
+            ctx->enhance.hdl = 0;
+        }
+    }
+    pthread_mutex_unlock(&ctx->video_lock);
+}
+
 static int hwc_requestlayer(sun4i_hwc_context_t *ctx,uint32_t screenid)
 {
+    unsigned long               args[4] = {0};
     uint32_t            layerhandle;
 
     if(ctx->dispfd == 0)
@@ -220,10 +569,7 @@ static int hwc_requestlayer(sun4i_hwc_context_t *ctx,uint32_t screenid)
 
     if(ctx->hwc_layer.currenthandle == 0)
     {
-        args[0]                         = screenid;
-        args[1]                         = 0;
-        args[2]                         = 0;
-        layerhandle                     = (uint32_t)ioctl(ctx->dispfd, DISP_CMD_LAYER_REQUEST,args);
+        layerhandle                     = hwc_pool_get(ctx, screenid);
         if(layerhandle == 0)
         {
             ALOGE("request layer failed!\n");
@@ -242,14 +588,13 @@ static int hwc_requestlayer(sun4i_hwc_context_t *ctx,uint32_t screenid)
         args[0]                         = ctx->hwc_screen;
         args[1]                         = ctx->hwc_layer.currenthandle;
         args[2]                         = 0;
-        ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
+        hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_CLOSE,args);
+        hwc_ioctl(ctx->dispfd, DISP_CMD_VIDEO_STOP,args);
+        hwc_pool_put(ctx, ctx->hwc_screen, ctx->hwc_layer.currenthandle);
 
         ctx->hwc_layer.currenthandle     = 0;
 
-        args[0]                         = screenid;
-        args[1]                         = 0;
-        args[2]                         = 0;
-        layerhandle                     = (uint32_t)ioctl(ctx->dispfd, DISP_CMD_LAYER_REQUEST,args);
+        layerhandle                     = hwc_pool_get(ctx, screenid);
         if(layerhandle == 0)
         {
             ALOGE("request layer failed!\n");
@@ -309,14 +654,8 @@ static void hwc_computerlayerdisplayframe(hwc_composer_device_1_t *dev)
      * in which case we will do our best to adjust the rectangle to be within
      * the display.
      */
-    args[0]                         = ctx->hwc_screen;
-    ret = ioctl(ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,args);
-
-    args[0]                         = ctx->hwc_screen;
-    args[1]                         = 0;
-    args[2]                         = 0;
-    g_lcd_width                     = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_WIDTH,args);
-    g_lcd_height                    = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_HEIGHT,args);
+    ret = hwc_output_type(ctx, ctx->hwc_screen);
+    hwc_output_size(ctx, ctx->hwc_screen, &g_lcd_width, &g_lcd_height);
 
     ALOGV("hdmi mode = %d\n",ret);
     ALOGV("ctx->cur_3denable = %d\n",ctx->cur_3dmode);
@@ -459,6 +798,31 @@ static void hwc_computerlayerdisplayframe(hwc_composer_device_1_t *dev)
      }
 }
 
+static bool hwc_fb_info(void)
+{
+    struct fb_fix_screeninfo    fix;
+    int                         fd;
+
+    if(g_fb_line_length)
+    {
+        return true;
+    }
+
+    fd = open(SUNXI_DEV_ROOT "/graphics/fb0", O_RDWR);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    if(ioctl(fd, FBIOGET_FSCREENINFO, &fix) == 0)
+    {
+        g_fb_line_length    = fix.line_length;
+    }
+    close(fd);
+
+    return g_fb_line_length != 0;
+}
+
 static bool hwc_can_render_layer(hwc_layer_1_t *layer)
 {
     if((layer->format == HWC_FORMAT_MBYUV420)
@@ -474,88 +838,329 @@ static bool hwc_can_render_layer(hwc_layer_1_t *layer)
     return  false;
 }
 
-static int hwc_setrect(sun4i_hwc_context_t *ctx,hwc_rect_t *croprect,hwc_rect_t *displayframe)
+static bool hwc_is_yuv_format(uint32_t format)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-    bool                        needset = false;
-
-    ALOGV("hwc_setcrop");
+    switch(format)
+    {
+        case HWC_FORMAT_MBYUV420:
+        case HWC_FORMAT_MBYUV422:
+        case HWC_FORMAT_YUV420PLANAR:
+        case HWC_FORMAT_YCbYCr_422_I:
+        case HWC_FORMAT_CbYCrY_422_I:
+        case HWC_FORMAT_DEFAULT:
+            return true;
+        default:
+            return false;
+    }
+}
 
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
+static uint32_t hwc_format_bpp(uint32_t format)
+{
+    switch(format)
+    {
+        case HWC_FORMAT_MBYUV420:
+        case HWC_FORMAT_YUV420PLANAR:
+        case HWC_FORMAT_DEFAULT:
+            return 12;
+        case HWC_FORMAT_MBYUV422:
+        case HWC_FORMAT_YCbYCr_422_I:
+        case HWC_FORMAT_CbYCrY_422_I:
+        case HWC_FORMAT_RGB_565:
+            return 16;
+        default:
+            return 32;
+    }
+}
 
-    if(ctx->hwc_layer.currenthandle)
-       {
-        unsigned long            tmp_args[4];
-        __disp_layer_info_t        tmpLayerAttr;
+/*
+ * gles fill saved by taking the layer off the framebuffer: the sourceCrop
+ * pixels the gpu would have fetched plus the 32bpp displayFrame pixels it
+ * would have written.
+ */
+static uint32_t hwc_layer_savescore(hwc_layer_1_t *layer)
+{
+    int                         w = layer->displayFrame.right - layer->displayFrame.left;
+    int                         h = layer->displayFrame.bottom - layer->displayFrame.top;
+    int                         src_w = layer->sourceCrop.right - layer->sourceCrop.left;
+    int                         src_h = layer->sourceCrop.bottom - layer->sourceCrop.top;
+    uint32_t                    fetch = 0;
 
-        tmp_args[0]             = screen;
-        tmp_args[1]             = (unsigned long)overlay;
-        tmp_args[2]             = (unsigned long) (&tmpLayerAttr);
-        tmp_args[3]             = 0;
+    if(w <= 0 || h <= 0)
+    {
+        return 0;
+    }
+    if(src_w > 0 && src_h > 0)
+    {
+        fetch = ((uint32_t)src_w * (uint32_t)src_h * hwc_format_bpp(layer->format)) >> 3;
+    }
 
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_PARA, &tmp_args);
+    return fetch + (((uint32_t)w * (uint32_t)h * 32) >> 3);
+}
 
-        if((tmpLayerAttr.fb.size.width != croprect->right - croprect->left)
-           ||(tmpLayerAttr.fb.size.height != croprect->bottom - croprect->top)
-           ||(tmpLayerAttr.src_win.x != croprect->left)
-           ||(tmpLayerAttr.src_win.y != croprect->top))
+static void hwc_plan_overlays(sun4i_hwc_context_t *ctx, uint32_t screen, hwc_display_contents_1_t *list)
+{
+    hwc_overlay_plan_t          *plan = &ctx->plan[screen];
+    hwc_plane_assign_t          cand[HWC_MAX_CANDIDATE];
+    hwc_plane_assign_t          tmp;
+    int                         ncand = 0;
+    int                         scaler_free = HWC_SCALER_NUM;
+    int                         layer_free = HWC_LAYER_NUM_PER_SCN - 1;
+    bool                        video_free = true;
+    int                         i, j;
+
+    memset(plan, 0, sizeof(hwc_overlay_plan_t));
+    plan->video_index = -1;
+
+    // screens are planned in order in the same prepare, lower ones got their scalers first
+    for(i = 0; i < (int)screen; i++)
+    {
+        scaler_free -= ctx->plan[i].scaler_num;
+        if(ctx->plan[i].video_index >= 0)
         {
-            //tmpLayerAttr.fb.size.width         = croprect->right - croprect->left;
-            //tmpLayerAttr.fb.size.height     = croprect->bottom - croprect->top;
+            video_free = false;
+        }
+    }
 
-            //tmpLayerAttr.src_win.x            = croprect->left;
-            //tmpLayerAttr.src_win.y            = croprect->top;
-            //tmpLayerAttr.src_win.width        = croprect->right - croprect->left;
-            //tmpLayerAttr.src_win.height        = croprect->bottom - croprect->top;
+    for(i = 0; i < (int)list->numHwLayers; i++)
+    {
+        hwc_layer_1_t           *layer = &list->hwLayers[i];
 
-            //needset = true;
+        if(layer->compositionType == HWC_FRAMEBUFFER_TARGET)
+        {
+            continue;
         }
-        if((ctx->hwc_layer.posX_org != displayframe->left)
-           ||(ctx->hwc_layer.posY_org != displayframe->top)
-           ||(ctx->hwc_layer.posW_org != displayframe->right - displayframe->left)
-           ||(ctx->hwc_layer.posH_org != displayframe->bottom - displayframe->top))
+
+        layer->compositionType = HWC_FRAMEBUFFER;
+        if((layer->flags & HWC_SKIP_LAYER) || !hwc_can_render_layer(layer))
         {
-            ctx->hwc_layer.posX_org = displayframe->left;
-            ctx->hwc_layer.posY_org = displayframe->top;
-            ctx->hwc_layer.posW_org = displayframe->right - displayframe->left;
-            ctx->hwc_layer.posH_org = displayframe->bottom - displayframe->top;
+            continue;
+        }
 
-            hwc_computerlayerdisplayframe((hwc_composer_device_1_t *)ctx);
+        if(ncand >= HWC_MAX_CANDIDATE)
+        {
+            break;
+        }
 
-            tmpLayerAttr.scn_win.x            = ctx->hwc_layer.posX;
-            tmpLayerAttr.scn_win.y            = ctx->hwc_layer.posY;
-            tmpLayerAttr.scn_win.width        = ctx->hwc_layer.posW;
-            tmpLayerAttr.scn_win.height        = ctx->hwc_layer.posH;
+        cand[ncand].index   = i;
+        cand[ncand].type    = HWC_PLANE_SCALER;
+        cand[ncand].score   = hwc_layer_savescore(layer);
+        ncand++;
+    }
 
-            needset = true;
+    /* biggest saving first, the candidate list is short */
+    for(i = 1; i < ncand; i++)
+    {
+        tmp = cand[i];
+        for(j = i - 1; j >= 0 && cand[j].score < tmp.score; j--)
+        {
+            cand[j + 1] = cand[j];
         }
+        cand[j + 1] = tmp;
+    }
 
-        if(needset)
+    for(i = 0; i < ncand && layer_free > 0; i++)
+    {
+        bool                    yuv = hwc_is_yuv_format(list->hwLayers[cand[i].index].format);
+
+        // hwc_set_layer programs the one video layer, any other yuv layer on
+        // any screen stays with gles instead of going unshown
+        if(yuv && !video_free)
         {
-            ret = ioctl(fd, DISP_CMD_LAYER_SET_PARA, &tmp_args);
+            continue;
+        }
+
+        // yuv layers are always scaler candidates, so the scalers bound them too
+        if(cand[i].type == HWC_PLANE_SCALER)
+        {
+            if(scaler_free <= 0)
+            {
+                continue;
+            }
+            scaler_free--;
+            plan->scaler_num++;
+        }
+        if(yuv)
+        {
+            plan->video_index = cand[i].index;
+            video_free        = false;
+        }
+
+        layer_free--;
+        plan->assign[plan->num] = cand[i];
+        plan->saved            += cand[i].score;
+        plan->num++;
+        list->hwLayers[cand[i].index].compositionType = HWC_OVERLAY;
+    }
+
+    ALOGV("screen %d: %d candidates, %d overlays, %d bytes saved",
+          screen, ncand, plan->num, plan->saved);
+}
+
+static void hwc_invalidate_geometry(sun4i_hwc_context_t *ctx)
+{
+    for(int i = 0; i < HWC_MAX_SCREEN; i++)
+    {
+        ctx->geometry[i].valid = false;
+    }
+}
+
+static bool hwc_rect_equal(const hwc_rect_t *a, const hwc_rect_t *b)
+{
+    return (a->left == b->left) && (a->top == b->top)
+           && (a->right == b->right) && (a->bottom == b->bottom);
+}
+
+/* true when the video layer already shows this geometry and has nothing pending */
+static bool hwc_geometry_unchanged(sun4i_hwc_context_t *ctx, uint32_t disp, hwc_layer_1_t *layer)
+{
+    hwc_geometry_cache_t        *cache = &ctx->geometry[disp];
+    int                         type;
+    int                         mode;
+    uint32_t                    width;
+    uint32_t                    height;
+
+    if(!cache->valid)
+    {
+        return false;
+    }
+
+    hwc_output_mode(ctx, ctx->hwc_screen, &type, &mode, &width, &height);
+    if(type != cache->out_type || mode != cache->out_mode
+       || width != cache->out_width || height != cache->out_height)
+    {
+        return false;
+    }
+
+    if(!ctx->hwc_layeropen && !ctx->hwc_reqclose && ctx->hwc_frameset)
+    {
+        /* hwc_setrect still has to open the layer */
+        return false;
+    }
+
+    return (cache->handle == ctx->hwc_layer.currenthandle)
+           && (cache->screen == ctx->hwc_screen)
+           && (cache->trd_enable == ctx->cur_3denable)
+           && (cache->half_enable == ctx->cur_half_enable)
+           && (cache->transform == layer->transform)
+           && hwc_rect_equal(&cache->crop, &layer->sourceCrop)
+           && hwc_rect_equal(&cache->frame, &layer->displayFrame);
+}
+
+static void hwc_update_geometry(sun4i_hwc_context_t *ctx, uint32_t disp, hwc_layer_1_t *layer)
+{
+    hwc_geometry_cache_t        *cache = &ctx->geometry[disp];
+
+    cache->valid        = (ctx->hwc_layer.currenthandle != 0);
+    cache->crop         = layer->sourceCrop;
+    cache->frame        = layer->displayFrame;
+    cache->transform    = layer->transform;
+    cache->handle       = ctx->hwc_layer.currenthandle;
+    cache->screen       = ctx->hwc_screen;
+    cache->trd_enable   = ctx->cur_3denable;
+    cache->half_enable  = ctx->cur_half_enable;
+    hwc_output_mode(ctx, ctx->hwc_screen, &cache->out_type, &cache->out_mode,
+                    &cache->out_width, &cache->out_height);
+}
+
+static int hwc_setrect(sun4i_hwc_context_t *ctx,hwc_rect_t *croprect,hwc_rect_t *displayframe)
+{
+    unsigned long               args[4] = {0};
+    uint32_t                    overlay;
+    int                         fd;
+    int                         ret = 0;
+    int                         screen;
+    bool                        needset = false;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint32_t                    org_width;
+    uint32_t                    org_height;
+
+    ALOGV("hwc_setcrop");
+
+    overlay                         = ctx->hwc_layer.currenthandle;
+    fd                              = ctx->dispfd;
+    screen                          = ctx->hwc_screen;
+
+    if(ctx->hwc_layer.currenthandle)
+       {
+        unsigned long            tmp_args[4];
+        __disp_layer_info_t        tmpLayerAttr;
+
+        tmp_args[0]             = screen;
+        tmp_args[1]             = (unsigned long)overlay;
+        tmp_args[2]             = (unsigned long) (&tmpLayerAttr);
+        tmp_args[3]             = 0;
+
+        ret = hwc_ioctl(fd, DISP_CMD_LAYER_GET_PARA, &tmp_args);
+
+        if((tmpLayerAttr.fb.size.width != croprect->right - croprect->left)
+           ||(tmpLayerAttr.fb.size.height != croprect->bottom - croprect->top)
+           ||(tmpLayerAttr.src_win.x != croprect->left)
+           ||(tmpLayerAttr.src_win.y != croprect->top))
+        {
+            //tmpLayerAttr.fb.size.width         = croprect->right - croprect->left;
+            //tmpLayerAttr.fb.size.height     = croprect->bottom - croprect->top;
+
+            //tmpLayerAttr.src_win.x            = croprect->left;
+            //tmpLayerAttr.src_win.y            = croprect->top;
+            //tmpLayerAttr.src_win.width        = croprect->right - croprect->left;
+            //tmpLayerAttr.src_win.height        = croprect->bottom - croprect->top;
+
+            //needset = true;
+        }
+        hwc_output_size(ctx, 0, &org_width, &org_height);
+        hwc_output_size(ctx, screen, &width, &height);
+        if((ctx->hwc_layer.posX_org != displayframe->left)
+           ||(ctx->hwc_layer.posY_org != displayframe->top)
+           ||(ctx->hwc_layer.posW_org != displayframe->right - displayframe->left)
+           ||(ctx->hwc_layer.posH_org != displayframe->bottom - displayframe->top)
+           ||(ctx->hwc_layer.dispW != width)
+           ||(ctx->hwc_layer.dispH != height)
+           ||(ctx->hwc_layer.org_dispW != org_width)
+           ||(ctx->hwc_layer.org_dispH != org_height))
+        {
+            // the window is scaled between the outputs, a new output size moves it too
+            ctx->hwc_layer.dispW    = width;
+            ctx->hwc_layer.dispH    = height;
+            ctx->hwc_layer.org_dispW = org_width;
+            ctx->hwc_layer.org_dispH = org_height;
+            ctx->hwc_layer.posX_org = displayframe->left;
+            ctx->hwc_layer.posY_org = displayframe->top;
+            ctx->hwc_layer.posW_org = displayframe->right - displayframe->left;
+            ctx->hwc_layer.posH_org = displayframe->bottom - displayframe->top;
+
+            hwc_computerlayerdisplayframe((hwc_composer_device_1_t *)ctx);
+
+            tmpLayerAttr.scn_win.x            = ctx->hwc_layer.posX;
+            tmpLayerAttr.scn_win.y            = ctx->hwc_layer.posY;
+            tmpLayerAttr.scn_win.width        = ctx->hwc_layer.posW;
+            tmpLayerAttr.scn_win.height        = ctx->hwc_layer.posH;
+
+            needset = true;
+        }
+
+        if(needset)
+        {
+            ret = hwc_ioctl(fd, DISP_CMD_LAYER_SET_PARA, &tmp_args);
         }
 
         if((ctx->hwc_layeropen == 0) && (ctx->hwc_reqclose == 0) && (ctx->hwc_frameset != 0))
         {
             hwc_setcolorkey(ctx);
+            hwc_enhance_apply(ctx, screen, (uint32_t)overlay);
 
             args[0]                 = screen;
             args[1]                 = (unsigned long)overlay;
             args[2]                 = 0;
             args[3]                 = 0;
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_OPEN, args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_OPEN, args);
 
             // ALOGV("------------------------------SET_PARA--0 addr0:%x addr1:%x ret:%d",layer_info.fb.addr[0],layer_info.fb.addr[1],ret);
             args[0]                 = screen;
             args[1]                 = (unsigned long)overlay;
             args[2]                 = 0;
             args[3]                 = 0;
-            ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
 
             ctx->hwc_layeropen = true;
         }
@@ -565,40 +1170,78 @@ static int hwc_setrect(sun4i_hwc_context_t *ctx,hwc_rect_t *croprect,hwc_rect_t
 }
 
 /*****************************************************************************/
+static bool hwc_layer_planned(hwc_overlay_plan_t *plan, int index)
+{
+    for(int i = 0; i < plan->num; i++)
+    {
+        if(plan->assign[i].index == index)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool hwc_dirty_planned(void *data, int index)
+{
+    return hwc_layer_planned((hwc_overlay_plan_t *)data, index);
+}
+
+static void hwc_track_damage(sun4i_hwc_context_t *ctx, uint32_t screen, hwc_display_contents_1_t *list)
+{
+    hwc_dirty_track(&ctx->dirty[screen], list, hwc_dirty_planned, &ctx->plan[screen]);
+}
+
 static int hwc_prepare(hwc_composer_device_1_t *dev, size_t numDisplays, hwc_display_contents_1_t** lists)
 {
-    hwc_display_contents_1_t* list = lists[0];
-    //ALOGV("hwc_prepare list->numHwLayers = %d\n",list->numHwLayers);
-    //list is null on HWComposer->disable() on surfaceflinger
-    if (list && (list->flags & HWC_GEOMETRY_CHANGED))
+    sun4i_hwc_context_t           *ctx = (sun4i_hwc_context_t *)dev;
+    bool                        replan = false;
+
+    if(g_trace.enable)
     {
-        //ALOGV("hwc_prepare HWC_GEOMETRY_CHANGED list->numHwLayers = %d\n",list->numHwLayers);
+        pthread_mutex_lock(&g_trace.lock);
+        g_trace.prepare_time = systemTime(CLOCK_MONOTONIC);
+        pthread_mutex_unlock(&g_trace.lock);
+    }
 
-        for (size_t i=0 ; i<list->numHwLayers ; i++)
+    // the screens share the scalers, so a geometry change on one replans all of them
+    for (size_t disp = 0; disp < numDisplays && disp < HWC_MAX_SCREEN; disp++)
+    {
+        if (lists[disp] && (lists[disp]->flags & HWC_GEOMETRY_CHANGED))
         {
-            if(hwc_can_render_layer(&list->hwLayers[i]))
-            {
-                //dump_layer(&list->hwLayers[i]);
-                list->hwLayers[i].compositionType = HWC_OVERLAY;
+            replan = true;
+        }
+    }
 
-                //ALOGV("hwc_prepare HWC_OVERLAY i = %d\n",i);
-            }
-            else
-            {
-                //dump_layer(&list->hwLayers[i]);
-                list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
+    for (size_t disp = 0; disp < numDisplays && disp < HWC_MAX_SCREEN; disp++)
+    {
+        hwc_display_contents_1_t* list = lists[disp];
+        //ALOGV("hwc_prepare list->numHwLayers = %d\n",list->numHwLayers);
+        //list is null on HWComposer->disable() on surfaceflinger
+        if (list && replan)
+        {
+            //ALOGV("hwc_prepare HWC_GEOMETRY_CHANGED list->numHwLayers = %d\n",list->numHwLayers);
+            hwc_plan_overlays(ctx, disp, list);
+        }
+        else if (!list)
+        {
+            memset(&ctx->plan[disp], 0, sizeof(hwc_overlay_plan_t));
+            ctx->plan[disp].video_index = -1;
+            hwc_dirty_reset(&ctx->dirty[disp]);
+        }
 
-                //ALOGV("hwc_prepare HWC_FRAMEBUFFER i = %d\n",i);
-            }
+        if (list)
+        {
+            hwc_track_damage(ctx, disp, list);
         }
     }
     return 0;
 }
 
-static int hwc_startset(hwc_composer_device_1_t *dev)
+static int hwc_startset(sun4i_hwc_context_t *ctx,uint32_t screen)
 {
-    sun4i_hwc_context_t           *ctx = (sun4i_hwc_context_t *)dev;
-
+    unsigned long               args[4] = {0};
     if(ctx->dispfd == 0)
     {
         ctx->dispfd = hwc_open_disp();
@@ -606,15 +1249,14 @@ static int hwc_startset(hwc_composer_device_1_t *dev)
             return  -1;
     }
 
-    args[0]                = ctx->hwc_screen;
+    args[0]                = screen;
     args[1]             = 0;
-    return ioctl(ctx->dispfd,DISP_CMD_START_CMD_CACHE,(void*)args);//disable the global alpha, use the pixel's alpha
+    return hwc_ioctl(ctx->dispfd,DISP_CMD_START_CMD_CACHE,(void*)args);//hold register updates until the cache is executed
 }
 
-static int hwc_endset(hwc_composer_device_1_t *dev)
+static int hwc_endset(sun4i_hwc_context_t *ctx,uint32_t screen)
 {
-    sun4i_hwc_context_t           *ctx = (sun4i_hwc_context_t *)dev;
-
+    unsigned long               args[4] = {0};
     if(ctx->dispfd == 0)
     {
         ctx->dispfd = hwc_open_disp();
@@ -622,14 +1264,67 @@ static int hwc_endset(hwc_composer_device_1_t *dev)
             return  -1;
     }
 
-    args[0]                = ctx->hwc_screen;
+    args[0]                = screen;
     args[1]             = 0;
-    return ioctl(ctx->dispfd,DISP_CMD_EXECUTE_CMD_AND_STOP_CACHE,(void*)args);//disable the global alpha, use the pixel's alpha
+    return hwc_ioctl(ctx->dispfd,DISP_CMD_EXECUTE_CMD_AND_STOP_CACHE,(void*)args);//apply the held updates on the next vblank
+}
+
+/*
+ * layer changes between hwc_commit_begin and hwc_commit_end are held in the
+ * driver's command cache and latched together, so a frame never shows half of
+ * them. commits nest, only the outermost one touches the cache. the screen
+ * stays locked for the whole commit, take video_lock first when both are held.
+ */
+static void hwc_commit_begin(sun4i_hwc_context_t *ctx,uint32_t screen)
+{
+    hwc_commit_t                *commit = &ctx->commit[screen];
+
+    pthread_mutex_lock(&commit->lock);
+    if(commit->depth++ == 0)
+    {
+        commit->cached = (hwc_startset(ctx, screen) == 0);
+    }
+}
+
+static int hwc_commit_end(sun4i_hwc_context_t *ctx,uint32_t screen)
+{
+    hwc_commit_t                *commit = &ctx->commit[screen];
+    nsecs_t                     vblank;
+    int                         ret = 0;
+
+    if(commit->depth == 0)
+    {
+        return 0;
+    }
+    if(--commit->depth > 0)
+    {
+        pthread_mutex_unlock(&commit->lock);
+        return 0;
+    }
+
+    if(commit->cached)
+    {
+        ret = hwc_endset(ctx, screen);
+        commit->cached = false;
+    }
+
+    vblank = ctx->display[screen].vsync.last;
+    if(commit->count != 0 && vblank == commit->vblank)
+    {
+        commit->same_vblank++;
+        ALOGV("screen %d: %d commits in one vblank", screen, commit->same_vblank);
+    }
+    commit->vblank = vblank;
+    commit->count++;
+    pthread_mutex_unlock(&commit->lock);
+
+    return ret;
 }
 
 
 static int hwc_setlayerframepara(sun4i_hwc_context_t *ctx,uint32_t value)
 {
+    unsigned long               args[4] = {0};
     __disp_video_fb_t              tmpFrmBufAddr;
     libhwclayerpara_t            *overlaypara;
     int                            handle;
@@ -687,6 +1382,8 @@ static int hwc_setlayerframepara(sun4i_hwc_context_t *ctx,uint32_t value)
 
     tmpFrmBufAddr.id                = overlaypara->number;
     ctx->hwc_layer.cur_frameid        = tmpFrmBufAddr.id;
+    ctx->hwc_layer.frame_time       = systemTime(CLOCK_MONOTONIC);
+    ctx->hwc_layer.frame_pending    = true;
     handle                            = (unsigned long)ctx->hwc_layer.currenthandle;
     ctx->hwc_frameset               = true;
     //ALOGV("overlaypara->bProgressiveSrc = %x",overlaypara->bProgressiveSrc);
@@ -701,7 +1398,7 @@ static int hwc_setlayerframepara(sun4i_hwc_context_t *ctx,uint32_t value)
         args[1]                 = handle;
         args[2]                 = (unsigned long) (&layer_info);
         args[3]                 = 0;
-        ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+        hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
 
         layer_info.fb.addr[0]     = tmpFrmBufAddr.addr[0];
         layer_info.fb.addr[1]     = tmpFrmBufAddr.addr[1];
@@ -714,15 +1411,16 @@ static int hwc_setlayerframepara(sun4i_hwc_context_t *ctx,uint32_t value)
         args[1]                 = handle;
         args[2]                 = (unsigned long) (&layer_info);
         args[3]                 = 0;
-        ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+        ret = hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
 
         if(ctx->wait_layer_open)
         {
+            hwc_enhance_apply(ctx, screen, handle);
             args[0]                     = screen;
             args[1]                     = handle;
             args[2]                     = 0;
             args[3]                     = 0;
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_OPEN,args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_OPEN,args);
         }
         ctx->wait_layer_open = 0;
     }
@@ -733,7 +1431,7 @@ static int hwc_setlayerframepara(sun4i_hwc_context_t *ctx,uint32_t value)
         args[1]                 = handle;
         args[2]                 = (unsigned long)(&tmpFrmBufAddr);
         args[3]                 = 0;
-        ioctl(ctx->dispfd, DISP_CMD_VIDEO_SET_FB,args);
+        hwc_ioctl(ctx->dispfd, DISP_CMD_VIDEO_SET_FB,args);
 
     }
 
@@ -742,6 +1440,7 @@ static int hwc_setlayerframepara(sun4i_hwc_context_t *ctx,uint32_t value)
 
 static int hwc_setlayerpara(sun4i_hwc_context_t *ctx,uint32_t value)
 {
+    unsigned long               args[4] = {0};
     void                        *overlayhandle = 0;
     __disp_layer_info_t         tmpLayerAttr;
     int                          fbfh0;
@@ -810,6 +1509,7 @@ static int hwc_setlayerpara(sun4i_hwc_context_t *ctx,uint32_t value)
         screenid                     = 1;
     }
 
+    hwc_invalidate_geometry(ctx);
     ret                             = hwc_requestlayer(ctx,screenid);
     if(ret != 0)
     {
@@ -818,18 +1518,14 @@ static int hwc_setlayerpara(sun4i_hwc_context_t *ctx,uint32_t value)
         return -1;
     }
 
-    args[0]                         = screenid;
-    args[1]                         = 0;
-    args[2]                         = 0;
-    g_lcd_width                     = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_WIDTH,args);
-    g_lcd_height                    = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_HEIGHT,args);
+    hwc_output_size(ctx, screenid, &g_lcd_width, &g_lcd_height);
 
     ALOGV("overlay.cpp:fb_mode:%d,disp_format:%d  %d:%d, %d",fb_mode,disp_format,g_lcd_width,g_lcd_height, __LINE__);
     args[0]                         = screenid;
     args[1]                         = ctx->hwc_layer.currenthandle;
     args[2]                         = (unsigned long) (&tmpLayerAttr);
     args[3]                         = 0;
-    ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+    ret = hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
 
     tmpLayerAttr.fb.mode             = fb_mode;    // DISP_MOD_NON_MB_UV_COMBINED;    // DISP_MOD_MB_UV_COMBINED;
     tmpLayerAttr.fb.format             = disp_format; //DISP_FORMAT_YUV420;//__disp_pixel_fmt_t(format);
@@ -868,6 +1564,10 @@ static int hwc_setlayerpara(sun4i_hwc_context_t *ctx,uint32_t value)
     tmpLayerAttr.src_win.y          = 0;//tmpVFrmInf->dst_rect.uStartY;
     tmpLayerAttr.src_win.width      = width;//tmpVFrmInf->dst_rect.uWidth;
     tmpLayerAttr.src_win.height     = height;//tmpVFrmInf->dst_rect.uHeight;
+    ctx->hwc_layer.cropX            = 0;
+    ctx->hwc_layer.cropY            = 0;
+    ctx->hwc_layer.cropW            = width;
+    ctx->hwc_layer.cropH            = height;
     tmpLayerAttr.fb.b_trd_src        = ctx->cur_half_enable;
     tmpLayerAttr.b_trd_out            = ctx->cur_3denable;
     tmpLayerAttr.fb.trd_mode         =  (__disp_3d_src_mode_t)ctx->cur_3dmode;
@@ -878,20 +1578,11 @@ static int hwc_setlayerpara(sun4i_hwc_context_t *ctx,uint32_t value)
     args[1]                         = ctx->hwc_layer.currenthandle;
     args[2]                         = (unsigned long) (&tmpLayerAttr);
     args[3]                         = 0;
-    ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+    ret = hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
     ALOGV("SET_PARA ret:%d",ret);
 
-    args[0]                         = 0;
-    args[1]                         = 0;
-    args[2]                         = 0;
-    ctx->hwc_layer.org_dispW        = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_WIDTH,args);
-    ctx->hwc_layer.org_dispH        = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_HEIGHT,args);
-
-    args[0]                         = screenid;
-    args[1]                         = 0;
-    args[2]                         = 0;
-    ctx->hwc_layer.dispW            = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_WIDTH,args);
-    ctx->hwc_layer.dispH            = ioctl(ctx->dispfd, DISP_CMD_SCN_GET_HEIGHT,args);
+    hwc_output_size(ctx, 0, &ctx->hwc_layer.org_dispW, &ctx->hwc_layer.org_dispH);
+    hwc_output_size(ctx, screenid, &ctx->hwc_layer.dispW, &ctx->hwc_layer.dispH);
     ctx->hwc_layeropen                 = false;
     ctx->hwc_reqclose                 = false;
     ctx->hwc_layer.posX_org            = 0;
@@ -905,6 +1596,7 @@ static int hwc_setlayerpara(sun4i_hwc_context_t *ctx,uint32_t value)
 // for taking photo to avoid preview wrong
 static int hwc_show(sun4i_hwc_context_t *ctx,int value)
 {
+    unsigned long               args[4] = {0};
     uint32_t                    overlay;
     int                         fd;
     int                         ret = 0;
@@ -931,13 +1623,16 @@ static int hwc_show(sun4i_hwc_context_t *ctx,int value)
             if(ctx->hwc_layeropen == false)
             {
                 ALOGV("----------hwc_layeropen false");
-                ret = ioctl(fd, DISP_CMD_LAYER_OPEN,args);
+                hwc_commit_begin(ctx, screen);
+                hwc_enhance_apply(ctx, screen, ctx->hwc_layer.currenthandle);
+                ret = hwc_ioctl(fd, DISP_CMD_LAYER_OPEN,args);
 
-                ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
+                hwc_ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
 
                 args[0]                         = ctx->hwc_screen;
                 args[1]                         = fb_layer_hdl;
-                ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
+                hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
+                hwc_commit_end(ctx, screen);
                     ctx->hwc_layeropen = true;
             }
         }
@@ -946,13 +1641,15 @@ static int hwc_show(sun4i_hwc_context_t *ctx,int value)
             if(ctx->hwc_layeropen == true)
             {
                 ALOGV("----------hwc_layeropen true");
-                ret = ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
+                hwc_commit_begin(ctx, screen);
+                ret = hwc_ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
 
-                ioctl(fd, DISP_CMD_VIDEO_STOP, args);
+                hwc_ioctl(fd, DISP_CMD_VIDEO_STOP, args);
 
                 args[0]                         = ctx->hwc_screen;
                 args[1]                         = fb_layer_hdl;
-                ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
+                hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
+                hwc_commit_end(ctx, screen);
 
                 ctx->hwc_layeropen = false;
             }
@@ -965,6 +1662,7 @@ static int hwc_show(sun4i_hwc_context_t *ctx,int value)
 // for taking photo to avoid preview wrong
 static int hwc_reqshow(sun4i_hwc_context_t *ctx,int value)
 {
+    unsigned long               args[4] = {0};
     uint32_t                    overlay;
     int                         fd;
     int                         ret = 0;
@@ -972,6 +1670,7 @@ static int hwc_reqshow(sun4i_hwc_context_t *ctx,int value)
 
     ALOGV("hwc_show, value: %d", value);
 
+    hwc_invalidate_geometry(ctx);
     overlay                         = ctx->hwc_layer.currenthandle;
     fd                              = ctx->dispfd;
     screen                          = ctx->hwc_screen;
@@ -994,13 +1693,16 @@ static int hwc_reqshow(sun4i_hwc_context_t *ctx,int value)
                    ||(ctx->hwc_layer.posH_org != 0))
                 {
                     ALOGV("----------hwc_layeropen false");
-                    ret = ioctl(fd, DISP_CMD_LAYER_OPEN,args);
+                    hwc_commit_begin(ctx, screen);
+                    hwc_enhance_apply(ctx, screen, ctx->hwc_layer.currenthandle);
+                    ret = hwc_ioctl(fd, DISP_CMD_LAYER_OPEN,args);
 
-                    ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
+                    hwc_ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
 
                     args[0]                         = ctx->hwc_screen;
                     args[1]                         = fb_layer_hdl;
-                    ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
+                    hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_OFF,(void*)args);//disable the global alpha, use the pixel's alpha
+                    hwc_commit_end(ctx, screen);
                     ctx->hwc_layeropen = true;
                 }
                 ctx->hwc_reqclose = false;
@@ -1011,36 +1713,20 @@ static int hwc_reqshow(sun4i_hwc_context_t *ctx,int value)
             if(ctx->hwc_layeropen == true)
             {
                 ALOGV("----------hwc_layeropen true");
-                ret = ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
+                hwc_commit_begin(ctx, screen);
+                ret = hwc_ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
 
-                ioctl(fd, DISP_CMD_VIDEO_STOP, args);
+                hwc_ioctl(fd, DISP_CMD_VIDEO_STOP, args);
 
                 args[0]                         = ctx->hwc_screen;
                 args[1]                         = fb_layer_hdl;
-                ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
+                hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
+                hwc_commit_end(ctx, screen);
 
-                args[0]                         = ctx->hwc_screen;
-                   ret = ioctl(ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,args);
+                   ret = hwc_output_type(ctx, ctx->hwc_screen);
                    if(ret == DISP_OUTPUT_TYPE_HDMI && (ctx->cur_3denable == true))
                    {
-                       args[0]                     = ctx->hwc_screen;
-                       args[1]                     = 0;
-                       args[2]                     = 0;
-                       args[3]                     = 0;
-                       ioctl(ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
-
-                       ALOGV("ctx->cur_hdmimode %d",ctx->cur_hdmimode);
-                       args[0]                     = ctx->hwc_screen;
-                       args[1]                     = ctx->cur_hdmimode;
-                       args[2]                     = 0;
-                       args[3]                     = 0;
-                       ioctl(ctx->dispfd, DISP_CMD_HDMI_SET_MODE, args);
-
-                       args[0]                     = ctx->hwc_screen;
-                       args[1]                     = 0;
-                       args[2]                     = 0;
-                       args[3]                     = 0;
-                       ioctl(ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
+                       hwc_3d_set_hdmi(ctx, ctx->hwc_screen, ctx->cur_hdmimode);
                    }
 
                 ctx->hwc_layeropen = false;
@@ -1055,6 +1741,7 @@ static int hwc_reqshow(sun4i_hwc_context_t *ctx,int value)
 // for taking photo to avoid preview wrong
 static int hwc_release(sun4i_hwc_context_t *ctx)
 {
+    unsigned long               args[4] = {0};
     uint32_t                    overlay;
     int                         fd;
     int                         ret = 0;
@@ -1062,6 +1749,7 @@ static int hwc_release(sun4i_hwc_context_t *ctx)
 
     ALOGV("hwc_release!ctx->hwc_layer.currenthandle = %d\n",ctx->hwc_layer.currenthandle);
 
+    hwc_invalidate_geometry(ctx);
     overlay                         = ctx->hwc_layer.currenthandle;
     fd                              = ctx->dispfd;
     screen                          = ctx->hwc_screen;
@@ -1073,40 +1761,22 @@ static int hwc_release(sun4i_hwc_context_t *ctx)
         args[1]                         = ctx->hwc_layer.currenthandle;
         args[2]                         = 0;
         args[3]                         = 0;
-        ret = ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
+        ret = hwc_ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
 
-        ioctl(fd, DISP_CMD_VIDEO_STOP, args);
+        hwc_ioctl(fd, DISP_CMD_VIDEO_STOP, args);
 
-        ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
+        hwc_pool_put(ctx, screen, ctx->hwc_layer.currenthandle);
 
         ctx->hwc_layer.currenthandle    = 0;
 
         args[0]                         = ctx->hwc_screen;
         args[1]                         = fb_layer_hdl;
-        ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
+        hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
 
-        args[0]                         = ctx->hwc_screen;
-        ret = ioctl(ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,args);
+        ret = hwc_output_type(ctx, ctx->hwc_screen);
         if(ret == DISP_OUTPUT_TYPE_HDMI && (ctx->cur_3denable == true))
         {
-            args[0]                     = ctx->hwc_screen;
-            args[1]                     = 0;
-            args[2]                     = 0;
-            args[3]                     = 0;
-            ioctl(ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
-
-            ALOGV("ctx->cur_hdmimode %d",ctx->cur_hdmimode);
-            args[0]                     = ctx->hwc_screen;
-            args[1]                     = ctx->cur_hdmimode;
-            args[2]                     = 0;
-            args[3]                     = 0;
-            ioctl(ctx->dispfd, DISP_CMD_HDMI_SET_MODE, args);
-
-            args[0]                     = ctx->hwc_screen;
-            args[1]                     = 0;
-            args[2]                     = 0;
-            args[3]                     = 0;
-            ioctl(ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
+            hwc_3d_set_hdmi(ctx, ctx->hwc_screen, ctx->cur_hdmimode);
         }
         ctx->hwc_layeropen = false;
     }
@@ -1139,12 +1809,12 @@ static int hwc_setformat(sun4i_hwc_context_t *ctx,uint32_t value)
         tmp_args[2]             = (unsigned long) (&tmpLayerAttr);
         tmp_args[3]             = 0;
 
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_PARA, &tmp_args);
+        ret = hwc_ioctl(fd, DISP_CMD_LAYER_GET_PARA, &tmp_args);
         ALOGV("DISP_CMD_LAYER_GET_PARA, ret %d", ret);
 
         tmpLayerAttr.fb.seq = (__disp_pixel_seq_t)value;
 
-        ret = ioctl(fd, DISP_CMD_LAYER_SET_PARA, &tmp_args);
+        ret = hwc_ioctl(fd, DISP_CMD_LAYER_SET_PARA, &tmp_args);
         ALOGV("DISP_CMD_LAYER_GET_PARA, ret %d", ret);
     }
 
@@ -1153,15 +1823,23 @@ static int hwc_setformat(sun4i_hwc_context_t *ctx,uint32_t value)
 
 static int hwc_setscreen(sun4i_hwc_context_t *ctx,uint32_t value)
 {
+    unsigned long               args[4] = {0};
     int                         fd;
     __disp_layer_info_t         layer_info;
     int                         ret;
     int                         output_mode;
     int                            old_screen;
     uint32_t                    overlay_handle;
-    void*                        overlayhandle;
+    void*                        overlayhandle = 0;
     int                            ctl_fd;
-
+    bool                        trd_enable;
+    int                         hdmi_mode = -1;
+
+    // the release wait and the hdmi switch run without video_lock, so
+    // hwc_set and the vsync thread keep going. mode_lock keeps other
+    // screen and 3d switches out meanwhile.
+    pthread_mutex_lock(&ctx->mode_lock);
+    pthread_mutex_lock(&ctx->video_lock);
     overlay_handle                = ctx->hwc_layer.currenthandle;
     ALOGV("overlay_handle = %d\n",(unsigned long)overlay_handle);
     old_screen                   = ctx->hwc_screen;
@@ -1171,6 +1849,8 @@ static int hwc_setscreen(sun4i_hwc_context_t *ctx,uint32_t value)
     if(old_screen  == value)
     {
         ALOGV("nothing to do!");
+        pthread_mutex_unlock(&ctx->video_lock);
+        pthread_mutex_unlock(&ctx->mode_lock);
 
         return  0;
     }
@@ -1180,70 +1860,62 @@ static int hwc_setscreen(sun4i_hwc_context_t *ctx,uint32_t value)
         value = 1;
     }
 
+    hwc_invalidate_geometry(ctx);
     ALOGV("overlay release first");
     args[0]                     = old_screen;
     args[1]                     = (unsigned long) overlay_handle;
     args[2]                         = (unsigned long) (&layer_info);
     args[3]                     = 0;
-    ioctl(ctl_fd, DISP_CMD_LAYER_GET_PARA, args);
+    hwc_ioctl(ctl_fd, DISP_CMD_LAYER_GET_PARA, args);
 
-    args[0]                     = old_screen;
-    args[1]                     = (unsigned long) overlay_handle;
-    args[2]                     = 0;
-    args[3]                     = 0;
-    ioctl(ctl_fd, DISP_CMD_VIDEO_STOP, args);
-    ioctl(ctl_fd, DISP_CMD_LAYER_RELEASE,args);
+    // no video layer is open, there is nothing to park
+    if(overlay_handle != 0)
+    {
+        args[0]                 = old_screen;
+        args[1]                 = (unsigned long) overlay_handle;
+        args[2]                 = 0;
+        args[3]                 = 0;
+        hwc_ioctl(ctl_fd, DISP_CMD_LAYER_CLOSE, args);
+        hwc_ioctl(ctl_fd, DISP_CMD_VIDEO_STOP, args);
+        hwc_pool_put(ctx, old_screen, (uint32_t)overlay_handle);
+    }
+
+    // no layer until the new screen has one, frames handed over meanwhile are dropped
+    ctx->hwc_layer.currenthandle    = 0;
+    trd_enable                      = ctx->cur_3denable;
+    pthread_mutex_unlock(&ctx->video_lock);
 
     ALOGV("release overlay = %d,value = %d\n",(unsigned long) overlay_handle,value);
 
     sleep(2);
 
-    args[0]                     = value;
-    args[1]                     = 0;
-    args[2]                     = 0;
-    overlayhandle                 = (void *)ioctl(ctl_fd, DISP_CMD_LAYER_REQUEST,args);
-    if(overlayhandle == 0)
-    {
-        ALOGE("request layer failed!\n");
-
-        goto error;
-    }
-
-    args[0]                         = value;
-    ret                             = ioctl(ctl_fd,DISP_CMD_GET_OUTPUT_TYPE,args);
-    output_mode = ret;
-    if(ret == DISP_OUTPUT_TYPE_HDMI && (ctx->cur_3denable == true))
+    output_mode                     = hwc_output_type(ctx, value);
+    if(output_mode == DISP_OUTPUT_TYPE_HDMI && trd_enable)
     {
         args[0]                     = value;
         args[1]                     = 0;
         args[2]                     = 0;
         args[3]                     = 0;
-        ctx->cur_hdmimode            = ioctl(ctl_fd, DISP_CMD_HDMI_GET_MODE, args);
-        ALOGV("overlay_setScreenid ctx->cur_hdmimode = %d\n",ctx->cur_hdmimode);
-        args[0]                     = value;
-        args[1]                     = 0;
-        args[2]                     = 0;
-        args[3]                     = 0;
-        ioctl(ctl_fd,DISP_CMD_HDMI_OFF,(unsigned long)args);
+        hdmi_mode                   = hwc_ioctl(ctl_fd, DISP_CMD_HDMI_GET_MODE, args);
+        ALOGV("overlay_setScreenid ctx->cur_hdmimode = %d\n",hdmi_mode);
+        hwc_3d_set_hdmi(ctx, value, DISP_TV_MOD_1080P_24HZ_3D_FP);
+    }
 
-        args[0]                     = value;
-        args[1]                     = DISP_TV_MOD_1080P_24HZ_3D_FP;
-        args[2]                     = 0;
-        args[3]                     = 0;
-        ioctl(ctl_fd, DISP_CMD_HDMI_SET_MODE, args);
+    pthread_mutex_lock(&ctx->video_lock);
+    if(hdmi_mode >= 0)
+    {
+        ctx->cur_hdmimode           = hdmi_mode;
+    }
 
-        args[0]                     = value;
-        args[1]                     = 0;
-        args[2]                     = 0;
-        args[3]                     = 0;
-        ioctl(ctl_fd,DISP_CMD_HDMI_ON,(unsigned long)args);
+    overlayhandle                 = (void *)hwc_pool_get(ctx, value);
+    if(overlayhandle == 0)
+    {
+        ALOGE("request layer failed!\n");
+
+        goto error;
     }
 
-    args[0]                         = value;
-    args[1]                         = 0;
-    args[2]                         = 0;
-    g_lcd_width                     = ioctl(ctl_fd, DISP_CMD_SCN_GET_WIDTH,args);
-    g_lcd_height                    = ioctl(ctl_fd, DISP_CMD_SCN_GET_HEIGHT,args);
+    hwc_output_size(ctx, value, &g_lcd_width, &g_lcd_height);
 
     ctx->hwc_layer.currenthandle    = (unsigned long)overlayhandle;
     ctx->hwc_screen                    = value;
@@ -1279,555 +1951,571 @@ static int hwc_setscreen(sun4i_hwc_context_t *ctx,uint32_t value)
     args[1]                         = (unsigned long)overlayhandle;
     args[2]                         = (unsigned long) (&layer_info);
     args[3]                         = 0;
-    ret = ioctl(ctl_fd, DISP_CMD_LAYER_SET_PARA, args);
+    ret = hwc_ioctl(ctl_fd, DISP_CMD_LAYER_SET_PARA, args);
     ALOGV("SET_PARA ret:%d",ret);
 
     args[0]                            = value;
     args[1]                         = (unsigned long)overlayhandle;
     args[2]                         = 0;
     args[3]                         = 0;
-    ioctl(ctl_fd, DISP_CMD_LAYER_BOTTOM,args);
+    hwc_ioctl(ctl_fd, DISP_CMD_LAYER_BOTTOM,args);
 
     hwc_setcolorkey(ctx);
+    hwc_enhance_apply(ctx, value, (uint32_t)overlayhandle);
 
     args[0]                         = value;
     args[1]                         = (unsigned long) overlayhandle;
     args[2]                         = 0;
     args[3]                         = 0;
-    ioctl(ctl_fd, DISP_CMD_LAYER_OPEN, args);
+    hwc_ioctl(ctl_fd, DISP_CMD_LAYER_OPEN, args);
 
     args[0]                         = value;
     args[1]                         = (unsigned long) overlayhandle;
     args[2]                         = 0;
     args[3]                         = 0;
-    ioctl(ctl_fd, DISP_CMD_VIDEO_START, args);
+    hwc_ioctl(ctl_fd, DISP_CMD_VIDEO_START, args);
+    pthread_mutex_unlock(&ctx->video_lock);
+    pthread_mutex_unlock(&ctx->mode_lock);
 
     return 0;
 
 error:
     if(overlayhandle)
     {
-        args[0] = value;
-        args[1] = (unsigned long)overlayhandle;
-        args[2] = 0;
-        args[3] = 0;
-        ioctl(ctl_fd, DISP_CMD_LAYER_RELEASE,args);
+        hwc_pool_put(ctx, value, (uint32_t)overlayhandle);
     }
+    pthread_mutex_unlock(&ctx->video_lock);
+    pthread_mutex_unlock(&ctx->mode_lock);
 
     return -1;
 }
 
-// for taking photo to avoid preview wrong
-static int hwc_vppon(sun4i_hwc_context_t *ctx,int value)
+/*
+ * the overlay enhancement settings live in ctx->enhance, so they survive the
+ * video layer being released and requested again and are read back without
+ * asking the driver. a new video layer gets all of them in one commit.
+ */
+static int hwc_enhance_set(sun4i_hwc_context_t *ctx, int cmd, int value)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
+    unsigned long               args[4] = {0};
 
-    ALOGV("hwc_vppon");
+    if(ctx->hwc_layer.currenthandle == 0)
+    {
+        // applied when the next layer opens
+        ctx->enhance.hdl            = 0;
+        return 0;
+    }
 
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-//    ALOGV("handle = %x,tmpFrmBufAddr.addr[0] = %x,tmpFrmBufAddr.addr[1] = %x,screen = %d\n",handle,tmpFrmBufAddr.addr[0],tmpFrmBufAddr.addr[1],screen);
+    args[0]                         = ctx->hwc_screen;
+    args[1]                         = ctx->hwc_layer.currenthandle;
+    args[2]                         = value;
+    return hwc_ioctl(ctx->dispfd, cmd, args);
+}
 
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = 0;
-        args[3]                         = 0;
-        if(value != 0)
-        {
-            ret = ioctl(fd, DISP_CMD_LAYER_VPP_ON,args);
-        }
-        else
-        {
-            ret = ioctl(fd, DISP_CMD_LAYER_VPP_OFF,args);
-        }
+/* push the whole profile to a video layer about to open, once per layer */
+static void hwc_enhance_apply(sun4i_hwc_context_t *ctx, uint32_t screen, uint32_t hdl)
+{
+    hwc_enhance_t               *enhance = &ctx->enhance;
+    unsigned long               args[4] = {0};
 
+    if(hdl == 0 || enhance->hdl == hdl)
+    {
+        return;
     }
 
-    return ret;
+    hwc_commit_begin(ctx, screen);
+    args[0]                         = screen;
+    args[1]                         = hdl;
+    hwc_ioctl(ctx->dispfd, enhance->vpp ? DISP_CMD_LAYER_VPP_ON : DISP_CMD_LAYER_VPP_OFF, args);
+    args[2]                         = enhance->luma_sharp;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_LUMA_SHARP_LEVEL, args);
+    args[2]                         = enhance->chroma_sharp;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_CHROMA_SHARP_LEVEL, args);
+    args[2]                         = enhance->white_exten;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_WHITE_EXTEN_LEVEL, args);
+    args[2]                         = enhance->black_exten;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_BLACK_EXTEN_LEVEL, args);
+    hwc_commit_end(ctx, screen);
+
+    enhance->hdl                    = hdl;
 }
 
-// for taking photo to avoid preview wrong
-static int hwc_getvppon(sun4i_hwc_context_t *ctx)
+static int hwc_vppon(sun4i_hwc_context_t *ctx,int value)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
     ALOGV("hwc_vppon");
 
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = 0;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_VPP_EN,args);
-    }
+    ctx->enhance.vpp                = (value != 0);
+    return hwc_enhance_set(ctx, value ? DISP_CMD_LAYER_VPP_ON : DISP_CMD_LAYER_VPP_OFF, 0);
+}
 
-    return ret;
+static int hwc_getvppon(sun4i_hwc_context_t *ctx)
+{
+    return ctx->enhance.vpp;
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_setlumasharp(sun4i_hwc_context_t *ctx,int value)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
-    ALOGV("hwc_vppon");
-
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = value;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_SET_LUMA_SHARP_LEVEL,args);
-    }
-
-    return ret;
+    ctx->enhance.luma_sharp         = value;
+    return hwc_enhance_set(ctx, DISP_CMD_LAYER_SET_LUMA_SHARP_LEVEL, value);
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_getlumasharp(sun4i_hwc_context_t *ctx)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
-    ALOGV("hwc_vppon");
-
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = 0;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_LUMA_SHARP_LEVEL,args);
-    }
-
-    return ret;
+    return ctx->enhance.luma_sharp;
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_setchromasharp(sun4i_hwc_context_t *ctx,int value)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
-    ALOGV("hwc_vppon");
-
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = value;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_SET_CHROMA_SHARP_LEVEL,args);
-    }
-
-    return ret;
+    ctx->enhance.chroma_sharp       = value;
+    return hwc_enhance_set(ctx, DISP_CMD_LAYER_SET_CHROMA_SHARP_LEVEL, value);
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_getchromasharp(sun4i_hwc_context_t *ctx)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
-    ALOGV("hwc_vppon");
-
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = 0;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_CHROMA_SHARP_LEVEL,args);
-    }
-
-    return ret;
+    return ctx->enhance.chroma_sharp;
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_setwhiteexten(sun4i_hwc_context_t *ctx,int value)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
-    ALOGV("hwc_vppon");
-
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = value;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_SET_WHITE_EXTEN_LEVEL,args);
-    }
-
-    return ret;
+    ctx->enhance.white_exten        = value;
+    return hwc_enhance_set(ctx, DISP_CMD_LAYER_SET_WHITE_EXTEN_LEVEL, value);
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_getwhiteexten(sun4i_hwc_context_t *ctx)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
-
-    ALOGV("hwc_vppon");
-
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
-
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = 0;
-        args[3]                         = 0;
-
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_WHITE_EXTEN_LEVEL,args);
-    }
-
-    return ret;
+    return ctx->enhance.white_exten;
 }
 
-// for taking photo to avoid preview wrong
 static int hwc_setblackexten(sun4i_hwc_context_t *ctx,int value)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
+    ctx->enhance.black_exten        = value;
+    return hwc_enhance_set(ctx, DISP_CMD_LAYER_SET_BLACK_EXTEN_LEVEL, value);
+}
 
-    ALOGV("hwc_vppon");
+static int hwc_getblackexten(sun4i_hwc_context_t *ctx)
+{
+    return ctx->enhance.black_exten;
+}
 
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
+/*
+ * work out what a 3d request ends up as before touching the hardware, so
+ * the hdmi timing is only switched when it really changes.
+ */
+static bool hwc_3d_plan(sun4i_hwc_context_t *ctx, uint32_t screen, int value, int mode, hwc_3d_target_t *target)
+{
+    target->hdmi_mode   = -1;
+    target->trd_mode    = value;
+    target->trd_src     = ctx->cur_half_enable;
+    target->trd_out     = ctx->cur_3denable;
+    target->half_enable = ctx->cur_half_enable;
+    target->trd_enable  = ctx->cur_3denable;
+
+    if(hwc_output_type(ctx, screen) != DISP_OUTPUT_TYPE_HDMI)
+    {
+        target->trd_src     = (mode == HWC_DISP_MODE_2D);
+        target->trd_out     = false;
+        target->half_enable = target->trd_src;
+        target->trd_enable  = false;
+        if(mode == HWC_DISP_MODE_3D)
+        {
+            target->trd_enable  = true;
+            target->half_enable = true;
+        }
+        return true;
+    }
 
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = value;
-        args[3]                         = 0;
+    if(mode == HWC_DISP_MODE_3D && value != HWC_3D_OUT_MODE_NORMAL)
+    {
+        if(ctx->cur_3denable && value == (int)ctx->cur_3dmode)
+        {
+            return false;
+        }
+        target->hdmi_mode   = DISP_TV_MOD_1080P_24HZ_3D_FP;
+        target->trd_src     = true;
+        target->trd_out     = true;
+        target->half_enable = true;
+        target->trd_enable  = true;
+        return true;
+    }
 
-        ret = ioctl(fd, DISP_CMD_LAYER_SET_BLACK_EXTEN_LEVEL,args);
+    if(value == HWC_3D_OUT_MODE_NORMAL)
+    {
+        return false;
     }
 
-    return ret;
+    if(ctx->cur_3denable)
+    {
+        // leaving frame packing, back to the mode saved on the way in
+        target->hdmi_mode   = ctx->cur_hdmimode;
+    }
+    target->trd_src     = (mode == HWC_DISP_MODE_2D);
+    target->trd_out     = false;
+    target->half_enable = target->trd_src;
+    target->trd_enable  = false;
+    return true;
 }
 
-// for taking photo to avoid preview wrong
-static int hwc_getblackexten(sun4i_hwc_context_t *ctx)
+/*
+ * switch the hdmi timing of a screen. the off/on power cycle blanks the tv
+ * for seconds, so it is skipped when the mode is already the wanted one.
+ * screen and 3d switches call it without video_lock, hdmi_lock keeps it
+ * from running twice at once.
+ */
+static bool hwc_3d_set_hdmi(sun4i_hwc_context_t *ctx, uint32_t screen, uint32_t mode)
 {
-    uint32_t                    overlay;
-    int                         fd;
-    int                         ret = 0;
-    int                         screen;
+    unsigned long               args[4] = {0};
 
-    ALOGV("hwc_vppon");
+    pthread_mutex_lock(&ctx->hdmi_lock);
+    args[0]                     = screen;
+    if((uint32_t)hwc_ioctl(ctx->dispfd, DISP_CMD_HDMI_GET_MODE, args) == mode)
+    {
+        ctx->trd.hdmi_skipped++;
+        pthread_mutex_unlock(&ctx->hdmi_lock);
+        return false;
+    }
 
-    overlay                         = ctx->hwc_layer.currenthandle;
-    fd                              = ctx->dispfd;
-    screen                          = ctx->hwc_screen;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_HDMI_OFF, args);
 
-    if(ctx->hwc_layer.currenthandle)
-       {
-        args[0]                            = screen;
-        args[1]                         = (unsigned long)overlay;
-        args[2]                         = 0;
-        args[3]                         = 0;
+    args[1]                     = mode;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_HDMI_SET_MODE, args);
 
-        ret = ioctl(fd, DISP_CMD_LAYER_GET_BLACK_EXTEN_LEVEL,args);
-    }
+    args[1]                     = 0;
+    hwc_ioctl(ctx->dispfd, DISP_CMD_HDMI_ON, args);
+    ctx->trd.hdmi_cycles++;
+    pthread_mutex_unlock(&ctx->hdmi_lock);
 
-    return ret;
+    // the geometry cache is keyed on the output mode, a video layer
+    // configured meanwhile is redone on its next frame
+    hwc_output_invalidate(ctx, screen);
+
+    return true;
 }
 
 static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
 {
-    int                         ctl_fd;
-    void                        *overlay;
+    unsigned long               args[4] = {0};
     int                         fd;
-    int                            handle;
-    int                         ret;
+    uint32_t                    handle;
     int                         screen;
     int                         value;
     int                         mode;
-    int                            is_mode_changed;
-    int i;
+    int                         is_mode_changed;
+    bool                        hdmi_switch = false;
+    int                         hdmi_mode = -1;
     __disp_layer_info_t         layer_info;
-    layerinitpara_t                layer_para;
-    video3Dinfo_t                 *_3d_info;
+    layerinitpara_t             layer_para;
+    video3Dinfo_t               *_3d_info;
+    hwc_3d_target_t             target;
+    bool                        apply;
 
     ALOGV("overlay_show");
 
+    // the hdmi switch runs without video_lock, see hwc_setscreen
+    pthread_mutex_lock(&ctx->mode_lock);
+    pthread_mutex_lock(&ctx->video_lock);
+    hwc_invalidate_geometry(ctx);
     memset(&layer_info, 0, sizeof(__disp_layer_info_t));
 
-    overlay                         = (void *)ctx->hwc_layer.currenthandle;
     fd                              = ctx->dispfd;
     screen                          = ctx->hwc_screen;
-    _3d_info                         = (video3Dinfo_t *)para;
-    value                             = _3d_info->_3d_mode;
-    mode                              = _3d_info->display_mode;
+    _3d_info                        = (video3Dinfo_t *)para;
+    value                           = _3d_info->_3d_mode;
+    mode                            = _3d_info->display_mode;
     is_mode_changed                 = _3d_info->is_mode_changed;
+    ALOGV("width %d, height %d, format %x, value %d, mode %d, is mode changed %d", _3d_info->width, _3d_info->height, _3d_info->format, _3d_info->_3d_mode, _3d_info->display_mode, _3d_info->is_mode_changed);
 
-    if(is_mode_changed)
+    apply = hwc_3d_plan(ctx, screen, value, mode, &target);
+    if(apply && target.hdmi_mode >= 0)
     {
         args[0]                     = screen;
-        args[1]                     = (unsigned long) overlay;
-        args[2]                     = 0;
-        args[3]                     = 0;
-        ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
-        ioctl(fd, DISP_CMD_VIDEO_STOP, args);
+        hdmi_mode                   = hwc_ioctl(fd, DISP_CMD_HDMI_GET_MODE, args);
+        hdmi_switch                 = (uint32_t)hdmi_mode != (uint32_t)target.hdmi_mode;
     }
-    ALOGV("width %d, height %d, format %x, value %d, mode %d, is mode changed %d", _3d_info->width, _3d_info->height, _3d_info->format, _3d_info->_3d_mode, _3d_info->display_mode, _3d_info->is_mode_changed);
-
-    layer_para.w              = _3d_info->width;
-    layer_para.h              = _3d_info->height;
-    layer_para.format          = _3d_info->format;
-    layer_para.screenid      = screen;
-    hwc_setlayerpara(ctx, (uint32_t)&layer_para);
 
-    if(ctx->hwc_layer.currenthandle)
+    if(is_mode_changed && hdmi_switch && ctx->hwc_layer.currenthandle)
     {
+        // the screen goes dark for the mode switch anyway, reopen on the next frame
         args[0]                     = screen;
-        args[1]                     = (unsigned long) overlay;
-        args[2]                         = (unsigned long) (&layer_info);
-        args[3]                     = 0;
-        ioctl(fd, DISP_CMD_LAYER_GET_PARA, args);
-        args[0] = screen;
-        ret = ioctl(fd,DISP_CMD_GET_OUTPUT_TYPE,args);
-        if(ret == DISP_OUTPUT_TYPE_HDMI)
-        {
-            ALOGV("value = %d, f_trd_srd = %d, trd_mode = %d, b_trd_out %d", value, layer_info.fb.b_trd_src, layer_info.fb.trd_mode, layer_info.b_trd_out);
+        args[1]                     = ctx->hwc_layer.currenthandle;
+        hwc_ioctl(fd, DISP_CMD_LAYER_CLOSE,args);
+        hwc_ioctl(fd, DISP_CMD_VIDEO_STOP, args);
+    }
 
-            if(mode == HWC_DISP_MODE_3D && value != HWC_3D_OUT_MODE_NORMAL)
-            {
-                if(layer_info.b_trd_out == false || value != (int)layer_info.fb.trd_mode )
-                {
-                    if(layer_info.b_trd_out == false){
-                        args[0]                     = screen;
-                        args[1]                     = 0;
-                        args[2]                     = 0;
-                        args[3]                     = 0;
-                        ctx->cur_hdmimode    = ioctl(fd, DISP_CMD_HDMI_GET_MODE, args);
-                    }
-
-                    args[0]                     = screen;
-                    args[1]                     = 0;
-                    args[2]                     = 0;
-                    args[3]                     = 0;
-                    ioctl(fd,DISP_CMD_HDMI_OFF,(unsigned long)args);
-
-                    args[0]                     = screen;
-                    args[1]                     = DISP_TV_MOD_1080P_24HZ_3D_FP;
-                    args[2]                     = 0;
-                    args[3]                     = 0;
-                    ioctl(fd, DISP_CMD_HDMI_SET_MODE, args);
-
-                    args[0]                     = screen;
-                    args[1]                     = 0;
-                    args[2]                     = 0;
-                    args[3]                     = 0;
-                    ioctl(fd,DISP_CMD_HDMI_ON,(unsigned long)args);
-                    args[0]                     = screen;
-                    args[1]                     = 0;
-                    args[2]                     = 0;
-                    g_lcd_width                 = ioctl(fd, DISP_CMD_SCN_GET_WIDTH,args);
-                    g_lcd_height                = ioctl(fd, DISP_CMD_SCN_GET_HEIGHT,args);
-
-                    ctx->hwc_layer.dispW        = g_lcd_width;
-                    ctx->hwc_layer.dispH        = g_lcd_height;
-                    layer_info.scn_win.x         = 0;
-                    layer_info.scn_win.y         = 0;
-                    layer_info.scn_win.width     = g_lcd_width;
-                    layer_info.scn_win.height     = g_lcd_height;
-                    ALOGV("%d, 3d mode %d, value is %d ", __LINE__, mode, value);
-
-                    layer_info.fb.trd_mode         =  (__disp_3d_src_mode_t)value;
-                    layer_info.out_trd_mode        = DISP_3D_OUT_MODE_FP;
-                    layer_info.fb.b_trd_src    = true;
-                    layer_info.b_trd_out    = true;
-
-                    ctx->cur_3dmode                = value;
-                    ctx->cur_3denable            = true;
-                    ctx->cur_half_enable        = true;
-                    ALOGV("line %d, screen width %d, screen height %d", __LINE__, g_lcd_width, g_lcd_height);
-
-                    args[0]                     = screen;
-                    args[1]                     = (unsigned long) overlay;
-                    args[2]                     = (unsigned long) (&layer_info);
-                    args[3]                     = 0;
-                    ioctl(fd, DISP_CMD_LAYER_SET_PARA, args);
-                }
-            }
-            else
-            {
-                if(value != HWC_3D_OUT_MODE_NORMAL)
-                {
-                    if(layer_info.b_trd_out == true )
-                    {
-                        args[0]                     = screen;
-                        args[1]                     = 0;
-                        args[2]                     = 0;
-                        args[3]                     = 0;
-                        ioctl(fd,DISP_CMD_HDMI_OFF,(unsigned long)args);
-
-                        args[0]                     = screen;
-                        args[1]                     = ctx->cur_hdmimode;
-                        args[2]                     = 0;
-                        args[3]                     = 0;
-                        ioctl(fd, DISP_CMD_HDMI_SET_MODE, args);
-
-                        args[0]                     = screen;
-                        args[1]                     = 0;
-                        args[2]                     = 0;
-                        args[3]                     = 0;
-                        ioctl(fd,DISP_CMD_HDMI_ON,(unsigned long)args);
-
-                        args[0]                     = screen;
-                        args[1]                     = 0;
-                        args[2]                     = 0;
-                        g_lcd_width                 = ioctl(fd, DISP_CMD_SCN_GET_WIDTH,args);
-                        g_lcd_height                = ioctl(fd, DISP_CMD_SCN_GET_HEIGHT,args);
-                        ctx->hwc_layer.dispW          = g_lcd_width;
-                        ctx->hwc_layer.dispH          = g_lcd_height;
-
-                        layer_info.scn_win.x         = 0;
-                        layer_info.scn_win.y         = 0;
-                        layer_info.scn_win.width     = g_lcd_width;
-                        layer_info.scn_win.height     = g_lcd_height;
-                    }
-                    if(mode == HWC_DISP_MODE_2D)
-                    {
-                        ALOGV("%d, 3d mode with one picture", __LINE__);
-                        layer_info.fb.b_trd_src     = true;
-                        layer_info.b_trd_out        = false;
-                    }
-                    else
-                    {
-                        ALOGV("%d, original mode", __LINE__);
-                        layer_info.fb.b_trd_src     = false;
-                        layer_info.b_trd_out        = false;
-                    }
-                    layer_info.fb.trd_mode         = (__disp_3d_src_mode_t)value;
-                    layer_info.out_trd_mode        = DISP_3D_OUT_MODE_FP;
-
-                    ctx->cur_3denable            = layer_info.b_trd_out;
-                    ctx->cur_half_enable        = layer_info.fb.b_trd_src;
-                    ctx->cur_3dmode                = value;
-
-                    ALOGV("line %d, screen width %d, screen height %d", __LINE__, g_lcd_width, g_lcd_height);
-                    args[0]                     = screen;
-                    args[1]                     = (unsigned long) overlay;
-                    args[2]                     = (unsigned long) (&layer_info);
-                    args[3]                     = 0;
-                    ioctl(fd, DISP_CMD_LAYER_SET_PARA, args);
-                }
-            }
-        }
-        else
+    if(hdmi_switch)
+    {
+        if(target.trd_out && !ctx->cur_3denable)
         {
-            layer_info.fb.b_trd_src     = (mode == HWC_DISP_MODE_2D)?true:false;
-            layer_info.b_trd_out        = false;
-            layer_info.fb.trd_mode         =  (__disp_3d_src_mode_t)value;
+            ctx->cur_hdmimode       = hdmi_mode;
+        }
+        pthread_mutex_unlock(&ctx->video_lock);
+        hwc_3d_set_hdmi(ctx, screen, target.hdmi_mode);
+        pthread_mutex_lock(&ctx->video_lock);
+    }
+    else if(apply && target.hdmi_mode >= 0)
+    {
+        ctx->trd.hdmi_skipped++;
+    }
 
-            ctx->cur_3dmode                = value;
-            ctx->cur_3denable            = false;
-            ctx->cur_half_enable        = layer_info.fb.b_trd_src;
+    // everything below reaches the screen in one vblank
+    hwc_commit_begin(ctx, screen);
+    if(is_mode_changed && !hdmi_switch && ctx->hwc_layer.currenthandle)
+    {
+        args[0]                     = screen;
+        args[1]                     = ctx->hwc_layer.currenthandle;
+        hwc_ioctl(fd, DISP_CMD_VIDEO_STOP, args);
+    }
 
-            if(mode == HWC_DISP_MODE_3D)
-            {
-                ctx->cur_3denable       = true;
-                ctx->cur_half_enable    = true;
-            }
+    // a full setup reopens the layer on the next frame, it is only needed
+    // when the layer was closed for the hdmi switch or is not there yet.
+    // otherwise the shown layer keeps its state and only the 3d fields change
+    if(hdmi_switch || !ctx->hwc_layer.currenthandle)
+    {
+        layer_para.w                = _3d_info->width;
+        layer_para.h                = _3d_info->height;
+        layer_para.format           = _3d_info->format;
+        layer_para.screenid         = screen;
+        hwc_setlayerpara(ctx, (uint32_t)&layer_para);
+    }
+    handle                          = ctx->hwc_layer.currenthandle;
 
-            args[0]                     = 0;
-            args[1]                     = (unsigned long) overlay;
-            args[2]                     = (unsigned long) (&layer_info);
-            args[3]                     = 0;
-            ioctl(fd, DISP_CMD_LAYER_SET_PARA, args);
+    if(handle && apply)
+    {
+        args[0]                     = screen;
+        args[1]                     = handle;
+        args[2]                     = (unsigned long) (&layer_info);
+        args[3]                     = 0;
+        hwc_ioctl(fd, DISP_CMD_LAYER_GET_PARA, args);
+
+        if(target.hdmi_mode >= 0)
+        {
+            hwc_output_size(ctx, screen, &g_lcd_width, &g_lcd_height);
+            ctx->hwc_layer.dispW        = g_lcd_width;
+            ctx->hwc_layer.dispH        = g_lcd_height;
+            layer_info.scn_win.x        = 0;
+            layer_info.scn_win.y        = 0;
+            layer_info.scn_win.width    = g_lcd_width;
+            layer_info.scn_win.height   = g_lcd_height;
         }
+        layer_info.fb.b_trd_src         = target.trd_src;
+        layer_info.b_trd_out            = target.trd_out;
+        layer_info.fb.trd_mode          = (__disp_3d_src_mode_t)target.trd_mode;
+        layer_info.out_trd_mode         = DISP_3D_OUT_MODE_FP;
+
+        ctx->cur_3dmode                 = value;
+        ctx->cur_3denable               = target.trd_enable;
+        ctx->cur_half_enable            = target.half_enable;
+        ALOGV("3d mode %d, value %d, screen %dx%d, hdmi %s", mode, value, g_lcd_width, g_lcd_height,
+              hdmi_switch ? "switched" : "kept");
+
+        args[0]                     = screen;
+        args[1]                     = handle;
+        args[2]                     = (unsigned long) (&layer_info);
+        args[3]                     = 0;
+        hwc_ioctl(fd, DISP_CMD_LAYER_SET_PARA, args);
     }
 
-    if(is_mode_changed)
+    if(is_mode_changed && handle)
     {
-        ctx->wait_layer_open = 1;
-
+        if(hdmi_switch)
+        {
+            ctx->wait_layer_open = 1;
+        }
         args[0]                     = screen;
-        args[1]                     = (unsigned long) overlay;
+        args[1]                     = handle;
         args[2]                     = 0;
         args[3]                     = 0;
-        ioctl(fd, DISP_CMD_VIDEO_START, args);
+        hwc_ioctl(fd, DISP_CMD_VIDEO_START, args);
     }
+    hwc_commit_end(ctx, screen);
+    pthread_mutex_unlock(&ctx->video_lock);
+    pthread_mutex_unlock(&ctx->mode_lock);
 
     return 0;
 }
 
+static int hwc_queue_frame(sun4i_hwc_context_t *ctx,uint32_t value)
+{
+    hwc_frame_queue_t           *queue = &ctx->frame_queue;
+    hwcqueueframepara_t         *para = (hwcqueueframepara_t *)value;
+
+    if(para == NULL)
+    {
+        return -1;
+    }
+
+    if(!queue->enable)
+    {
+        return hwc_setlayerframepara(ctx,(uint32_t)&para->frame);
+    }
+
+    hwc_frame_queue_push(queue, para);
+
+    return 0;
+}
+
+/*
+ * called by the vsync thread of the video screen right after a vblank. a
+ * frame set now is shown on the next vblank, so it takes the newest frame
+ * due closer to that vblank than to the one after it, older due frames are
+ * dropped.
+ */
+static void hwc_queue_latch(sun4i_hwc_context_t *ctx, sun4i_hwc_display_t *display, nsecs_t timestamp)
+{
+    hwc_frame_queue_t           *queue = &ctx->frame_queue;
+    hwcqueueframepara_t         frame;
+    nsecs_t                     period;
+    nsecs_t                     due;
+
+    if(!queue->enable || (uint32_t)display->disp != ctx->hwc_screen)
+    {
+        return;
+    }
+
+    period  = display->vsync.period ? display->vsync.period : display->vsync.mode_period;
+    due     = timestamp + period + period / 2;
+
+    if(hwc_frame_queue_pop(queue, due, &frame))
+    {
+        pthread_mutex_lock(&ctx->video_lock);
+        hwc_setlayerframepara(ctx,(uint32_t)&frame.frame);
+        pthread_mutex_unlock(&ctx->video_lock);
+    }
+}
+
+/*
+ * the source window of a frame posted through the mailbox. the layer keeps
+ * the last one applied in crop*, hwc_setlayerpara starts it at the whole
+ * frame. the screen window stays with the surfaceflinger layer, dst_rect is
+ * the player's display size and not a position.
+ */
+static bool hwc_mailbox_crop_changed(sun4i_hwc_layer_1_t *video, const vdrvrect_t *rect)
+{
+    if(video->currenthandle == 0 || rect->uWidth <= 0 || rect->uHeight <= 0 || rect->uStartX < 0 || rect->uStartY < 0)
+    {
+        return false;
+    }
+
+    return (uint32_t)rect->uStartX != video->cropX || (uint32_t)rect->uStartY != video->cropY
+           || (uint32_t)rect->uWidth != video->cropW || (uint32_t)rect->uHeight != video->cropH;
+}
+
+static void hwc_mailbox_crop(sun4i_hwc_context_t *ctx, const vdrvrect_t *rect)
+{
+    sun4i_hwc_layer_1_t         *video = &ctx->hwc_layer;
+    unsigned long               args[4] = {0};
+    __disp_layer_info_t         layer_info;
+
+    args[0]                         = ctx->hwc_screen;
+    args[1]                         = video->currenthandle;
+    args[2]                         = (unsigned long)&layer_info;
+    if(hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args) < 0
+       || (uint32_t)(rect->uStartX + rect->uWidth) > layer_info.fb.size.width
+       || (uint32_t)(rect->uStartY + rect->uHeight) > layer_info.fb.size.height)
+    {
+        return;
+    }
+
+    layer_info.src_win.x            = rect->uStartX;
+    layer_info.src_win.y            = rect->uStartY;
+    layer_info.src_win.width        = rect->uWidth;
+    layer_info.src_win.height       = rect->uHeight;
+    if(hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args) == 0)
+    {
+        video->cropX                = rect->uStartX;
+        video->cropY                = rect->uStartY;
+        video->cropW                = rect->uWidth;
+        video->cropH                = rect->uHeight;
+    }
+}
+
+/*
+ * vsync thread side, applies the newest posted frame right after a vblank.
+ * only the thread of the screen the video layer is on latches, the frame
+ * and a new source window reach the DE in one commit.
+ */
+static void hwc_mailbox_latch(sun4i_hwc_context_t *ctx, sun4i_hwc_display_t *display)
+{
+    const libhwclayerpara_t     *para;
+    uint32_t                    screen;
+    bool                        crop;
+
+    if(!ctx->mailbox.enable || (uint32_t)display->disp != ctx->hwc_screen)
+    {
+        return;
+    }
+
+    // SETFRAMEMAILBOX resets the slots under video_lock, take under it too
+    pthread_mutex_lock(&ctx->video_lock);
+    para = ctx->mailbox.enable ? hwc_frame_mailbox_take(&ctx->mailbox) : NULL;
+    if(para == NULL)
+    {
+        pthread_mutex_unlock(&ctx->video_lock);
+        return;
+    }
+
+    screen  = ctx->hwc_screen;
+    crop    = hwc_mailbox_crop_changed(&ctx->hwc_layer, &para->src_rect);
+    if(crop)
+    {
+        hwc_commit_begin(ctx, screen);
+        hwc_mailbox_crop(ctx, &para->src_rect);
+    }
+    hwc_setlayerframepara(ctx,(uint32_t)para);
+    if(crop)
+    {
+        hwc_commit_end(ctx, screen);
+    }
+    pthread_mutex_unlock(&ctx->video_lock);
+}
+
 static int hwc_setparameter(hwc_composer_device_1_t *dev,uint32_t param,uint32_t value)
 {
+    unsigned long               args[4] = {0};
     int                         ret = 0;
     sun4i_hwc_context_t           *ctx = (sun4i_hwc_context_t *)dev;
     int                            ctl_fd;
 
+    if(param == HWC_LAYER_SETFRAMEPARA && ctx->mailbox.enable)
+    {
+        // leave the ioctls to the vsync thread, the decoder must not wait on them
+        if(value == 0)
+        {
+            return -1;
+        }
+        hwc_frame_mailbox_post(&ctx->mailbox, (const libhwclayerpara_t *)value);
+        return 0;
+    }
+    if(param == HWC_LAYER_SETSCREEN)
+    {
+        // takes video_lock itself and drops it over the slow parts
+        ALOGV("param == HWC_LAYER_SETSCREEN,value = %d\n",value);
+        return hwc_setscreen(ctx,value);
+    }
+    if(param == HWC_LAYER_SET3DMODE)
+    {
+        ALOGV("param == HWC_LAYER_SET3DMODE,value = %d\n",value);
+        return hwc_set3dmode(ctx,value);
+    }
+    if(param == HWC_LAYER_SETMODE)
+    {
+        // the caller changed the screen's output, read it again and tell surfaceflinger
+        ALOGV("param == HWC_LAYER_SETMODE,value = %d\n",value);
+        if(value < HWC_MAX_SCREEN)
+        {
+            hwc_output_invalidate(ctx, value);
+            hwc_update_hotplug(ctx, value);
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->video_lock);
     ctl_fd   = ctx->dispfd;
     if(param == HWC_LAYER_SETINITPARA)
     {
         ctx->cur_3denable            = false;
         ctx->cur_half_enable        = false;
         ctx->cur_3dmode                = value;
+        hwc_frame_queue_reset(&ctx->frame_queue);
         ret = hwc_setlayerpara(ctx,value);
     }
     else if(param == HWC_LAYER_SETFRAMEPARA)
@@ -1837,19 +2525,18 @@ static int hwc_setparameter(hwc_composer_device_1_t *dev,uint32_t param,uint32_t
     }
     else if(param == HWC_LAYER_GETCURFRAMEPARA)
     {
-        ret = ioctl(ctl_fd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
+        args[0]                         = ctx->hwc_screen;
+        args[1]                         = (unsigned long)ctx->hwc_layer.currenthandle;
+        ret = hwc_ioctl(ctl_fd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
         if(ret == -1)
         {
-            ret = ctx->hwc_layer.cur_frameid;
+            // the frame handed over last may not be scanned out yet, only
+            // report what the vsync thread saw the DE latch
+            ret = ctx->hwc_layer.latched_frameid;
             ALOGV("ret = -1 HWC_LAYER_GETCURFRAMEPARA =%d",ret);
         }
         ALOGV("HWC_LAYER_GETCURFRAMEPARA =%d",ret);
     }
-    else if(param == HWC_LAYER_SETSCREEN)
-    {
-        ALOGV("param == HWC_LAYER_SETSCREEN,value = %d\n",value);
-        ret = hwc_setscreen(ctx,value);
-    }
     else if(param == HWC_LAYER_SHOW)
     {
         ALOGV("param == HWC_LAYER_SHOW,value = %d\n",value);
@@ -1858,13 +2545,9 @@ static int hwc_setparameter(hwc_composer_device_1_t *dev,uint32_t param,uint32_t
     else if(param == HWC_LAYER_RELEASE)
     {
         ALOGV("param == HWC_LAYER_RELEASE,value = %d\n",value);
+        hwc_frame_queue_reset(&ctx->frame_queue);
         ret = hwc_release(ctx);
     }
-    else if(param == HWC_LAYER_SET3DMODE)
-    {
-        ALOGV("param == HWC_LAYER_SET3DMODE,value = %d\n",value);
-        ret = hwc_set3dmode(ctx,value);
-    }
     else if(param == HWC_LAYER_SETFORMAT)
     {
         ALOGV("param == HWC_LAYER_SETFORMAT,value = %d\n",value);
@@ -1920,37 +2603,426 @@ static int hwc_setparameter(hwc_composer_device_1_t *dev,uint32_t param,uint32_t
         ALOGV("param == HWC_LAYER_GETBLACKEXTEN,value = %d\n",value);
         ret = hwc_getblackexten(ctx);
     }
+    else if(param == HWC_LAYER_SETFRAMEQUEUE)
+    {
+        ALOGV("param == HWC_LAYER_SETFRAMEQUEUE,value = %d\n",value);
+        hwc_frame_queue_reset(&ctx->frame_queue);
+        ctx->frame_queue.dropped    = 0;
+        ctx->frame_queue.repeated   = 0;
+        ctx->frame_queue.enable     = !!value;
+    }
+    else if(param == HWC_LAYER_QUEUEFRAME)
+    {
+        ret = hwc_queue_frame(ctx,value);
+    }
+    else if(param == HWC_LAYER_SETFRAMEMAILBOX)
+    {
+        ALOGV("param == HWC_LAYER_SETFRAMEMAILBOX,value = %d\n",value);
+        android_atomic_release_store(0, &ctx->mailbox.enable);
+        hwc_frame_mailbox_reset(&ctx->mailbox);
+        ctx->mailbox.posted         = 0;
+        ctx->mailbox.coalesced      = 0;
+        android_atomic_release_store(!!value, &ctx->mailbox.enable);
+    }
+    pthread_mutex_unlock(&ctx->video_lock);
 
     return ( ret );
 }
 
-static uint32_t hwc_getparameter(hwc_composer_device_1_t *dev,uint32_t cmd)
-{
-    return  0;
+static uint32_t hwc_getparameter(hwc_composer_device_1_t *dev,uint32_t cmd)
+{
+    sun4i_hwc_context_t           *ctx = (sun4i_hwc_context_t *)dev;
+
+    if(cmd == HWC_LAYER_GETDROPPEDFRAMES)
+    {
+        return ctx->frame_queue.dropped;
+    }
+    else if(cmd == HWC_LAYER_GETREPEATEDFRAMES)
+    {
+        return ctx->frame_queue.repeated;
+    }
+    else if(cmd == HWC_LAYER_GETCOALESCEDFRAMES)
+    {
+        return ctx->mailbox.coalesced;
+    }
+
+    return  0;
+}
+
+/* the video layer is bound to a layer on some display */
+static bool hwc_video_planned(sun4i_hwc_context_t *ctx)
+{
+    for(int i = 0; i < HWC_MAX_SCREEN; i++)
+    {
+        if(ctx->plan[i].video_index >= 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void hwc_fence_init(hwc_fence_timeline_t *timeline)
+{
+    pthread_mutex_init(&timeline->lock, NULL);
+    timeline->fd = sw_sync_timeline_create();
+    if(timeline->fd < 0)
+    {
+        ALOGW("no sw_sync timeline (%s), fences are signalled on return", strerror(errno));
+    }
+}
+
+static int hwc_fence_create(hwc_fence_timeline_t *timeline, uint32_t point)
+{
+    if(timeline->fd < 0)
+    {
+        return -1;
+    }
+
+    return sw_sync_fence_create(timeline->fd, "hwc", point);
+}
+
+/* the DE cannot wait on fences, so the acquire fence is waited on before the layer is programmed */
+static void hwc_fence_acquire(hwc_layer_1_t *layer)
+{
+    if(layer->acquireFenceFd >= 0)
+    {
+        if(sync_wait(layer->acquireFenceFd, 1000) < 0)
+        {
+            ALOGE("acquire fence %d: %s", layer->acquireFenceFd, strerror(errno));
+        }
+        close(layer->acquireFenceFd);
+        layer->acquireFenceFd = -1;
+    }
+}
+
+/*
+ * a frame committed at point N is replaced once frame N + 1 is latched, so
+ * its buffers are released and the frame retired on point N + 1.
+ */
+static void hwc_fence_commit(sun4i_hwc_display_t *display, hwc_display_contents_1_t *list)
+{
+    hwc_fence_timeline_t        *timeline = &display->fence;
+    uint32_t                    point;
+
+    pthread_mutex_lock(&timeline->lock);
+    point                   = ++timeline->committed;
+    timeline->commit_time   = systemTime(CLOCK_MONOTONIC);
+    pthread_mutex_unlock(&timeline->lock);
+
+    for(size_t i = 0; i < list->numHwLayers; i++)
+    {
+        hwc_layer_1_t           *layer = &list->hwLayers[i];
+
+        if(layer->compositionType == HWC_OVERLAY
+           || layer->compositionType == HWC_FRAMEBUFFER_TARGET)
+        {
+            layer->releaseFenceFd = hwc_fence_create(timeline, point + 1);
+        }
+    }
+    list->retireFenceFd = hwc_fence_create(timeline, point + 1);
+}
+
+/* called after each vblank, anything committed before it is now on screen */
+static void hwc_fence_latch(sun4i_hwc_context_t *ctx, sun4i_hwc_display_t *display, nsecs_t timestamp)
+{
+    hwc_fence_timeline_t        *timeline = &display->fence;
+    sun4i_hwc_layer_1_t         *video = &ctx->hwc_layer;
+    uint32_t                    point;
+
+    pthread_mutex_lock(&timeline->lock);
+    point = timeline->committed;
+    if(timeline->commit_time > timestamp)
+    {
+        // committed after this vblank, it lands on the next one
+        point--;
+    }
+    if((int32_t)(point - timeline->signaled) > 0)
+    {
+        if(timeline->fd >= 0)
+        {
+            sw_sync_timeline_inc(timeline->fd, point - timeline->signaled);
+        }
+        timeline->signaled = point;
+    }
+    pthread_mutex_unlock(&timeline->lock);
+
+    if((uint32_t)display->disp == ctx->hwc_screen
+       && video->frame_pending && video->frame_time <= timestamp)
+    {
+        video->latched_frameid  = video->cur_frameid;
+        video->frame_pending    = false;
+    }
+}
+
+static void hwc_fb_open(sun4i_hwc_display_t *display)
+{
+    char                        node[64];
+
+    snprintf(node, sizeof(node), SUNXI_DEV_ROOT "/graphics/fb%d", display->disp);
+    display->fb.fd      = open(node, O_RDWR);
+    display->fb.base    = NULL;
+    display->fb.size    = 0;
+    display->fb.start   = 0;
+}
+
+static void hwc_fb_unmap(hwc_fb_post_t *fb)
+{
+    if(fb->base != NULL)
+    {
+        munmap(fb->base, fb->size);
+        fb->base    = NULL;
+        fb->size    = 0;
+        fb->start   = 0;
+    }
+}
+
+/*
+ * hwc 1.1 has no display format attribute, surfaceflinger allocates every
+ * framebuffer target as rgba8888. the fb it is copied into may
+ * be laid out differently, pick the row writer for that layout.
+ */
+static hwc_fb_copy_t hwc_fb_copyfmt(const struct fb_var_screeninfo *var)
+{
+    if(var->bits_per_pixel == 32 && var->green.offset == 8 && var->green.length == 8
+       && var->red.length == 8 && var->blue.length == 8)
+    {
+        if(var->red.offset == 0 && var->blue.offset == 16)
+        {
+            return HWC_FB_COPY_RGBA;
+        }
+        if(var->red.offset == 16 && var->blue.offset == 0)
+        {
+            return HWC_FB_COPY_BGRA;
+        }
+    }
+    if(var->bits_per_pixel == 16
+       && var->red.offset == 11 && var->red.length == 5
+       && var->green.offset == 5 && var->green.length == 6
+       && var->blue.offset == 0 && var->blue.length == 5)
+    {
+        return HWC_FB_COPY_RGB565;
+    }
+
+    return HWC_FB_COPY_NONE;
+}
+
+/* one row of rgba8888 pixels into the fb layout */
+static void hwc_fb_copyrow(uint8_t *dst, const uint8_t *src, uint32_t width, hwc_fb_copy_t copy)
+{
+    const uint32_t              *s = (const uint32_t *)src;
+    uint32_t                    x;
+
+    switch(copy)
+    {
+        case HWC_FB_COPY_RGBA:
+            memcpy(dst, src, width * 4);
+            break;
+        case HWC_FB_COPY_BGRA:
+            for(x = 0; x < width; x++)
+            {
+                uint32_t        p = s[x];
+
+                ((uint32_t *)dst)[x] = (p & 0xff00ff00) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+            }
+            break;
+        case HWC_FB_COPY_RGB565:
+            for(x = 0; x < width; x++)
+            {
+                uint32_t        p = s[x];
+
+                ((uint16_t *)dst)[x] = ((p & 0xf8) << 8) | ((p & 0xfc00) >> 5) | ((p & 0xf80000) >> 19);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * scan out the framebuffer target of a display, the way gralloc's fb_post
+ * does for hwc 1.0. buffers gralloc carved out of fb0 are panned to where
+ * they are, anything else is copied by the cpu into the fb page not on
+ * screen first. that copy is a whole frame each time gles composed, it is
+ * only taken on displays whose target gralloc could not put in their fb.
+ */
+static int hwc_fb_post(sun4i_hwc_display_t *display, hwc_layer_1_t *layer)
+{
+    private_handle_t            *hnd = (private_handle_t *)layer->handle;
+    hwc_fb_post_t               *fb = &display->fb;
+    struct fb_fix_screeninfo    fix;
+    struct fb_var_screeninfo    var;
+    hwc_fb_copy_t               copy;
+    uint32_t                    pages;
+    uint32_t                    page;
+    uint32_t                    src_stride;
+    uint32_t                    width;
+    uint32_t                    rows;
+    uint8_t                     *src;
+    uint8_t                     *dst;
+
+    if(fb->fd < 0 || hnd == NULL || hnd->magic != private_handle_t::sMagic)
+    {
+        return -1;
+    }
+
+    if(ioctl(fb->fd, FBIOGET_FSCREENINFO, &fix) < 0 || ioctl(fb->fd, FBIOGET_VSCREENINFO, &var) < 0
+       || var.yres == 0)
+    {
+        return -1;
+    }
+
+    if(display->disp == 0 && (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER))
+    {
+        var.yoffset = hnd->offset / fix.line_length;
+    }
+    else
+    {
+        copy = hwc_fb_copyfmt(&var);
+        if(copy == HWC_FB_COPY_NONE)
+        {
+            if(fb->rejected++ == 0)
+            {
+                ALOGE("fb%d layout %d bpp r%d/%d g%d/%d b%d/%d cannot take an rgba8888 target",
+                      display->disp, var.bits_per_pixel, var.red.offset, var.red.length,
+                      var.green.offset, var.green.length, var.blue.offset, var.blue.length);
+            }
+            return -1;
+        }
+
+        // the display hal releases and requests the fb again on mode switches, which frees
+        // its memory. a mapping of the old memory would write into freed pages
+        if(fb->base != NULL && (fb->start != fix.smem_start || fb->size != fix.smem_len))
+        {
+            ALOGI("fb%d memory moved, mapping it again", display->disp);
+            hwc_fb_unmap(fb);
+        }
+        if(fb->base == NULL)
+        {
+            if(fix.smem_len == 0)
+            {
+                return -1;
+            }
+            fb->base = mmap(0, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
+            if(fb->base == MAP_FAILED)
+            {
+                fb->base = NULL;
+                return -1;
+            }
+            fb->size    = fix.smem_len;
+            fb->start   = fix.smem_start;
+        }
+        if(hnd->base == 0)
+        {
+            return -1;
+        }
+
+        // the pitch is the target's own: gralloc aligns rows to 64 bytes,
+        // unless the buffer is a page of fb0
+        width       = layer->displayFrame.right - layer->displayFrame.left;
+        rows        = layer->displayFrame.bottom - layer->displayFrame.top;
+        src_stride  = (width * HWC_FB_TARGET_BPP + 63) & ~63;
+        if((hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) && hwc_fb_info())
+        {
+            src_stride = g_fb_line_length;
+        }
+        if(width * HWC_FB_TARGET_BPP > src_stride)
+        {
+            return -1;
+        }
+        if(width > var.xres)
+        {
+            width = var.xres;
+        }
+        if(rows > var.yres)
+        {
+            rows = var.yres;
+        }
+
+        pages   = var.yres_virtual / var.yres;
+        page    = pages > 1 ? (var.yoffset / var.yres + 1) % pages : 0;
+        if((size_t)(page + 1) * var.yres * fix.line_length > fb->size
+           || (size_t)rows * src_stride > (size_t)hnd->size)
+        {
+            return -1;
+        }
+
+        src = (uint8_t *)(intptr_t)hnd->base;
+        dst = (uint8_t *)fb->base + page * var.yres * fix.line_length;
+        for(uint32_t y = 0; y < rows; y++)
+        {
+            hwc_fb_copyrow(dst, src, width, copy);
+            src += src_stride;
+            dst += fix.line_length;
+        }
+        var.yoffset = page * var.yres;
+        fb->copies++;
+    }
+
+    var.activate = FB_ACTIVATE_VBL;
+    if(ioctl(fb->fd, FBIOPAN_DISPLAY, &var) < 0)
+    {
+        ALOGE("fb%d pan to %d failed: %s", display->disp, var.yoffset, strerror(errno));
+        return -1;
+    }
+    fb->posts++;
+
+    return 0;
+}
+
+/* the target only holds a new frame when gles composed something into it */
+static hwc_layer_1_t *hwc_fb_target(hwc_display_contents_1_t *list)
+{
+    hwc_layer_1_t               *target = NULL;
+    bool                        composed = false;
+
+    for(size_t i = 0; i < list->numHwLayers; i++)
+    {
+        hwc_layer_1_t           *layer = &list->hwLayers[i];
+
+        if(layer->compositionType == HWC_FRAMEBUFFER_TARGET)
+        {
+            target = layer;
+        }
+        else if(layer->compositionType == HWC_FRAMEBUFFER)
+        {
+            composed = true;
+        }
+    }
+
+    return composed ? target : NULL;
 }
 
-static int hwc_set_layer(hwc_composer_device_1_t *dev, hwc_display_contents_1_t* list)
+static int hwc_set_layer(hwc_composer_device_1_t *dev, int disp, hwc_display_contents_1_t* list)
 {
     int                         ret = 0;
     sun4i_hwc_context_t           *ctx = (sun4i_hwc_context_t *)dev;
-    bool                        findoverlay = false;
+    hwc_overlay_plan_t          *plan = &ctx->plan[disp];
+    int                         index = plan->video_index;
 
     //ALOGV("hwc_set_layer list->numHwLayers = %d\n",list->numHwLayers);
 
-    for (size_t i=0 ; i<list->numHwLayers ; i++)
+    pthread_mutex_lock(&ctx->video_lock);
+    if(index >= 0 && index < (int)list->numHwLayers
+       && list->hwLayers[index].compositionType == HWC_OVERLAY)
     {
-        if(list->hwLayers[i].compositionType == HWC_OVERLAY)
-        {
-            ret = hwc_setrect(ctx,&list->hwLayers[i].sourceCrop,&list->hwLayers[i].displayFrame);
+        hwc_layer_1_t           *layer = &list->hwLayers[index];
 
-            findoverlay = true;
+        if((list->flags & HWC_GEOMETRY_CHANGED) || !hwc_geometry_unchanged(ctx, disp, layer))
+        {
+            hwc_commit_begin(ctx, ctx->hwc_screen);
+            ret = hwc_setrect(ctx,&layer->sourceCrop,&layer->displayFrame);
+            hwc_commit_end(ctx, ctx->hwc_screen);
+            hwc_update_geometry(ctx, disp, layer);
         }
     }
-
-    if(!findoverlay)
+    else if(!hwc_video_planned(ctx))
     {
+        hwc_invalidate_geometry(ctx);
         hwc_show(ctx,0);
     }
+    pthread_mutex_unlock(&ctx->video_lock);
 
     return ret;
 }
@@ -1959,63 +3031,114 @@ static int hwc_set(hwc_composer_device_1_t *dev,
         size_t numDisplays,
         hwc_display_contents_1_t** lists)
 {
-    hwc_display_contents_1_t* list = lists[0];
-    //for (size_t i=0 ; i<list->numHwLayers ; i++) {
-    //    dump_layer(&list->hwLayers[i]);
-    //}
-    EGLBoolean sucess = eglSwapBuffers((EGLDisplay)list->dpy, (EGLSurface)list->sur);
-    if (unlikely(!sucess))
-        return HWC_EGL_ERROR;
+    sun4i_hwc_context_t *ctx = (sun4i_hwc_context_t *)dev;
+    hwc_layer_1_t *target;
+    int ret = 0;
 
-    //don't continue if layer list is NULL
-    if (unlikely(list == NULL))
-        return 0;
+    if (g_trace.enable)
+    {
+        pthread_mutex_lock(&g_trace.lock);
+        if (g_trace.prepare_time)
+        {
+            hwc_trace_add(&g_trace.prepare_to_set, systemTime(CLOCK_MONOTONIC) - g_trace.prepare_time);
+            g_trace.prepare_time = 0;
+        }
+        pthread_mutex_unlock(&g_trace.lock);
+    }
+
+    for (size_t disp = 0; disp < numDisplays && disp < HWC_MAX_SCREEN; disp++)
+    {
+        hwc_display_contents_1_t* list = lists[disp];
+        //for (size_t i=0 ; i<list->numHwLayers ; i++) {
+        //    dump_layer(&list->hwLayers[i]);
+        //}
+
+        //don't continue if layer list is NULL
+        if (unlikely(list == NULL))
+        {
+            continue;
+        }
 
-    return hwc_set_layer(dev,list);
+        for (size_t i = 0; i < list->numHwLayers; i++)
+            hwc_fence_acquire(&list->hwLayers[i]);
+
+        // hwc 1.1 posts the gles composition itself, surfaceflinger no
+        // longer calls the fb hal. errors are kept and the remaining
+        // displays still get their fences.
+        // the display hal may have taken screen 1 since the last hotplug
+        // poll, its own copies must not be panned over
+        target = hwc_fb_target(list);
+        if (target && disp != HWC_DISPLAY_PRIMARY && !hwc_display_owned(disp))
+        {
+            target = NULL;
+        }
+        if (target && hwc_fb_post(&ctx->display[disp], target) != 0)
+        {
+            ret = -1;
+        }
+
+        if (hwc_set_layer(dev,disp,list) != 0)
+        {
+            ret = -1;
+        }
+        hwc_fence_commit(&ctx->display[disp], list);
+        if (g_trace.enable)
+        {
+            pthread_mutex_lock(&g_trace.lock);
+            g_trace.set_time[disp] = systemTime(CLOCK_MONOTONIC);
+            pthread_mutex_unlock(&g_trace.lock);
+        }
+    }
+
+    return ret;
 }
 
 static int hwc_device_close(struct hw_device_t *dev)
 {
+    unsigned long               args[4] = {0};
     sun4i_hwc_context_t* ctx = (sun4i_hwc_context_t*)dev;
     int ret;
     if (ctx)
     {
+        hwc_threads_stop(ctx);
+
         if(ctx->hwc_layer.currenthandle)
         {
+            args[0]                         = ctx->hwc_screen;
+            args[1]                         = fb_layer_hdl;
+            hwc_ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
+
             args[0] = ctx->hwc_screen;
             args[1] = (unsigned long)ctx->hwc_layer.currenthandle;
             args[2] = 0;
             args[3] = 0;
-
-            args[0]                         = ctx->hwc_screen;
-            args[1]                         = fb_layer_hdl;
-            ioctl(ctx->dispfd,DISP_CMD_LAYER_ALPHA_ON,(void*)args);//disable the global alpha, use the pixel's alpha
-
-            ioctl(ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
+            hwc_ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
         }
-        args[0]                         = ctx->hwc_screen;
-        ret = ioctl(ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,args);
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            hwc_pool_drain(ctx, i);
+        }
+        ret = hwc_output_type(ctx, ctx->hwc_screen);
         if(ret == DISP_OUTPUT_TYPE_HDMI && (ctx->cur_3denable == true))
         {
-            args[0]                     = ctx->hwc_screen;
-            args[1]                     = 0;
-            args[2]                     = 0;
-            args[3]                     = 0;
-            ioctl(ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
+            hwc_3d_set_hdmi(ctx, ctx->hwc_screen, ctx->cur_hdmimode);
+        }
 
-            ALOGV("ctx->cur_hdmimode %d",ctx->cur_hdmimode);
-            args[0]                     = ctx->hwc_screen;
-            args[1]                     = ctx->cur_hdmimode;
-            args[2]                     = 0;
-            args[3]                     = 0;
-            ioctl(ctx->dispfd, DISP_CMD_HDMI_SET_MODE, args);
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            sun4i_hwc_display_t *display = &ctx->display[i];
 
-            args[0]                     = ctx->hwc_screen;
-            args[1]                     = 0;
-            args[2]                     = 0;
-            args[3]                     = 0;
-            ioctl(ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
+            // closing the timeline signals the fences still pending on it
+            if(display->fence.fd >= 0)
+            {
+                close(display->fence.fd);
+            }
+            hwc_fb_unmap(&display->fb);
+            if(display->fb.fd >= 0)
+            {
+                close(display->fb.fd);
+            }
         }
 
         if(ctx->dispfd)
@@ -2027,52 +3150,363 @@ static int hwc_device_close(struct hw_device_t *dev)
     return 0;
 }
 
+/*
+ * display N is DE screen N and fbN only while the display hal leaves them
+ * to us. in dual same mode its mirror thread copies into fb1 and pans it,
+ * and with the master on screen 1 fb0 is scanned out there. the external
+ * display is then not ours to report or post to.
+ */
+static bool hwc_display_ownedin(const char *value, int disp)
+{
+    int                         mode = DISPLAY_MODE_SINGLE;
+    int                         master = 0;
+
+    if(disp == HWC_DISPLAY_PRIMARY)
+    {
+        return true;
+    }
+
+    sscanf(value, "%d %d", &mode, &master);
+
+    return (mode == DISPLAY_MODE_SINGLE || mode == DISPLAY_MODE_DUALDIFF) && master == 0;
+}
+
+static bool hwc_display_owned(int disp)
+{
+    char                        value[PROPERTY_VALUE_MAX];
+
+    property_get(DISPLAY_MODE_PROPERTY, value, "0 0");
+
+    return hwc_display_ownedin(value, disp);
+}
+
+/* *changed is set when the output's type or timing moved since the last look */
+static bool hwc_display_connected(sun4i_hwc_context_t *ctx, int disp, bool *changed)
+{
+    *changed = false;
+    if(ctx->dispfd == 0)
+    {
+        ctx->dispfd = hwc_open_disp();
+        if (ctx->dispfd < 0)
+        {
+            ctx->dispfd = 0;
+            return disp == HWC_DISPLAY_PRIMARY;
+        }
+    }
+
+    *changed = hwc_output_refresh(ctx, disp);
+
+    return disp == HWC_DISPLAY_PRIMARY
+           || (hwc_output_type(ctx, disp) != DISP_OUTPUT_TYPE_NONE && hwc_display_owned(disp));
+}
+
+/*
+ * look at a screen again after a uevent or from the once a second poll.
+ * the external screens report hotplug, a screen that stays connected but
+ * got a new output or timing has surfaceflinger compose it again.
+ */
+static void hwc_update_hotplug(sun4i_hwc_context_t *ctx, int disp)
+{
+    sun4i_hwc_display_t         *display = &ctx->display[disp];
+    bool                        connected;
+    bool                        changed;
+
+    pthread_mutex_lock(&ctx->hotplug_lock);
+    connected = hwc_display_connected(ctx, disp, &changed);
+    if(connected == display->connected)
+    {
+        if(changed && connected && ctx->procs && ctx->procs->invalidate)
+        {
+            ALOGI("display %d output changed", disp);
+            ctx->procs->invalidate(ctx->procs);
+        }
+        pthread_mutex_unlock(&ctx->hotplug_lock);
+        return;
+    }
+
+    ALOGI("display %d %s", disp, connected ? "connected" : "disconnected");
+    display->connected = connected;
+    if(connected)
+    {
+        hwc_vsync_request_reset(&display->vsync);
+        hwc_pool_warm(ctx, disp);
+    }
+    else
+    {
+        hwc_pool_drain(ctx, disp);
+    }
+
+    if(ctx->procs && ctx->procs->hotplug)
+    {
+        ctx->procs->hotplug(ctx->procs, disp, connected);
+    }
+    pthread_mutex_unlock(&ctx->hotplug_lock);
+}
+
+/* hdmi and tv hotplug arrive as switch uevents, every screen is looked at again */
+static void *hwc_uevent_thread(void *data)
+{
+    sun4i_hwc_context_t         *ctx = (sun4i_hwc_context_t *)data;
+    struct pollfd               fds[2];
+    char                        buf[1024];
+    int                         len;
+
+    fds[0].fd       = ctx->uevent_fd;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = ctx->uevent_wake[0];
+    fds[1].events   = POLLIN;
+    while(!android_atomic_acquire_load(&ctx->quit))
+    {
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno != EINTR)
+            {
+                ALOGE("uevent poll fail: %s", strerror(errno));
+                break;
+            }
+            continue;
+        }
+        if(fds[1].revents)
+        {
+            // hwc_device_close
+            break;
+        }
+        if(!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        len = recv(ctx->uevent_fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if(len <= 0)
+        {
+            if(len < 0 && errno != EINTR && errno != ENOBUFS && errno != EAGAIN)
+            {
+                ALOGE("uevent recv fail: %s", strerror(errno));
+                break;
+            }
+            continue;
+        }
+        buf[len] = 0;
+
+        // the first string is action@devpath
+        if(!strstr(buf, "/switch/"))
+        {
+            continue;
+        }
+
+        ALOGV("uevent %s", buf);
+        for(int disp = 0; disp < HWC_MAX_SCREEN; disp++)
+        {
+            hwc_output_invalidate(ctx, disp);
+            hwc_update_hotplug(ctx, disp);
+        }
+    }
+
+    return NULL;
+}
+
+static void hwc_uevent_start(sun4i_hwc_context_t *ctx)
+{
+    struct sockaddr_nl          addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family  = AF_NETLINK;
+    addr.nl_groups  = 0xffffffff;
+
+    ctx->uevent_fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+    if(ctx->uevent_fd < 0)
+    {
+        ALOGE("uevent socket fail, hotplug is only polled");
+        return;
+    }
+    if(pipe(ctx->uevent_wake) < 0)
+    {
+        ALOGE("uevent wake pipe fail, hotplug is only polled");
+        close(ctx->uevent_fd);
+        ctx->uevent_fd = -1;
+        return;
+    }
+
+    if(bind(ctx->uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+       || pthread_create(&ctx->uevent_thread, NULL, hwc_uevent_thread, ctx) != 0)
+    {
+        ALOGE("uevent listener fail, hotplug is only polled");
+        close(ctx->uevent_wake[0]);
+        close(ctx->uevent_wake[1]);
+        close(ctx->uevent_fd);
+        ctx->uevent_fd = -1;
+    }
+}
+
+/* the uevent and vsync threads dereference ctx, they are gone before it is freed */
+static void hwc_threads_stop(sun4i_hwc_context_t *ctx)
+{
+    char                        wake = 0;
+
+    android_atomic_release_store(1, &ctx->quit);
+    if(ctx->uevent_fd >= 0)
+    {
+        if(write(ctx->uevent_wake[1], &wake, 1) < 0)
+        {
+            ALOGE("uevent wake fail: %s", strerror(errno));
+        }
+        pthread_join(ctx->uevent_thread, NULL);
+        close(ctx->uevent_wake[0]);
+        close(ctx->uevent_wake[1]);
+        close(ctx->uevent_fd);
+        ctx->uevent_fd = -1;
+    }
+
+    // a vsync thread leaves within a vsync period, hardware or software
+    for(int i = 0; i < HWC_MAX_SCREEN; i++)
+    {
+        if(ctx->display[i].vsync_running)
+        {
+            pthread_join(ctx->display[i].vsync_thread, NULL);
+            ctx->display[i].vsync_running = false;
+        }
+    }
+}
+
 static void *hwc_vsync_thread(void *data)
 {
-    #define HZ 60
-    struct timespec spec;
-    int err = 0;
-    nsecs_t period, now, next_vsync, sleep, next_fake_vsync = 0;
-    hwc_context_t *ctx = (hwc_context_t *)data;
-    int fb = open("/dev/graphics/fb0", O_RDWR);
-    if(fb < 0) {
-        ALOGE("failed to open fb0\n");
-        return NULL;
+    sun4i_hwc_display_t *display = (sun4i_hwc_display_t *)data;
+    sun4i_hwc_context_t *ctx = display->ctx;
+    nsecs_t timestamp;
+    nsecs_t last_poll = 0;
+
+    if(display->fb.fd < 0) {
+        ALOGE("failed to open fb%d, using software vsync\n", display->disp);
     }
 
+    hwc_vsync_init(&display->vsync, display->fb.fd);
+    ALOGI("display %d vsync period %lld ns from mode", display->disp, display->vsync.mode_period);
+
     setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
 
-    while (true) {
-        period = 1000000000/HZ;
-        now = systemTime(CLOCK_MONOTONIC);
-        next_vsync = next_fake_vsync;
-        sleep = next_vsync - now;
-        if (sleep < 0) {
-            // we missed, find where the next vsync should be
-            sleep = (period - ((now - next_vsync) % period));
-            next_vsync = now + sleep;
+    while (!android_atomic_acquire_load(&ctx->quit)) {
+        timestamp = hwc_vsync_wait(&display->vsync);
+
+        if (timestamp - last_poll > 1000000000LL) {
+            // hotplug also arrives as a uevent, mode changes of the display
+            // hal are only seen here
+            hwc_update_hotplug(ctx, display->disp);
+            last_poll = timestamp;
         }
-        next_fake_vsync = next_vsync + period;
 
-        spec.tv_sec  = next_vsync / 1000000000;
-        spec.tv_nsec = next_vsync % 1000000000;
+        if (g_trace.enable)
+        {
+            pthread_mutex_lock(&g_trace.lock);
+            if (g_trace.set_time[display->disp] && g_trace.set_time[display->disp] <= timestamp)
+            {
+                hwc_trace_add(&g_trace.set_to_vsync[display->disp], timestamp - g_trace.set_time[display->disp]);
+                g_trace.set_time[display->disp] = 0;
+            }
+            pthread_mutex_unlock(&g_trace.lock);
+        }
 
-        do {
-            err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
-        } while (err < 0 && errno == EINTR);
+        hwc_fence_latch(ctx, display, timestamp);
+        hwc_queue_latch(ctx, display, timestamp);
+        hwc_mailbox_latch(ctx, display);
 
-/*      arg = 0;
-        //ioctl(fb, FBIO_WAITFORVSYNC, &arg);
-*/
-        if (ctx->vsync_enabled)
-            ctx->procs->vsync(ctx->procs, 0, next_vsync);
+        if (display->vsync_enabled && display->connected && ctx->procs)
+            ctx->procs->vsync(ctx->procs, display->disp, timestamp);
     }
 
-    close(fb);
-
     return NULL;
 }
 
+static int hwc_dump_hist(char *buff, int len, const char *name, const hwc_trace_hist_t *hist)
+{
+    int                         n;
+
+    if(hist->count == 0)
+    {
+        return 0;
+    }
+
+    n = snprintf(buff, len, "  %-24s n=%-8u avg=%6lldus max=%6lldus |",
+                 name, hist->count, hist->total / hist->count / 1000, hist->max / 1000);
+    for(int i = 0; i < HWC_TRACE_BUCKETS && n < len; i++)
+    {
+        n += snprintf(buff + n, len - n, " %u", hist->bucket[i]);
+    }
+    if(n < len)
+    {
+        n += snprintf(buff + n, len - n, "\n");
+    }
+
+    return n < len ? n : len;
+}
+
+static void hwc_dump(hwc_composer_device_1* dev, char *buff, int buff_len)
+{
+    sun4i_hwc_context_t         *ctx = (sun4i_hwc_context_t *)dev;
+    char                        name[32];
+    int                         n = 0;
+
+    if(buff_len <= 0)
+    {
+        return;
+    }
+    buff[0] = 0;
+
+    pthread_mutex_lock(&g_trace.lock);
+    if(g_trace.enable)
+    {
+        n += snprintf(buff + n, buff_len - n, "sun4i hwc latency, buckets are 2^i us\n");
+    }
+    else
+    {
+        n += snprintf(buff + n, buff_len - n, "sun4i hwc latency not traced, set " HWC_TRACE_PROPERTY " to 1\n");
+    }
+    n += hwc_dump_hist(buff + n, buff_len - n, "prepare->set", &g_trace.prepare_to_set);
+    for(int i = 0; i < HWC_MAX_SCREEN && n < buff_len; i++)
+    {
+        sprintf(name, "set->vsync[%d]", i);
+        n += hwc_dump_hist(buff + n, buff_len - n, name, &g_trace.set_to_vsync[i]);
+        if(n < buff_len)
+        {
+            n += snprintf(buff + n, buff_len - n, "  commits[%d] %u, %u in an already used vblank\n",
+                          i, ctx->commit[i].count, ctx->commit[i].same_vblank);
+        }
+        if(n < buff_len)
+        {
+            n += snprintf(buff + n, buff_len - n, "  video layer pool[%d] %d parked, %u reused, %u requested\n",
+                          i, ctx->pool[i].num, ctx->pool[i].hits, ctx->pool[i].misses);
+        }
+        if(n < buff_len)
+        {
+            n += snprintf(buff + n, buff_len - n, "  fb%d targets posted %u, %u copied, %u rejected\n",
+                          i, ctx->display[i].fb.posts, ctx->display[i].fb.copies, ctx->display[i].fb.rejected);
+        }
+        if(n < buff_len)
+        {
+            n += snprintf(buff + n, buff_len - n, "  gles[%d] skipped %u frames\n", i, ctx->dirty[i].skipped);
+        }
+    }
+    if(n < buff_len)
+    {
+        n += snprintf(buff + n, buff_len - n, "  3d hdmi mode switches %u, %u skipped as unchanged\n",
+                      ctx->trd.hdmi_cycles, ctx->trd.hdmi_skipped);
+    }
+    if(n < buff_len && ctx->mailbox.enable)
+    {
+        n += snprintf(buff + n, buff_len - n, "  frame mailbox %d posted, %d coalesced\n",
+                      ctx->mailbox.posted, ctx->mailbox.coalesced);
+    }
+    for(int i = 0; i < g_trace.cmd_num && n < buff_len; i++)
+    {
+        sprintf(name, "ioctl 0x%03x", g_trace.cmd[i].cmd);
+        n += hwc_dump_hist(buff + n, buff_len - n, name, &g_trace.cmd[i].hist);
+        if(g_trace.cmd[i].errors && n < buff_len)
+        {
+            n += snprintf(buff + n, buff_len - n, "    %u failed\n", g_trace.cmd[i].errors);
+        }
+    }
+    pthread_mutex_unlock(&g_trace.lock);
+}
+
 static int hwc_blank(hwc_composer_device_1* a, int b, int c)
 {
     /* STUB */
@@ -2084,9 +3518,12 @@ static int hwc_eventControl(hwc_composer_device_1* dev, int dpy, int event,
 {
     struct hwc_context_t* ctx = (sun4i_hwc_context_t*) dev;
 
+    if (dpy < 0 || dpy >= HWC_MAX_SCREEN)
+        return -EINVAL;
+
     switch (event) {
     case HWC_EVENT_VSYNC:
-        ctx->vsync_enabled = !!enabled;
+        ctx->display[dpy].vsync_enabled = !!enabled;
         return 0;
     }
     return -EINVAL;
@@ -2097,6 +3534,84 @@ static void hwc_registerProcs(struct hwc_composer_device_1* dev,
 {
     struct hwc_context_t* ctx = (struct hwc_context_t*)dev;
     ctx->procs = const_cast<hwc_procs_t *>(procs);
+
+    for (int disp = HWC_DISPLAY_EXTERNAL; disp < HWC_MAX_SCREEN; disp++)
+        hwc_update_hotplug(ctx, disp);
+}
+
+static int hwc_getDisplayConfigs(struct hwc_composer_device_1* dev, int disp,
+        uint32_t* configs, size_t* numConfigs)
+{
+    struct hwc_context_t* ctx = (struct hwc_context_t*)dev;
+
+    if (disp < 0 || disp >= HWC_MAX_SCREEN || !ctx->display[disp].connected)
+        return -EINVAL;
+
+    if (*numConfigs == 0)
+        return 0;
+
+    // the mode is chosen by the display hal, only the active one is exposed
+    configs[0] = 0;
+    *numConfigs = 1;
+
+    return 0;
+}
+
+static int hwc_getDisplayAttributes(struct hwc_composer_device_1* dev, int disp,
+        uint32_t config, const uint32_t* attributes, int32_t* values)
+{
+    struct hwc_context_t* ctx = (struct hwc_context_t*)dev;
+    sun4i_hwc_display_t *display;
+    struct fb_var_screeninfo var;
+    bool has_var;
+    uint32_t width, height;
+
+    if (disp < 0 || disp >= HWC_MAX_SCREEN || !ctx->display[disp].connected || config != 0)
+        return -EINVAL;
+
+    if (ctx->dispfd == 0)
+    {
+        ctx->dispfd = hwc_open_disp();
+        if (ctx->dispfd < 0)
+        {
+            ctx->dispfd = 0;
+            return -ENODEV;
+        }
+    }
+
+    display = &ctx->display[disp];
+    has_var = display->vsync.fd >= 0
+              && ioctl(display->vsync.fd, FBIOGET_VSCREENINFO, &var) == 0
+              && var.width > 0 && var.height > 0;
+
+    hwc_output_size(ctx, disp, &width, &height);
+
+    for (int i = 0; attributes[i] != HWC_DISPLAY_NO_ATTRIBUTE; i++)
+    {
+        switch (attributes[i])
+        {
+        case HWC_DISPLAY_VSYNC_PERIOD:
+            values[i] = display->vsync.mode_period;
+            break;
+        case HWC_DISPLAY_WIDTH:
+            values[i] = width;
+            break;
+        case HWC_DISPLAY_HEIGHT:
+            values[i] = height;
+            break;
+        case HWC_DISPLAY_DPI_X:
+            values[i] = has_var ? (int32_t)(var.xres * 25400 / var.width) : 0;
+            break;
+        case HWC_DISPLAY_DPI_Y:
+            values[i] = has_var ? (int32_t)(var.yres * 25400 / var.height) : 0;
+            break;
+        default:
+            ALOGE("unknown display attribute %u", attributes[i]);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
 }
 
 /*****************************************************************************/
@@ -2113,9 +3628,14 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         /* initialize our state here */
         memset(dev, 0, sizeof(*dev));
 
+        char                    value[PROPERTY_VALUE_MAX];
+
+        property_get(HWC_TRACE_PROPERTY, value, "0");
+        g_trace.enable = (atoi(value) != 0);
+
         /* initialize the procs */
         dev->device.common.tag      = HARDWARE_DEVICE_TAG;
-        dev->device.common.version  = HWC_DEVICE_API_VERSION_1_0;
+        dev->device.common.version  = HWC_DEVICE_API_VERSION_1_1;
         dev->device.common.module   = const_cast<hw_module_t*>(module);
         dev->device.common.close    = hwc_device_close;
 
@@ -2124,13 +3644,59 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         dev->device.blank           = hwc_blank;
         dev->device.eventControl    = hwc_eventControl;
         dev->device.registerProcs   = hwc_registerProcs;
+        dev->device.dump            = hwc_dump;
+        dev->device.getDisplayConfigs    = hwc_getDisplayConfigs;
+        dev->device.getDisplayAttributes = hwc_getDisplayAttributes;
         dev->device.setparameter    = hwc_setparameter;
         dev->device.getparameter    = hwc_getparameter;
 
         *device = &dev->device.common;
 
-        dev->vsync_enabled = false;
-        pthread_create(&dev->vsync_thread, NULL, hwc_vsync_thread, dev);
+        pthread_mutexattr_t     attr;
+
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&dev->video_lock, &attr);
+        pthread_mutex_init(&dev->mode_lock, NULL);
+        pthread_mutex_init(&dev->hdmi_lock, NULL);
+        pthread_mutex_init(&dev->hotplug_lock, NULL);
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            pthread_mutex_init(&dev->commit[i].lock, &attr);
+        }
+        pthread_mutexattr_destroy(&attr);
+        pthread_mutex_init(&dev->frame_queue.lock, NULL);
+        hwc_frame_mailbox_reset(&dev->mailbox);
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            pthread_mutex_init(&dev->output[i].lock, NULL);
+        }
+
+        // have a video layer ready before the first player asks for one
+        dev->dispfd = hwc_open_disp();
+        if(dev->dispfd < 0)
+        {
+            dev->dispfd = 0;
+        }
+        else
+        {
+            hwc_pool_warm(dev, HWC_DISPLAY_PRIMARY);
+        }
+
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            dev->plan[i].video_index        = -1;
+            hwc_dirty_reset(&dev->dirty[i]);
+            dev->display[i].ctx             = dev;
+            dev->display[i].disp            = i;
+            dev->display[i].connected       = (i == HWC_DISPLAY_PRIMARY);
+            dev->display[i].vsync_enabled   = false;
+            hwc_fence_init(&dev->display[i].fence);
+            hwc_fb_open(&dev->display[i]);
+            dev->display[i].vsync_running = (pthread_create(&dev->display[i].vsync_thread, NULL,
+                                                            hwc_vsync_thread, &dev->display[i]) == 0);
+        }
+        hwc_uevent_start(dev);
 
         status = 0;
     }
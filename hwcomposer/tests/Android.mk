@@ -0,0 +1,87 @@
+# Copyright (C) 2008 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+LOCAL_PATH := $(call my-dir)
+
+# host tests, each replaces the driver ioctls it needs in its own binary
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_vsync_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := hwc_vsync_test.cpp ../hwc_vsync.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_CFLAGS := -DLOG_TAG=\"hwc_vsync_test\"
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_STATIC_LIBRARIES := libcutils
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_frame_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := hwc_frame_test.cpp ../hwc_frame.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_CFLAGS := -DLOG_TAG=\"hwc_frame_test\"
+LOCAL_STATIC_LIBRARIES := libcutils
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_dirty_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := hwc_dirty_test.cpp ../hwc_dirty.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_CFLAGS := -DLOG_TAG=\"hwc_dirty_test\"
+include $(BUILD_HOST_NATIVE_TEST)
+
+# includes hwcomposer.cpp to reach the overlay planner
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_plan_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := hwc_plan_test.cpp ../hwc_vsync.cpp ../hwc_frame.cpp ../hwc_dirty.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include $(LOCAL_PATH)/../../gralloc
+LOCAL_CFLAGS := -DLOG_TAG=\"hwc_plan_test\"
+LOCAL_STATIC_LIBRARIES := libcutils libutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_NATIVE_TEST)
+
+# includes hwcomposer.cpp to reach the framebuffer target post
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_fb_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := hwc_fb_test.cpp ../hwc_vsync.cpp ../hwc_frame.cpp ../hwc_dirty.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include $(LOCAL_PATH)/../../gralloc
+LOCAL_CFLAGS := -DLOG_TAG=\"hwc_fb_test\"
+LOCAL_STATIC_LIBRARIES := libcutils libutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_NATIVE_TEST)
+
+# stand-in sunxi disp/g2d/fb driver, LD_PRELOAD it under a HAL built with
+# -DSUNXI_DEV_ROOT=\"/tmp/sunxi_stub\"
+include $(CLEAR_VARS)
+LOCAL_MODULE := libsunxi_stub
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := sunxi_stub.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../../include
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+# replays layer lists such as layers/video_ui.txt through the hwc
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := hwc_bench.cpp sunxi_stub.cpp ../hwcomposer.cpp ../hwc_vsync.cpp ../hwc_frame.cpp ../hwc_dirty.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include $(LOCAL_PATH)/../../gralloc
+LOCAL_CFLAGS := -DLOG_TAG=\"hwc_bench\" -DSUNXI_DEV_ROOT=\"/tmp/sunxi_stub\"
+LOCAL_STATIC_LIBRARIES := libcutils libutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+include $(BUILD_HOST_EXECUTABLE)
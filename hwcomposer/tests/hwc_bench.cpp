@@ -0,0 +1,521 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * replays recorded surfaceflinger layer lists through prepare and set of
+ * the hwc, linked against the sunxi stand-in driver so it runs on a plain
+ * linux box, and reports how long both took.
+ *
+ *     hwc_bench [-r repeat] [-p] [-d] <layers>
+ *
+ * -p paces the frames at the refresh rate instead of running them back to
+ * back, -d prints the hwc dump at the end. a layer file holds:
+ *
+ *     display <disp> <width> <height>
+ *     frame [geometry]
+ *     layer <disp> <format> <crop l t r b> <frame l t r b> [option...]
+ *
+ * a frame takes the layer lines that follow it, geometry marks it
+ * HWC_GEOMETRY_CHANGED. every display gets a framebuffer target on top.
+ * format is rgba8888, rgbx8888, bgra8888, rgb565, yuv420, mbyuv420,
+ * mbyuv422 or a number. options:
+ *
+ *     id=N        buffer set of the layer, layers with the same id share it
+ *     buffers=N   the layer cycles through N buffers, one per frame
+ *     skip        HWC_SKIP_LAYER
+ *     fbmem       buffers are carved from fb0, like gralloc's HW_FB ones
+ *     transform=N
+ *     blend=none|premult|coverage
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+
+#include "gralloc_priv.h"
+#include "sunxi_stub.h"
+
+#define  BENCH_MAX_LAYERS          32
+
+extern hwc_module_t             HAL_MODULE_INFO_SYM;
+
+/*
+ * the host has no sw_sync. the hal handles a timeline it cannot create the
+ * way it does on kernels without sw_sync, it just hands out no fences.
+ */
+extern "C" int sw_sync_timeline_create(void)
+{
+    errno = ENOENT;
+    return -1;
+}
+
+extern "C" int sw_sync_timeline_inc(int fd, unsigned count)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int sw_sync_fence_create(int fd, const char *name, unsigned value)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int sync_wait(int fd, int timeout)
+{
+    errno = EBADF;
+    return -1;
+}
+
+typedef struct bench_layer
+{
+    int                 disp;
+    uint32_t            format;
+    hwc_rect_t          crop;
+    hwc_rect_t          frame;
+    int                 id;
+    int                 buffers;
+    uint32_t            flags;
+    uint32_t            transform;
+    int32_t             blending;
+    bool                fbmem;
+} bench_layer_t;
+
+typedef struct bench_frame
+{
+    bool                geometry;
+    std::vector<bench_layer_t> layers;
+} bench_frame_t;
+
+static int                      g_width[HWC_NUM_DISPLAY_TYPES] = { 1280, 0 };
+static int                      g_height[HWC_NUM_DISPLAY_TYPES] = { 720, 0 };
+static std::map<long, private_handle_t *> g_handles;
+
+static int64_t bench_now(void)
+{
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t bench_format(const char *name)
+{
+    static const struct
+    {
+        const char      *name;
+        uint32_t        format;
+    } formats[] =
+    {
+        { "rgba8888",   HAL_PIXEL_FORMAT_RGBA_8888 },
+        { "rgbx8888",   HAL_PIXEL_FORMAT_RGBX_8888 },
+        { "bgra8888",   HAL_PIXEL_FORMAT_BGRA_8888 },
+        { "rgb565",     HAL_PIXEL_FORMAT_RGB_565 },
+        { "yuv420",     HWC_FORMAT_YUV420PLANAR },
+        { "mbyuv420",   HWC_FORMAT_MBYUV420 },
+        { "mbyuv422",   HWC_FORMAT_MBYUV422 },
+    };
+
+    for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if(!strcmp(name, formats[i].name))
+        {
+            return formats[i].format;
+        }
+    }
+    return strtoul(name, NULL, 0);
+}
+
+static bool bench_load(const char *path, std::vector<bench_frame_t> *frames)
+{
+    FILE                        *file = fopen(path, "r");
+    char                        line[512];
+    int                         lineno = 0;
+
+    if(file == NULL)
+    {
+        fprintf(stderr, "hwc_bench: cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), file))
+    {
+        char                    *tok = strtok(line, " \t\n");
+
+        lineno++;
+        if(tok == NULL || tok[0] == '#')
+        {
+            continue;
+        }
+
+        if(!strcmp(tok, "display"))
+        {
+            int                 disp = atoi(strtok(NULL, " \t\n") ?: "-1");
+            char                *w = strtok(NULL, " \t\n");
+            char                *h = strtok(NULL, " \t\n");
+
+            if(disp < 0 || disp >= HWC_NUM_DISPLAY_TYPES || w == NULL || h == NULL)
+            {
+                break;
+            }
+            g_width[disp]   = atoi(w);
+            g_height[disp]  = atoi(h);
+        }
+        else if(!strcmp(tok, "frame"))
+        {
+            bench_frame_t       frame;
+
+            tok = strtok(NULL, " \t\n");
+            frame.geometry = frames->empty() || (tok && !strcmp(tok, "geometry"));
+            frames->push_back(frame);
+        }
+        else if(!strcmp(tok, "layer") && !frames->empty())
+        {
+            bench_layer_t       layer;
+            char                *v[10];
+            int                 n;
+
+            memset(&layer, 0, sizeof(layer));
+            for(n = 0; n < 10 && (v[n] = strtok(NULL, " \t\n")) != NULL; n++)
+            {
+            }
+            if(n < 10)
+            {
+                break;
+            }
+            layer.disp          = atoi(v[0]);
+            layer.format        = bench_format(v[1]);
+            layer.crop.left     = atoi(v[2]);
+            layer.crop.top      = atoi(v[3]);
+            layer.crop.right    = atoi(v[4]);
+            layer.crop.bottom   = atoi(v[5]);
+            layer.frame.left    = atoi(v[6]);
+            layer.frame.top     = atoi(v[7]);
+            layer.frame.right   = atoi(v[8]);
+            layer.frame.bottom  = atoi(v[9]);
+            layer.id            = frames->back().layers.size();
+            layer.buffers       = 1;
+            layer.blending      = HWC_BLENDING_NONE;
+            if(layer.disp < 0 || layer.disp >= HWC_NUM_DISPLAY_TYPES)
+            {
+                break;
+            }
+
+            while((tok = strtok(NULL, " \t\n")) != NULL)
+            {
+                if(!strncmp(tok, "id=", 3))
+                    layer.id = atoi(tok + 3);
+                else if(!strncmp(tok, "buffers=", 8))
+                    layer.buffers = std::max(1, atoi(tok + 8));
+                else if(!strcmp(tok, "skip"))
+                    layer.flags |= HWC_SKIP_LAYER;
+                else if(!strcmp(tok, "fbmem"))
+                    layer.fbmem = true;
+                else if(!strncmp(tok, "transform=", 10))
+                    layer.transform = atoi(tok + 10);
+                else if(!strcmp(tok, "blend=premult"))
+                    layer.blending = HWC_BLENDING_PREMULT;
+                else if(!strcmp(tok, "blend=coverage"))
+                    layer.blending = HWC_BLENDING_COVERAGE;
+                else if(strcmp(tok, "blend=none"))
+                    break;
+            }
+            if(tok != NULL)
+            {
+                break;
+            }
+            frames->back().layers.push_back(layer);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if(!feof(file))
+    {
+        fprintf(stderr, "hwc_bench: %s:%d: cannot parse\n", path, lineno);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    return !frames->empty();
+}
+
+/* buffers stay mapped below 4G, gralloc handles keep the address in an int */
+static void *bench_map(size_t size)
+{
+    int                         flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void                        *base;
+
+#ifdef MAP_32BIT
+    flags |= MAP_32BIT;
+#endif
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+static private_handle_t *bench_handle(int disp, int id, int index, int w, int h, bool fbmem)
+{
+    long                        key = ((long)disp << 24) | ((long)id << 8) | index;
+    private_handle_t            *hnd = g_handles[key];
+    size_t                      size = (size_t)w * h * 4;
+
+    if(hnd == NULL)
+    {
+        if(fbmem)
+        {
+            // the page of fb0 gralloc would hand out, pages alternate
+            hnd = new private_handle_t(private_handle_t::PRIV_FLAGS_FRAMEBUFFER, size, 0, 0, 0,
+                                       (index & 1) * g_height[0] * g_width[0] * 4);
+        }
+        else
+        {
+            hnd = new private_handle_t(0, size, (int)(intptr_t)bench_map(size), 0, 0, 0);
+        }
+        g_handles[key] = hnd;
+    }
+    return hnd;
+}
+
+/* like surfaceflinger, the composition type is only reset with the geometry */
+static void bench_fill_layer(hwc_layer_1_t *layer, const bench_layer_t *src, int frame, bool geometry)
+{
+    int                         w = src->crop.right > 0 ? src->crop.right : 1;
+    int                         h = src->crop.bottom > 0 ? src->crop.bottom : 1;
+    int32_t                     type = layer->compositionType;
+
+    memset(layer, 0, sizeof(*layer));
+    layer->compositionType  = geometry ? HWC_FRAMEBUFFER : type;
+    layer->flags            = src->flags;
+    layer->format           = src->format;
+    layer->handle           = bench_handle(src->disp, src->id, frame % src->buffers, w, h, src->fbmem);
+    layer->transform        = src->transform;
+    layer->blending         = src->blending;
+    layer->sourceCrop       = src->crop;
+    layer->displayFrame     = src->frame;
+    layer->acquireFenceFd   = -1;
+    layer->releaseFenceFd   = -1;
+}
+
+static void bench_fill_target(hwc_layer_1_t *layer, int disp, int frame)
+{
+    bench_layer_t               target;
+
+    memset(&target, 0, sizeof(target));
+    target.disp         = disp;
+    target.format       = HAL_PIXEL_FORMAT_RGBA_8888;
+    target.crop.right   = g_width[disp];
+    target.crop.bottom  = g_height[disp];
+    target.frame        = target.crop;
+    target.id           = 0xffff;
+    target.buffers      = 2;
+    target.fbmem        = (disp == HWC_DISPLAY_PRIMARY);
+    target.blending     = HWC_BLENDING_PREMULT;
+    bench_fill_layer(layer, &target, frame, true);
+    layer->compositionType = HWC_FRAMEBUFFER_TARGET;
+}
+
+static void bench_invalidate(const struct hwc_procs *procs)
+{
+}
+
+static void bench_vsync(const struct hwc_procs *procs, int disp, int64_t timestamp)
+{
+}
+
+static void bench_hotplug(const struct hwc_procs *procs, int disp, int connected)
+{
+}
+
+static int64_t bench_percentile(std::vector<int64_t> samples, int pct)
+{
+    if(samples.empty())
+    {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[(samples.size() - 1) * pct / 100];
+}
+
+static void bench_report(const char *name, const std::vector<int64_t> &samples)
+{
+    int64_t                     total = 0;
+
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        total += samples[i];
+    }
+    printf("%-8s avg %6lld us  p50 %6lld us  p99 %6lld us  max %6lld us\n", name,
+           (long long)(samples.empty() ? 0 : total / (int64_t)samples.size() / 1000),
+           (long long)(bench_percentile(samples, 50) / 1000),
+           (long long)(bench_percentile(samples, 99) / 1000),
+           (long long)(bench_percentile(samples, 100) / 1000));
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<bench_frame_t>  frames;
+    std::vector<int64_t>        prepare_ns;
+    std::vector<int64_t>        set_ns;
+    hwc_composer_device_1_t     *dev;
+    hwc_procs_t                 procs = { bench_invalidate, bench_vsync, bench_hotplug };
+    hwc_display_contents_1_t    *lists[HWC_NUM_DISPLAY_TYPES];
+    sunxi_stub_stats_t          stats;
+    uint64_t                    overlays = 0;
+    int                         repeat = 1;
+    bool                        pace = false;
+    bool                        dump = false;
+    int                         opt;
+    int                         n = 0;
+
+    while((opt = getopt(argc, argv, "r:pd")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                repeat = std::max(1, atoi(optarg));
+                break;
+            case 'p':
+                pace = true;
+                break;
+            case 'd':
+                dump = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r repeat] [-p] [-d] <layers>\n", argv[0]);
+                return 2;
+        }
+    }
+    if(optind >= argc || !bench_load(argv[optind], &frames))
+    {
+        fprintf(stderr, "usage: %s [-r repeat] [-p] [-d] <layers>\n", argv[0]);
+        return 2;
+    }
+
+    if(HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common, HWC_HARDWARE_COMPOSER,
+                                                 (hw_device_t **)&dev) != 0)
+    {
+        fprintf(stderr, "hwc_bench: cannot open the hwc on %s\n", sunxi_stub_root());
+        return 1;
+    }
+    dev->registerProcs(dev, &procs);
+    sunxi_stub_reset_stats();
+
+    for(int d = 0; d < HWC_NUM_DISPLAY_TYPES; d++)
+    {
+        lists[d] = (hwc_display_contents_1_t *)calloc(1, sizeof(hwc_display_contents_1_t)
+                                                      + (BENCH_MAX_LAYERS + 1) * sizeof(hwc_layer_1_t));
+    }
+
+    for(int r = 0; r < repeat; r++)
+    {
+        for(size_t f = 0; f < frames.size(); f++, n++)
+        {
+            bench_frame_t       *frame = &frames[f];
+            size_t              num = (size_t)(g_width[1] > 0 ? 2 : 1);
+            int64_t             start;
+            int64_t             mid;
+            int64_t             end;
+
+            for(size_t d = 0; d < num; d++)
+            {
+                hwc_display_contents_1_t *list = lists[d];
+                bool            geometry = frame->geometry || (r > 0 && f == 0);
+                size_t          count = 0;
+
+                for(size_t i = 0; i < frame->layers.size() && count < BENCH_MAX_LAYERS; i++)
+                {
+                    if(frame->layers[i].disp == (int)d)
+                    {
+                        bench_fill_layer(&list->hwLayers[count++], &frame->layers[i], n, geometry);
+                    }
+                }
+                bench_fill_target(&list->hwLayers[count++], d, n);
+                list->numHwLayers   = count;
+                list->flags         = geometry ? HWC_GEOMETRY_CHANGED : 0;
+                list->retireFenceFd = -1;
+            }
+
+            start = bench_now();
+            dev->prepare(dev, num, lists);
+            mid = bench_now();
+            dev->set(dev, num, lists);
+            end = bench_now();
+
+            prepare_ns.push_back(mid - start);
+            set_ns.push_back(end - mid);
+            for(size_t d = 0; d < num; d++)
+            {
+                for(size_t i = 0; i < lists[d]->numHwLayers; i++)
+                {
+                    overlays += (lists[d]->hwLayers[i].compositionType == HWC_OVERLAY);
+                    if(lists[d]->hwLayers[i].releaseFenceFd >= 0)
+                    {
+                        close(lists[d]->hwLayers[i].releaseFenceFd);
+                    }
+                }
+                if(lists[d]->retireFenceFd >= 0)
+                {
+                    close(lists[d]->retireFenceFd);
+                }
+            }
+
+            if(pace)
+            {
+                int64_t         period = 1000000000LL / 60;
+                int64_t         left = period - (bench_now() - start);
+
+                if(left > 0)
+                {
+                    usleep(left / 1000);
+                }
+            }
+        }
+    }
+
+    sunxi_stub_stats(&stats);
+    printf("%d frames, %.2f overlay layers per frame\n", n, n ? (double)overlays / n : 0.0);
+    bench_report("prepare", prepare_ns);
+    bench_report("set", set_ns);
+    printf("driver   %u video frames, %u/%u pans, %u g2d ops, layers peak %u/%u, %u denied\n",
+           stats.video_frames, stats.pans[0], stats.pans[1], stats.g2d_ops,
+           stats.layers_peak[0], stats.layers_peak[1], stats.layers_denied);
+
+    if(dump)
+    {
+        char            buff[4096];
+
+        dev->dump(dev, buff, sizeof(buff));
+        printf("%s", buff);
+    }
+
+    dev->common.close(&dev->common);
+
+    return 0;
+}
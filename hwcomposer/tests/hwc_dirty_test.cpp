@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* deciding when gles composition can be skipped */
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "hwc_dirty.h"
+
+#define  TEST_LAYERS               4
+
+class DirtyTest : public ::testing::Test
+{
+protected:
+    hwc_dirty_t                 dirty;
+    hwc_display_contents_1_t    *list;
+    bool                        planned[TEST_LAYERS + 1];
+    int                         buffers[TEST_LAYERS][2];
+
+    /* layer 0 is the video overlay, 1..3 are gles layers, then the target */
+    virtual void SetUp()
+    {
+        list = (hwc_display_contents_1_t *)calloc(1, sizeof(hwc_display_contents_1_t)
+                                                  + (TEST_LAYERS + 1) * sizeof(hwc_layer_1_t));
+        list->numHwLayers = TEST_LAYERS + 1;
+        for(int i = 0; i < TEST_LAYERS; i++)
+        {
+            list->hwLayers[i].handle            = (buffer_handle_t)&buffers[i][0];
+            list->hwLayers[i].compositionType   = HWC_FRAMEBUFFER;
+        }
+        list->hwLayers[TEST_LAYERS].compositionType = HWC_FRAMEBUFFER_TARGET;
+        list->hwLayers[0].compositionType           = HWC_OVERLAY;
+
+        memset(planned, 0, sizeof(planned));
+        planned[0] = true;
+        hwc_dirty_reset(&dirty);
+        dirty.skipped = 0;
+
+        list->flags = HWC_GEOMETRY_CHANGED;
+        EXPECT_FALSE(track());
+        list->flags = 0;
+    }
+
+    virtual void TearDown()
+    {
+        free(list);
+    }
+
+    static bool is_planned(void *data, int index)
+    {
+        return ((bool *)data)[index];
+    }
+
+    bool track()
+    {
+        return hwc_dirty_track(&dirty, list, is_planned, planned);
+    }
+
+    /* the next buffer of a layer's two */
+    void flip(int i)
+    {
+        hwc_layer_1_t           *layer = &list->hwLayers[i];
+
+        layer->handle = (layer->handle == (buffer_handle_t)&buffers[i][0])
+                        ? (buffer_handle_t)&buffers[i][1] : (buffer_handle_t)&buffers[i][0];
+    }
+
+    void expect_gles(int32_t type)
+    {
+        for(int i = 1; i < TEST_LAYERS; i++)
+        {
+            EXPECT_EQ(type, list->hwLayers[i].compositionType) << "layer " << i;
+        }
+        EXPECT_EQ(HWC_OVERLAY, list->hwLayers[0].compositionType);
+        EXPECT_EQ(HWC_FRAMEBUFFER_TARGET, list->hwLayers[TEST_LAYERS].compositionType);
+    }
+};
+
+TEST_F(DirtyTest, SkipsWhenOnlyTheVideoChanged)
+{
+    flip(0);
+    EXPECT_TRUE(track());
+    expect_gles(HWC_OVERLAY);
+
+    flip(0);
+    EXPECT_TRUE(track());
+    EXPECT_EQ(2u, dirty.skipped);
+}
+
+TEST_F(DirtyTest, ComposesWhenAGlesBufferChanged)
+{
+    flip(0);
+    EXPECT_TRUE(track());
+
+    flip(0);
+    flip(2);
+    EXPECT_FALSE(track());
+    expect_gles(HWC_FRAMEBUFFER);
+}
+
+TEST_F(DirtyTest, ComposesWhenNoBufferChanged)
+{
+    // surfaceflinger refreshed for something the handles do not show,
+    // such as an update in place
+    EXPECT_FALSE(track());
+    expect_gles(HWC_FRAMEBUFFER);
+
+    flip(0);
+    EXPECT_TRUE(track());
+    EXPECT_FALSE(track());
+    expect_gles(HWC_FRAMEBUFFER);
+}
+
+TEST_F(DirtyTest, ComposesOnGeometryChange)
+{
+    flip(0);
+    list->flags = HWC_GEOMETRY_CHANGED;
+    EXPECT_FALSE(track());
+    expect_gles(HWC_FRAMEBUFFER);
+}
+
+TEST_F(DirtyTest, ComposesWhenTheLayerCountChanged)
+{
+    flip(0);
+    list->numHwLayers--;
+    EXPECT_FALSE(track());
+}
+
+TEST_F(DirtyTest, ComposesWithColorLayers)
+{
+    // a layer without a buffer, a dim layer fading
+    list->hwLayers[3].handle = NULL;
+    flip(0);
+    EXPECT_FALSE(track());
+    flip(0);
+    EXPECT_FALSE(track());
+    expect_gles(HWC_FRAMEBUFFER);
+}
+
+TEST_F(DirtyTest, SkipLayersComposeAndKeepTheirType)
+{
+    // surfaceflinger flags a skip layer with the geometry and resets its type
+    list->flags = HWC_GEOMETRY_CHANGED;
+    list->hwLayers[2].flags = HWC_SKIP_LAYER;
+    list->hwLayers[2].compositionType = HWC_FRAMEBUFFER;
+    EXPECT_FALSE(track());
+    list->flags = 0;
+
+    for(int i = 0; i < 3; i++)
+    {
+        flip(0);
+        EXPECT_FALSE(track());
+        expect_gles(HWC_FRAMEBUFFER);
+    }
+
+    // whatever type a skip layer has, it is not changed here
+    list->hwLayers[2].compositionType = HWC_OVERLAY;
+    flip(0);
+    EXPECT_FALSE(track());
+    EXPECT_EQ(HWC_OVERLAY, list->hwLayers[2].compositionType);
+}
+
+TEST_F(DirtyTest, NothingToSkipWithoutGlesLayers)
+{
+    for(int i = 1; i < TEST_LAYERS; i++)
+    {
+        planned[i] = true;
+        list->hwLayers[i].compositionType = HWC_OVERLAY;
+    }
+    flip(0);
+    EXPECT_FALSE(track());
+    EXPECT_EQ(0u, dirty.skipped);
+}
+
+TEST_F(DirtyTest, ResetComposesNextFrame)
+{
+    hwc_dirty_reset(&dirty);
+    flip(0);
+    EXPECT_FALSE(track());
+    flip(0);
+    EXPECT_TRUE(track());
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * the framebuffer target post of hwc_set. hwcomposer.cpp is included to
+ * reach it, ioctl is replaced in this binary by an fb whose memory is a
+ * temporary file the display hal can release and request again.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "../hwcomposer.cpp"
+
+static int                      g_fb = -1;
+static uint32_t                 g_width;
+static uint32_t                 g_height;
+static unsigned long            g_start;
+static uint32_t                 g_yoffset;
+static int                      g_pans;
+
+/* the host has no sw_sync, see hwc_bench */
+extern "C" int sw_sync_timeline_create(void)
+{
+    errno = ENOENT;
+    return -1;
+}
+
+extern "C" int sw_sync_timeline_inc(int fd, unsigned count)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int sw_sync_fence_create(int fd, const char *name, unsigned value)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int sync_wait(int fd, int timeout)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list                     ap;
+    void                        *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if(fd != g_fb)
+    {
+        errno = ENOTTY;
+        return -1;
+    }
+
+    switch(request)
+    {
+        case FBIOGET_VSCREENINFO:
+        {
+            struct fb_var_screeninfo    *var = (struct fb_var_screeninfo *)arg;
+
+            // the rgba8888 layout the display hal requests for fbs
+            memset(var, 0, sizeof(*var));
+            var->xres               = g_width;
+            var->yres               = g_height;
+            var->xres_virtual       = g_width;
+            var->yres_virtual       = g_height * 2;
+            var->yoffset            = g_yoffset;
+            var->bits_per_pixel     = 32;
+            var->red.length         = 8;
+            var->green.offset       = 8;
+            var->green.length       = 8;
+            var->blue.offset        = 16;
+            var->blue.length        = 8;
+            var->transp.offset      = 24;
+            var->transp.length      = 8;
+            return 0;
+        }
+        case FBIOGET_FSCREENINFO:
+        {
+            struct fb_fix_screeninfo    *fix = (struct fb_fix_screeninfo *)arg;
+
+            memset(fix, 0, sizeof(*fix));
+            fix->smem_start         = g_start;
+            fix->smem_len           = g_width * g_height * 4 * 2;
+            fix->line_length        = g_width * 4;
+            return 0;
+        }
+        case FBIOPAN_DISPLAY:
+            g_yoffset = ((struct fb_var_screeninfo *)arg)->yoffset;
+            g_pans++;
+            return 0;
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+/* gralloc handles keep the address in an int, see hwc_bench */
+static void *map_low(size_t size)
+{
+    int                         flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void                        *base;
+
+#ifdef MAP_32BIT
+    flags |= MAP_32BIT;
+#endif
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+class FbPostTest : public ::testing::Test
+{
+protected:
+    sun4i_hwc_display_t         display;
+    char                        path[64];
+
+    virtual void SetUp()
+    {
+        strcpy(path, "/tmp/hwc_fb_test.XXXXXX");
+        g_fb        = mkstemp(path);
+        g_yoffset   = 0;
+        g_pans      = 0;
+        ASSERT_GE(g_fb, 0);
+
+        memset(&display, 0, sizeof(display));
+        display.disp    = 1;
+        display.fb.fd   = g_fb;
+    }
+
+    virtual void TearDown()
+    {
+        hwc_fb_unmap(&display.fb);
+        close(g_fb);
+        unlink(path);
+        g_fb = -1;
+    }
+
+    /* what the display hal's release and request of the fb leave behind */
+    void request(uint32_t width, uint32_t height, unsigned long start)
+    {
+        g_width     = width;
+        g_height    = height;
+        g_start     = start;
+        g_yoffset   = 0;
+        ASSERT_EQ(0, ftruncate(g_fb, width * height * 4 * 2));
+    }
+
+    /* a gralloc allocated target of width x height, every pixel set to value */
+    int post(uint32_t width, uint32_t height, uint32_t value)
+    {
+        uint32_t                stride = (width * 4 + 63) & ~63;
+        uint8_t                 *mem = (uint8_t *)map_low(stride * height);
+        private_handle_t        hnd(0, stride * height, (int)(intptr_t)mem, 0, 0, 0);
+        hwc_layer_1_t           layer;
+        int                     ret;
+
+        for(uint32_t y = 0; y < height; y++)
+        {
+            for(uint32_t x = 0; x < width; x++)
+            {
+                ((uint32_t *)(mem + y * stride))[x] = value;
+            }
+        }
+        memset(&layer, 0, sizeof(layer));
+        layer.handle                = &hnd;
+        layer.displayFrame.right    = width;
+        layer.displayFrame.bottom   = height;
+        ret = hwc_fb_post(&display, &layer);
+        munmap(mem, stride * height);
+
+        return ret;
+    }
+
+    /* pixel x, y of the fb page the last post panned to, read through the file */
+    uint32_t shown(uint32_t x, uint32_t y)
+    {
+        uint32_t                pixel = 0;
+
+        EXPECT_EQ((ssize_t)sizeof(pixel),
+                  pread(g_fb, &pixel, sizeof(pixel), ((g_yoffset + y) * g_width + x) * 4));
+        return pixel;
+    }
+};
+
+TEST_F(FbPostTest, CopiesIntoThePageOffScreen)
+{
+    request(16, 8, 0x50000000);
+    ASSERT_EQ(0, post(16, 8, 0x11223344));
+    EXPECT_EQ(8u, g_yoffset);
+    EXPECT_EQ(0x11223344u, shown(0, 0));
+    EXPECT_EQ(0x11223344u, shown(15, 7));
+
+    ASSERT_EQ(0, post(16, 8, 0x55667788));
+    EXPECT_EQ(0u, g_yoffset);
+    EXPECT_EQ(0x55667788u, shown(15, 7));
+    EXPECT_EQ(2, g_pans);
+}
+
+TEST_F(FbPostTest, MapsTheFbAgainWhenItsMemoryMoves)
+{
+    request(16, 8, 0x50000000);
+    ASSERT_EQ(0, post(16, 8, 0x11223344));
+    EXPECT_EQ(0x50000000ul, display.fb.start);
+
+    // a mode switch releases the fb and requests a bigger one somewhere else
+    request(32, 16, 0x58000000);
+    ASSERT_EQ(0, post(32, 16, 0x55667788));
+    EXPECT_EQ(0x58000000ul, display.fb.start);
+    EXPECT_EQ((size_t)32 * 16 * 4 * 2, display.fb.size);
+    EXPECT_EQ(16u, g_yoffset);
+    EXPECT_EQ(0x55667788u, shown(0, 0));
+    EXPECT_EQ(0x55667788u, shown(31, 15));
+
+    // moved without changing size
+    request(32, 16, 0x5c000000);
+    ASSERT_EQ(0, post(32, 16, 0x01020304));
+    EXPECT_EQ(0x5c000000ul, display.fb.start);
+    EXPECT_EQ(0x01020304u, shown(31, 15));
+}
+
+TEST(FbOwnerTest, ExternalDisplayFollowsTheDisplayHalMode)
+{
+    char                        mode[16];
+
+    // unset, single and dual diff leave screen 1 and fb1 to the hwc
+    EXPECT_TRUE(hwc_display_ownedin("", HWC_DISPLAY_EXTERNAL));
+    snprintf(mode, sizeof(mode), "%d 0", DISPLAY_MODE_SINGLE);
+    EXPECT_TRUE(hwc_display_ownedin(mode, HWC_DISPLAY_EXTERNAL));
+    snprintf(mode, sizeof(mode), "%d 0", DISPLAY_MODE_DUALDIFF);
+    EXPECT_TRUE(hwc_display_ownedin(mode, HWC_DISPLAY_EXTERNAL));
+
+    // the display hal mirrors into fb1 itself
+    snprintf(mode, sizeof(mode), "%d 0", DISPLAY_MODE_DUALSAME);
+    EXPECT_FALSE(hwc_display_ownedin(mode, HWC_DISPLAY_EXTERNAL));
+    EXPECT_TRUE(hwc_display_ownedin(mode, HWC_DISPLAY_PRIMARY));
+    snprintf(mode, sizeof(mode), "%d 0", DISPLAY_MODE_DUALLCD);
+    EXPECT_FALSE(hwc_display_ownedin(mode, HWC_DISPLAY_EXTERNAL));
+
+    // fb0 is on screen 1
+    snprintf(mode, sizeof(mode), "%d 1", DISPLAY_MODE_DUALDIFF);
+    EXPECT_FALSE(hwc_display_ownedin(mode, HWC_DISPLAY_EXTERNAL));
+    snprintf(mode, sizeof(mode), "%d 1", DISPLAY_MODE_SINGLE);
+    EXPECT_FALSE(hwc_display_ownedin(mode, HWC_DISPLAY_EXTERNAL));
+}
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* frame queue and mailbox the player feeds video frames through */
+
+#include <pthread.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <cutils/atomic.h>
+
+#include "hwc_frame.h"
+
+class FrameQueueTest : public ::testing::Test
+{
+protected:
+    hwc_frame_queue_t           queue;
+
+    virtual void SetUp()
+    {
+        memset(&queue, 0, sizeof(queue));
+        pthread_mutex_init(&queue.lock, NULL);
+        queue.enable = true;
+    }
+
+    virtual void TearDown()
+    {
+        pthread_mutex_destroy(&queue.lock);
+    }
+
+    /* frames are told apart by their id */
+    void push(uint32_t id, nsecs_t present_time)
+    {
+        hwcqueueframepara_t     para;
+
+        memset(&para, 0, sizeof(para));
+        para.frame.number       = id;
+        para.present_time       = present_time;
+        hwc_frame_queue_push(&queue, &para);
+    }
+
+    int pop(nsecs_t due)
+    {
+        hwcqueueframepara_t     frame;
+
+        if(!hwc_frame_queue_pop(&queue, due, &frame))
+        {
+            return -1;
+        }
+        return (int)frame.frame.number;
+    }
+};
+
+TEST_F(FrameQueueTest, EmptyQueueShowsNothing)
+{
+    EXPECT_EQ(-1, pop(1000));
+    // nothing was shown yet, so nothing is repeated either
+    EXPECT_EQ(0u, queue.repeated);
+}
+
+TEST_F(FrameQueueTest, UntimedFramesAreDueAtOnce)
+{
+    push(1, 0);
+    EXPECT_EQ(1, pop(0));
+    EXPECT_EQ(0, queue.count);
+}
+
+TEST_F(FrameQueueTest, WaitsForPresentTime)
+{
+    push(1, 1000);
+    push(2, 2000);
+
+    EXPECT_EQ(-1, pop(999));
+    EXPECT_EQ(1, pop(1000));
+    EXPECT_EQ(-1, pop(1500));
+    EXPECT_EQ(2, pop(2500));
+    EXPECT_EQ(0u, queue.dropped);
+    EXPECT_EQ(1u, queue.repeated);
+}
+
+TEST_F(FrameQueueTest, LateFramesAreDropped)
+{
+    push(1, 1000);
+    push(2, 2000);
+    push(3, 3000);
+    push(4, 4000);
+
+    // the display stalled, only the newest due frame is shown
+    EXPECT_EQ(3, pop(3500));
+    EXPECT_EQ(2u, queue.dropped);
+    EXPECT_EQ(4, pop(4000));
+}
+
+TEST_F(FrameQueueTest, OverflowDropsOldest)
+{
+    for(int i = 0; i < HWC_FRAME_QUEUE_LEN + 2; i++)
+    {
+        push(i, 10000 + i);
+    }
+
+    EXPECT_EQ(HWC_FRAME_QUEUE_LEN, queue.count);
+    EXPECT_EQ(2u, queue.dropped);
+    EXPECT_EQ(2u, queue.entry[queue.head].frame.number);
+    EXPECT_EQ(HWC_FRAME_QUEUE_LEN + 1, pop(20000));
+}
+
+TEST_F(FrameQueueTest, WrapsAround)
+{
+    for(int i = 0; i < 3 * HWC_FRAME_QUEUE_LEN; i++)
+    {
+        push(i, 1000 * (i + 1));
+        EXPECT_EQ(i, pop(1000 * (i + 1)));
+    }
+    EXPECT_EQ(0u, queue.dropped);
+    EXPECT_EQ(0u, queue.repeated);
+}
+
+TEST_F(FrameQueueTest, ResetForgetsFrames)
+{
+    push(1, 0);
+    EXPECT_EQ(1, pop(0));
+    push(2, 5000);
+    hwc_frame_queue_reset(&queue);
+
+    EXPECT_EQ(0, queue.count);
+    EXPECT_FALSE(queue.shown);
+    EXPECT_EQ(-1, pop(10000));
+    EXPECT_EQ(0u, queue.repeated);
+}
+
+/* every field the player fills carries the id, a torn frame shows up as a mismatch */
+static void fill(libhwclayerpara_t *para, uint32_t id)
+{
+    memset(para, 0, sizeof(*para));
+    para->number            = id;
+    para->top_y             = id;
+    para->top_c             = id;
+    para->uPts              = id;
+    para->src_rect.uWidth   = (signed short)id;
+}
+
+static bool whole(const libhwclayerpara_t *para)
+{
+    return para->top_y == para->number && para->top_c == para->number
+           && para->uPts == para->number && (unsigned short)para->src_rect.uWidth == (para->number & 0xffff);
+}
+
+class FrameMailboxTest : public ::testing::Test
+{
+protected:
+    hwc_frame_mailbox_t         mailbox;
+
+    virtual void SetUp()
+    {
+        memset(&mailbox, 0, sizeof(mailbox));
+        hwc_frame_mailbox_reset(&mailbox);
+        mailbox.enable = 1;
+    }
+
+    void post(uint32_t id)
+    {
+        libhwclayerpara_t       para;
+
+        fill(&para, id);
+        hwc_frame_mailbox_post(&mailbox, &para);
+    }
+
+    int take()
+    {
+        const libhwclayerpara_t *para = hwc_frame_mailbox_take(&mailbox);
+
+        return para ? (int)para->number : -1;
+    }
+};
+
+TEST_F(FrameMailboxTest, EmptyMailboxGivesNothing)
+{
+    EXPECT_EQ(-1, take());
+    EXPECT_EQ(0, mailbox.posted);
+}
+
+TEST_F(FrameMailboxTest, TakesPostedFrameOnce)
+{
+    post(1);
+    EXPECT_EQ(1, take());
+    EXPECT_EQ(-1, take());
+    EXPECT_EQ(1, mailbox.posted);
+    EXPECT_EQ(0, mailbox.coalesced);
+}
+
+TEST_F(FrameMailboxTest, CoalescesToNewest)
+{
+    post(1);
+    post(2);
+    post(3);
+
+    EXPECT_EQ(3, take());
+    EXPECT_EQ(-1, take());
+    EXPECT_EQ(3, mailbox.posted);
+    EXPECT_EQ(2, mailbox.coalesced);
+}
+
+TEST_F(FrameMailboxTest, TakenFrameSurvivesPosts)
+{
+    const libhwclayerpara_t     *para;
+
+    post(1);
+    para = hwc_frame_mailbox_take(&mailbox);
+    ASSERT_TRUE(para != NULL);
+
+    // the player keeps posting while the vsync thread still reads the frame
+    post(2);
+    post(3);
+    post(4);
+    EXPECT_EQ(1u, para->number);
+    EXPECT_TRUE(whole(para));
+    EXPECT_EQ(4, take());
+}
+
+TEST_F(FrameMailboxTest, ResetDropsUnreadFrame)
+{
+    post(1);
+    hwc_frame_mailbox_reset(&mailbox);
+    EXPECT_EQ(-1, take());
+}
+
+struct MailboxStress
+{
+    hwc_frame_mailbox_t         *mailbox;
+    uint32_t                    frames;
+    volatile int32_t            done;
+};
+
+static void *mailbox_player(void *data)
+{
+    MailboxStress               *stress = (MailboxStress *)data;
+    libhwclayerpara_t           para;
+
+    for(uint32_t id = 1; id <= stress->frames; id++)
+    {
+        fill(&para, id);
+        hwc_frame_mailbox_post(stress->mailbox, &para);
+    }
+    android_atomic_release_store(1, &stress->done);
+
+    return NULL;
+}
+
+TEST_F(FrameMailboxTest, PlayerAndVsyncThreadsRace)
+{
+    MailboxStress               stress = { &mailbox, 200000, 0 };
+    pthread_t                   player;
+    uint32_t                    last = 0;
+    uint32_t                    taken = 0;
+    bool                        finished;
+
+    ASSERT_EQ(0, pthread_create(&player, NULL, mailbox_player, &stress));
+    do
+    {
+        const libhwclayerpara_t *para;
+
+        finished = android_atomic_acquire_load(&stress.done);
+        para = hwc_frame_mailbox_take(&mailbox);
+        if(para == NULL)
+        {
+            continue;
+        }
+
+        // frames arrive whole and in order, never twice
+        ASSERT_TRUE(whole(para)) << "frame " << para->number;
+        ASSERT_GT(para->number, last);
+        last = para->number;
+        taken++;
+    } while(!finished);
+    pthread_join(player, NULL);
+
+    if(take() >= 0)
+    {
+        taken++;
+        last = mailbox.slot[mailbox.front].number;
+    }
+
+    // the last frame posted is always delivered, everything else is taken or coalesced
+    EXPECT_EQ(stress.frames, last);
+    EXPECT_EQ((int32_t)stress.frames, mailbox.posted);
+    EXPECT_EQ((int32_t)stress.frames, (int32_t)taken + mailbox.coalesced);
+}
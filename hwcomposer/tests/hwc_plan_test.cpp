@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * the overlay planner of hwc_prepare. hwcomposer.cpp is included to reach
+ * it, prepare itself issues no driver ioctls.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "../hwcomposer.cpp"
+
+#define  TEST_LAYERS               4
+
+/* the host has no sw_sync, see hwc_bench */
+extern "C" int sw_sync_timeline_create(void)
+{
+    errno = ENOENT;
+    return -1;
+}
+
+extern "C" int sw_sync_timeline_inc(int fd, unsigned count)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int sw_sync_fence_create(int fd, const char *name, unsigned value)
+{
+    errno = EBADF;
+    return -1;
+}
+
+extern "C" int sync_wait(int fd, int timeout)
+{
+    errno = EBADF;
+    return -1;
+}
+
+class PlanTest : public ::testing::Test
+{
+protected:
+    sun4i_hwc_context_t         *ctx;
+    hwc_display_contents_1_t    *list[HWC_MAX_SCREEN];
+
+    virtual void SetUp()
+    {
+        ctx = (sun4i_hwc_context_t *)calloc(1, sizeof(sun4i_hwc_context_t));
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            ctx->plan[i].video_index = -1;
+            hwc_dirty_reset(&ctx->dirty[i]);
+
+            list[i] = (hwc_display_contents_1_t *)calloc(1, sizeof(hwc_display_contents_1_t)
+                                                         + (TEST_LAYERS + 1) * sizeof(hwc_layer_1_t));
+            list[i]->flags          = HWC_GEOMETRY_CHANGED;
+            list[i]->numHwLayers    = 1;
+            list[i]->hwLayers[0].compositionType = HWC_FRAMEBUFFER_TARGET;
+        }
+    }
+
+    virtual void TearDown()
+    {
+        for(int i = 0; i < HWC_MAX_SCREEN; i++)
+        {
+            free(list[i]);
+        }
+        free(ctx);
+    }
+
+    /* a layer below the framebuffer target of a display */
+    hwc_layer_1_t *add(int disp, uint32_t format, int l, int t, int r, int b)
+    {
+        hwc_display_contents_1_t    *l1 = list[disp];
+        hwc_layer_1_t               *layer;
+
+        l1->hwLayers[l1->numHwLayers] = l1->hwLayers[l1->numHwLayers - 1];
+        layer = &l1->hwLayers[l1->numHwLayers - 1];
+        memset(layer, 0, sizeof(*layer));
+        layer->format               = format;
+        layer->sourceCrop.right     = r - l;
+        layer->sourceCrop.bottom    = b - t;
+        layer->displayFrame.left    = l;
+        layer->displayFrame.top     = t;
+        layer->displayFrame.right   = r;
+        layer->displayFrame.bottom  = b;
+        layer->acquireFenceFd       = -1;
+        layer->releaseFenceFd       = -1;
+        l1->numHwLayers++;
+
+        return layer;
+    }
+
+    void prepare(size_t num)
+    {
+        hwc_prepare(&ctx->device, num, list);
+    }
+};
+
+TEST_F(PlanTest, OneVideoLayerOnOneScreen)
+{
+    add(0, HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1280, 720);
+    add(0, HWC_FORMAT_YUV420PLANAR, 0, 0, 1280, 720);
+    prepare(1);
+
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(HWC_OVERLAY, list[0]->hwLayers[1].compositionType);
+    EXPECT_EQ(HWC_FRAMEBUFFER_TARGET, list[0]->hwLayers[2].compositionType);
+    EXPECT_EQ(1, ctx->plan[0].video_index);
+    EXPECT_EQ(1, ctx->plan[0].num);
+}
+
+TEST_F(PlanTest, SecondVideoLayerStaysWithGles)
+{
+    // a thumbnail over the full screen video, only the bigger one gets the DE layer
+    add(0, HWC_FORMAT_YUV420PLANAR, 0, 0, 1280, 720);
+    add(0, HWC_FORMAT_MBYUV420, 960, 540, 1280, 720);
+    prepare(1);
+
+    EXPECT_EQ(HWC_OVERLAY, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[0]->hwLayers[1].compositionType);
+    EXPECT_EQ(0, ctx->plan[0].video_index);
+    EXPECT_EQ(1, ctx->plan[0].num);
+    EXPECT_EQ(1, ctx->plan[0].scaler_num);
+
+    // swapped sizes, the choice follows the saving
+    list[0]->hwLayers[0].displayFrame.left = 960;
+    list[0]->hwLayers[0].displayFrame.top  = 540;
+    list[0]->hwLayers[1].displayFrame.left = 0;
+    list[0]->hwLayers[1].displayFrame.top  = 0;
+    prepare(1);
+
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(HWC_OVERLAY, list[0]->hwLayers[1].compositionType);
+    EXPECT_EQ(1, ctx->plan[0].video_index);
+}
+
+TEST_F(PlanTest, SavingCountsTheSourceFetch)
+{
+    hwc_layer_1_t               *small;
+
+    // a 360p video in the bigger window, a 1080p one downscaled into a preview
+    add(0, HWC_FORMAT_YUV420PLANAR, 0, 0, 640, 360);
+    small = add(0, HWC_FORMAT_YUV420PLANAR, 800, 0, 1280, 270);
+    small->sourceCrop.right     = 1920;
+    small->sourceCrop.bottom    = 1080;
+    prepare(1);
+
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(HWC_OVERLAY, list[0]->hwLayers[1].compositionType);
+    EXPECT_EQ(1, ctx->plan[0].video_index);
+    EXPECT_EQ(hwc_layer_savescore(small), ctx->plan[0].saved);
+    EXPECT_EQ(1920u * 1080 * 12 / 8 + 480 * 270 * 4, hwc_layer_savescore(small));
+}
+
+TEST_F(PlanTest, OneVideoLayerAcrossScreens)
+{
+    add(0, HWC_FORMAT_YUV420PLANAR, 0, 0, 800, 480);
+    add(1, HWC_FORMAT_YUV420PLANAR, 0, 0, 1920, 1080);
+    prepare(2);
+
+    EXPECT_EQ(HWC_OVERLAY, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[1]->hwLayers[0].compositionType);
+    EXPECT_EQ(0, ctx->plan[0].video_index);
+    EXPECT_EQ(-1, ctx->plan[1].video_index);
+    EXPECT_EQ(0, ctx->plan[1].num);
+
+    // with no video on the primary the external screen takes it
+    list[0]->hwLayers[0].format = HAL_PIXEL_FORMAT_RGB_565;
+    prepare(2);
+
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(HWC_OVERLAY, list[1]->hwLayers[0].compositionType);
+    EXPECT_EQ(-1, ctx->plan[0].video_index);
+    EXPECT_EQ(0, ctx->plan[1].video_index);
+}
+
+TEST_F(PlanTest, SkippedLayersStayWithGles)
+{
+    hwc_layer_1_t               *layer = add(0, HWC_FORMAT_YUV420PLANAR, 0, 0, 1280, 720);
+
+    layer->flags = HWC_SKIP_LAYER;
+    prepare(1);
+
+    EXPECT_EQ(HWC_FRAMEBUFFER, list[0]->hwLayers[0].compositionType);
+    EXPECT_EQ(-1, ctx->plan[0].video_index);
+}
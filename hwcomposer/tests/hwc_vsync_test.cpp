@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * drives the hwc vsync source from a simulated fb. ioctl, systemTime and
+ * clock_nanosleep are replaced in this binary, so FBIO_WAITFORVSYNC on the
+ * simulated fd returns at the next simulated vblank and time only moves
+ * when the source waits.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <gtest/gtest.h>
+
+#include <fb.h>
+#include <linux/fb.h>
+
+#include "hwc_vsync.h"
+
+static int                      g_fd = -1;
+static nsecs_t                  g_now;
+static nsecs_t                  g_vblank_base;
+static nsecs_t                  g_vblank_period;
+static nsecs_t                  g_wakeup = 50000;   /* wait ioctl return latency */
+static int                      g_skip;             /* vblanks missed before each wakeup */
+static bool                     g_hw_wait = true;
+static int                      g_interrupts;       /* sleeps cut short by a signal */
+static struct fb_var_screeninfo g_var;
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list                     ap;
+    void                        *arg;
+    nsecs_t                     n;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if(fd != g_fd)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    switch(request)
+    {
+        case FBIOGET_VSCREENINFO:
+            memcpy(arg, &g_var, sizeof(g_var));
+            return 0;
+        case FBIO_WAITFORVSYNC:
+            if(!g_hw_wait)
+            {
+                errno = ENOTTY;
+                return -1;
+            }
+            n = (g_now - g_vblank_base) / g_vblank_period + 1 + g_skip;
+            g_now = g_vblank_base + n * g_vblank_period + g_wakeup;
+            return 0;
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+nsecs_t systemTime(int clock)
+{
+    return g_now;
+}
+
+extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
+                               const struct timespec *request,
+                               struct timespec *remain) __THROW
+{
+    nsecs_t                     target = (nsecs_t)request->tv_sec * 1000000000LL + request->tv_nsec;
+
+    // woken early, the error is returned rather than set in errno
+    if(g_interrupts > 0)
+    {
+        g_interrupts--;
+        g_now += 1000000;
+        return EINTR;
+    }
+    if(flags & TIMER_ABSTIME)
+    {
+        if(target > g_now)
+        {
+            g_now = target;
+        }
+    }
+    else
+    {
+        g_now += target;
+    }
+    return 0;
+}
+
+/* a mode of htotal x vtotal at pixclock ps */
+static void set_mode(uint32_t xres, uint32_t yres, uint32_t htotal, uint32_t vtotal, uint32_t pixclock)
+{
+    memset(&g_var, 0, sizeof(g_var));
+    g_var.xres          = xres;
+    g_var.yres          = yres;
+    g_var.right_margin  = htotal - xres;
+    g_var.lower_margin  = vtotal - yres;
+    g_var.pixclock      = pixclock;
+}
+
+static nsecs_t mode_period(void)
+{
+    return (nsecs_t)(g_var.xres + g_var.right_margin) * (g_var.yres + g_var.lower_margin)
+           * g_var.pixclock / 1000;
+}
+
+class VsyncTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        g_fd            = open("/dev/null", O_RDONLY);
+        g_now           = 1000000000LL;
+        g_vblank_base   = g_now + 3000000;
+        g_skip          = 0;
+        g_hw_wait       = true;
+        g_interrupts    = 0;
+        // 1080p60, 148.5 MHz
+        set_mode(1920, 1080, 2200, 1125, 6734);
+        g_vblank_period = mode_period();
+    }
+
+    virtual void TearDown()
+    {
+        close(g_fd);
+        g_fd = -1;
+    }
+
+    /* distance from t to the closest simulated vblank */
+    static nsecs_t phase_error(nsecs_t t)
+    {
+        nsecs_t                 off = (t - g_vblank_base) % g_vblank_period;
+
+        return off > g_vblank_period / 2 ? g_vblank_period - off : off;
+    }
+};
+
+TEST_F(VsyncTest, PeriodFromMode)
+{
+    EXPECT_EQ(mode_period(), hwc_vsync_mode_period(g_fd));
+    EXPECT_EQ(HWC_DEFAULT_VSYNC_PERIOD, hwc_vsync_mode_period(-1));
+
+    g_var.pixclock = 0;
+    EXPECT_EQ(HWC_DEFAULT_VSYNC_PERIOD, hwc_vsync_mode_period(g_fd));
+}
+
+TEST_F(VsyncTest, ReportsHardwareVblanks)
+{
+    hwc_vsync_source_t          src;
+
+    hwc_vsync_init(&src, g_fd);
+    for(int i = 0; i < 10; i++)
+    {
+        nsecs_t                 t = hwc_vsync_wait(&src);
+
+        EXPECT_EQ(g_wakeup, phase_error(t));
+    }
+    EXPECT_TRUE(src.hw_wait);
+}
+
+TEST_F(VsyncTest, TracksHardwareSlowerThanMode)
+{
+    hwc_vsync_source_t          src;
+
+    // the mode says 60 Hz, the tv runs 59.94 Hz
+    g_vblank_period = mode_period() * 1001 / 1000;
+    hwc_vsync_init(&src, g_fd);
+    for(int i = 0; i < 200; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    EXPECT_EQ(mode_period(), src.mode_period);
+    EXPECT_NEAR((double)g_vblank_period, (double)src.period, g_vblank_period / 1000.0);
+}
+
+TEST_F(VsyncTest, FoldsMissedVblanks)
+{
+    hwc_vsync_source_t          src;
+
+    g_vblank_period = mode_period() * 1001 / 1000;
+    hwc_vsync_init(&src, g_fd);
+    g_skip = 2;
+    for(int i = 0; i < 200; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    EXPECT_EQ(mode_period(), src.mode_period);
+    EXPECT_NEAR((double)g_vblank_period, (double)src.period, g_vblank_period / 1000.0);
+}
+
+TEST_F(VsyncTest, RereadsModeOnSwitch)
+{
+    hwc_vsync_source_t          src;
+
+    hwc_vsync_init(&src, g_fd);
+    for(int i = 0; i < 10; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    // 1080p50
+    set_mode(1920, 1080, 2640, 1125, 6734);
+    g_vblank_base   = g_now;
+    g_vblank_period = mode_period();
+    for(int i = 0; i < 10; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    EXPECT_EQ(mode_period(), src.mode_period);
+    EXPECT_NEAR((double)g_vblank_period, (double)src.period, g_vblank_period / 1000.0);
+}
+
+TEST_F(VsyncTest, RequestedResetWaitsForTheVsyncThread)
+{
+    hwc_vsync_source_t          src;
+    nsecs_t                     before;
+
+    g_hw_wait = false;
+    hwc_vsync_init(&src, g_fd);
+    for(int i = 0; i < 10; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+    before = src.period;
+
+    // a hotplug switches to 1080p50 and asks for a reset
+    set_mode(1920, 1080, 2640, 1125, 6734);
+    hwc_vsync_request_reset(&src);
+    EXPECT_EQ(before, src.period);
+
+    hwc_vsync_wait(&src);
+    EXPECT_EQ(mode_period(), src.mode_period);
+    EXPECT_EQ(mode_period(), src.period);
+    EXPECT_EQ(0, src.reset_pending);
+}
+
+TEST_F(VsyncTest, MeasuresPeriodWithoutPixclock)
+{
+    hwc_vsync_source_t          src;
+
+    // 1080p50 on a fb that reports no pixclock
+    set_mode(1920, 1080, 2640, 1125, 6734);
+    g_vblank_period = mode_period();
+    g_var.pixclock  = 0;
+    hwc_vsync_init(&src, g_fd);
+    EXPECT_TRUE(src.measured);
+    EXPECT_EQ(HWC_DEFAULT_VSYNC_PERIOD, src.period);
+    for(int i = 0; i < 200; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    EXPECT_NEAR((double)g_vblank_period, (double)src.mode_period, g_vblank_period / 1000.0);
+    EXPECT_NEAR((double)g_vblank_period, (double)src.period, g_vblank_period / 1000.0);
+}
+
+TEST_F(VsyncTest, MeasuredPeriodIgnoresMissedVblanks)
+{
+    hwc_vsync_source_t          src;
+
+    set_mode(1920, 1080, 2640, 1125, 6734);
+    g_vblank_period = mode_period();
+    g_var.pixclock  = 0;
+    hwc_vsync_init(&src, g_fd);
+
+    // two late wakeups while the period locks
+    hwc_vsync_wait(&src);
+    g_skip = 1;
+    hwc_vsync_wait(&src);
+    hwc_vsync_wait(&src);
+    g_skip = 0;
+    for(int i = 0; i < 200; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    EXPECT_NEAR((double)g_vblank_period, (double)src.mode_period, g_vblank_period / 1000.0);
+    EXPECT_NEAR((double)g_vblank_period, (double)src.period, g_vblank_period / 1000.0);
+}
+
+TEST_F(VsyncTest, SoftwareFallbackStaysInPhase)
+{
+    hwc_vsync_source_t          src;
+    nsecs_t                     last = 0;
+
+    g_vblank_period = mode_period() * 1001 / 1000;
+    hwc_vsync_init(&src, g_fd);
+    for(int i = 0; i < 200; i++)
+    {
+        hwc_vsync_wait(&src);
+    }
+
+    // the driver loses the wait ioctl, ticks are predicted from here on
+    g_hw_wait = false;
+    for(int i = 0; i < 600; i++)
+    {
+        nsecs_t                 t = hwc_vsync_wait(&src);
+
+        EXPECT_GT(t, last);
+        EXPECT_LT(phase_error(t), 1000000) << "tick " << i;
+        last = t;
+    }
+    EXPECT_FALSE(src.hw_wait);
+}
+
+TEST_F(VsyncTest, SoftwareSleepOutlastsSignals)
+{
+    hwc_vsync_source_t          src;
+    nsecs_t                     t;
+
+    hwc_vsync_init(&src, -1);
+    hwc_vsync_wait(&src);
+
+    g_interrupts = 3;
+    t = hwc_vsync_wait(&src);
+    EXPECT_EQ(0, g_interrupts);
+    EXPECT_EQ(t, g_now);
+}
+
+TEST_F(VsyncTest, SoftwareOnlyWithoutFb)
+{
+    hwc_vsync_source_t          src;
+    nsecs_t                     last;
+
+    hwc_vsync_init(&src, -1);
+    EXPECT_FALSE(src.hw_wait);
+    EXPECT_EQ(HWC_DEFAULT_VSYNC_PERIOD, src.period);
+
+    last = hwc_vsync_wait(&src);
+    for(int i = 0; i < 10; i++)
+    {
+        nsecs_t                 t = hwc_vsync_wait(&src);
+
+        EXPECT_EQ(HWC_DEFAULT_VSYNC_PERIOD, t - last);
+        last = t;
+    }
+}
@@ -0,0 +1,700 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * userspace stand-in for the sun4i disp, g2d and fb drivers, to run the
+ * HALs off target. ioctl is replaced in the process, by linking this in or
+ * with LD_PRELOAD=libsunxi_stub.so, and calls on the stand-in nodes
+ *
+ *     <root>/disp  <root>/g2d  <root>/graphics/fb0  <root>/graphics/fb1
+ *
+ * are answered here, every other fd goes to the kernel. the nodes are
+ * plain files created on load, fbN sized to its fb memory so it can be
+ * mapped. a HAL reaches them when built with -DSUNXI_DEV_ROOT=\"<root>\".
+ *
+ * the model keeps what the HALs read back: layer handles against a per
+ * screen limit, layer parameters, output type and hdmi mode, the fb pan
+ * offset and a vblank grid for FBIO_WAITFORVSYNC. the rest of the disp
+ * command set succeeds without doing anything. g2d blits take the time the
+ * configured throughput gives them, no pixels are moved.
+ *
+ * environment:
+ *     SUNXI_STUB_ROOT         node directory, default /tmp/sunxi_stub
+ *     SUNXI_STUB_LATENCY_US   time each disp and fb ioctl takes, default 0
+ *     SUNXI_STUB_G2D_BPUS     g2d bytes per us, 0 for instant, default 800
+ *     SUNXI_STUB_LAYERS       DE layers per screen, the fb holds one, default 4
+ *     SUNXI_STUB_SCREEN0      lcd WxH@Hz[/bpp], default 1280x720@60/32
+ *     SUNXI_STUB_SCREEN1      hdmi WxH@Hz[/bpp], no hdmi head when unset
+ *     SUNXI_STUB_STATS        print the command counts at exit when set
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <fb.h>
+#include <linux/fb.h>
+#include <sunxi_disp_ioctl.h>
+#include <g2d_driver.h>
+
+#include "sunxi_stub.h"
+
+#define  STUB_DISP                 0
+#define  STUB_G2D                  1
+#define  STUB_FB                   2
+#define  STUB_NODES                4       /* disp, g2d, fb0, fb1 */
+#define  STUB_LAYER_HDL_BASE       100
+#define  STUB_G2D_MEM_NUM          16
+#define  STUB_G2D_MEM_BASE         0x60000000
+#define  STUB_FB_MEM_BASE          0x50000000
+
+typedef struct stub_layer
+{
+    bool                used;
+    bool                open;
+    __disp_layer_info_t para;
+} stub_layer_t;
+
+typedef struct stub_screen
+{
+    __disp_output_type_t output;
+    uint32_t            width;
+    uint32_t            height;
+    uint32_t            hz;
+    uint32_t            bpp;            /* 32 xrgb8888, 16 rgb565 */
+    int                 hdmi_mode;
+    bool                hdmi_on;
+    uint32_t            yoffset;
+    int                 frame_id;
+    stub_layer_t        layer[SUNXI_STUB_MAX_LAYERS];
+} stub_screen_t;
+
+static struct
+{
+    pthread_mutex_t     lock;
+    char                root[PATH_MAX / 2];
+    dev_t               dev[STUB_NODES];
+    ino_t               ino[STUB_NODES];
+    int64_t             latency;
+    int64_t             g2d_bpus;
+    int                 layers;
+    stub_screen_t       screen[2];
+    int                 g2d_mem;
+    sunxi_stub_stats_t  stats;
+} g_stub = { PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_once_t           g_stub_once = PTHREAD_ONCE_INIT;
+
+static int64_t stub_now(void)
+{
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void stub_sleep(int64_t ns)
+{
+    struct timespec             ts;
+
+    if(ns <= 0)
+    {
+        return;
+    }
+    ts.tv_sec   = ns / 1000000000LL;
+    ts.tv_nsec  = ns % 1000000000LL;
+    while(nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    {
+    }
+}
+
+static long stub_env(const char *name, long def)
+{
+    const char                  *value = getenv(name);
+
+    return value ? strtol(value, NULL, 0) : def;
+}
+
+static bool stub_env_mode(const char *name, const char *def, stub_screen_t *screen)
+{
+    const char                  *value = getenv(name);
+
+    if(value == NULL)
+    {
+        value = def;
+    }
+    if(value == NULL)
+    {
+        return false;
+    }
+
+    screen->hz  = 60;
+    screen->bpp = 32;
+    return sscanf(value, "%ux%u@%u/%u", &screen->width, &screen->height, &screen->hz, &screen->bpp) >= 2
+           && screen->width > 0 && screen->height > 0 && screen->hz > 0
+           && (screen->bpp == 16 || screen->bpp == 32);
+}
+
+static size_t stub_fb_size(const stub_screen_t *screen)
+{
+    // double buffered, like the fb gralloc pans between
+    return (size_t)screen->width * screen->height * (screen->bpp / 8) * 2;
+}
+
+static void stub_node(int node, const char *name, size_t size)
+{
+    struct stat                 st;
+    char                        path[PATH_MAX];
+    int                         fd;
+
+    snprintf(path, sizeof(path), "%s/%s", g_stub.root, name);
+    fd = open(path, O_RDWR | O_CREAT, 0666);
+    if(fd < 0)
+    {
+        fprintf(stderr, "sunxi_stub: cannot create %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if(size && ftruncate(fd, size) < 0)
+    {
+        fprintf(stderr, "sunxi_stub: cannot size %s: %s\n", path, strerror(errno));
+    }
+    if(fstat(fd, &st) == 0)
+    {
+        g_stub.dev[node] = st.st_dev;
+        g_stub.ino[node] = st.st_ino;
+    }
+    close(fd);
+}
+
+static void stub_dump_stats(void)
+{
+    static const char           *driver[] = { "disp", "g2d", "fb" };
+
+    fprintf(stderr, "sunxi_stub: layers peak %u/%u, %u denied, %u video frames, %u/%u pans, %u g2d ops\n",
+            g_stub.stats.layers_peak[0], g_stub.stats.layers_peak[1], g_stub.stats.layers_denied,
+            g_stub.stats.video_frames, g_stub.stats.pans[0], g_stub.stats.pans[1], g_stub.stats.g2d_ops);
+    for(int i = 0; i < g_stub.stats.cmd_num; i++)
+    {
+        sunxi_stub_cmd_t        *cmd = &g_stub.stats.cmd[i];
+
+        fprintf(stderr, "sunxi_stub: %-4s 0x%04lx %8u calls %6u failed\n",
+                driver[cmd->driver], cmd->cmd, cmd->count, cmd->errors);
+    }
+}
+
+static void stub_init(void)
+{
+    const char                  *root = getenv("SUNXI_STUB_ROOT");
+    char                        path[PATH_MAX];
+
+    snprintf(g_stub.root, sizeof(g_stub.root), "%s", root ? root : "/tmp/sunxi_stub");
+    g_stub.latency  = stub_env("SUNXI_STUB_LATENCY_US", 0) * 1000;
+    g_stub.g2d_bpus = stub_env("SUNXI_STUB_G2D_BPUS", 800);
+    g_stub.layers   = stub_env("SUNXI_STUB_LAYERS", 4);
+    if(g_stub.layers < 1 || g_stub.layers > SUNXI_STUB_MAX_LAYERS)
+    {
+        g_stub.layers = 4;
+    }
+
+    if(stub_env_mode("SUNXI_STUB_SCREEN0", "1280x720@60", &g_stub.screen[0]))
+    {
+        g_stub.screen[0].output = DISP_OUTPUT_TYPE_LCD;
+    }
+    if(stub_env_mode("SUNXI_STUB_SCREEN1", NULL, &g_stub.screen[1]))
+    {
+        g_stub.screen[1].output     = DISP_OUTPUT_TYPE_HDMI;
+        g_stub.screen[1].hdmi_on    = true;
+        g_stub.screen[1].hdmi_mode  = g_stub.screen[1].height >= 1080 ? DISP_TV_MOD_1080P_60HZ : DISP_TV_MOD_720P_60HZ;
+    }
+
+    // the fb of each screen holds its first layer
+    for(int i = 0; i < 2; i++)
+    {
+        if(g_stub.screen[i].output != DISP_OUTPUT_TYPE_NONE)
+        {
+            g_stub.screen[i].layer[0].used  = true;
+            g_stub.screen[i].layer[0].open  = true;
+            g_stub.stats.layers_used[i]     = 1;
+            g_stub.stats.layers_peak[i]     = 1;
+        }
+    }
+
+    mkdir(g_stub.root, 0777);
+    snprintf(path, sizeof(path), "%s/graphics", g_stub.root);
+    mkdir(path, 0777);
+    stub_node(0, "disp", 0);
+    stub_node(1, "g2d", 0);
+    stub_node(2, "graphics/fb0", stub_fb_size(&g_stub.screen[0]));
+    stub_node(3, "graphics/fb1", stub_fb_size(&g_stub.screen[1]));
+
+    if(getenv("SUNXI_STUB_STATS"))
+    {
+        atexit(stub_dump_stats);
+    }
+}
+
+/* the nodes have to exist before the first open, not just the first ioctl */
+__attribute__((constructor)) static void stub_load(void)
+{
+    pthread_once(&g_stub_once, stub_init);
+}
+
+/* node index of a stand-in fd, -1 for anything else */
+static int stub_node_of(int fd)
+{
+    struct stat                 st;
+
+    if(fstat(fd, &st) < 0)
+    {
+        return -1;
+    }
+    for(int i = 0; i < STUB_NODES; i++)
+    {
+        if(g_stub.ino[i] && st.st_ino == g_stub.ino[i] && st.st_dev == g_stub.dev[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void stub_count(int driver, unsigned long request, int ret)
+{
+    sunxi_stub_stats_t          *stats = &g_stub.stats;
+    sunxi_stub_cmd_t            *cmd = NULL;
+
+    for(int i = 0; i < stats->cmd_num; i++)
+    {
+        if(stats->cmd[i].driver == driver && stats->cmd[i].cmd == request)
+        {
+            cmd = &stats->cmd[i];
+            break;
+        }
+    }
+    if(cmd == NULL)
+    {
+        if(stats->cmd_num == SUNXI_STUB_CMD_SLOTS)
+        {
+            return;
+        }
+        cmd = &stats->cmd[stats->cmd_num++];
+        cmd->driver = driver;
+        cmd->cmd    = request;
+    }
+    cmd->count++;
+    if(ret == -1)
+    {
+        cmd->errors++;
+    }
+}
+
+static stub_screen_t *stub_screen(unsigned long sel)
+{
+    return sel < 2 ? &g_stub.screen[sel] : NULL;
+}
+
+static stub_layer_t *stub_layer(unsigned long sel, unsigned long hdl)
+{
+    stub_screen_t               *screen = stub_screen(sel);
+    unsigned long               index = hdl - STUB_LAYER_HDL_BASE;
+
+    if(screen == NULL || hdl < STUB_LAYER_HDL_BASE || index >= (unsigned long)g_stub.layers
+       || !screen->layer[index].used)
+    {
+        return NULL;
+    }
+    return &screen->layer[index];
+}
+
+static void stub_hdmi_mode(stub_screen_t *screen, int mode)
+{
+    screen->hdmi_mode = mode;
+    switch(mode)
+    {
+        case DISP_TV_MOD_720P_50HZ:
+        case DISP_TV_MOD_720P_60HZ:
+        case DISP_TV_MOD_720P_50HZ_3D_FP:
+        case DISP_TV_MOD_720P_60HZ_3D_FP:
+            screen->width   = 1280;
+            screen->height  = 720;
+            break;
+        case DISP_TV_MOD_1080I_50HZ:
+        case DISP_TV_MOD_1080I_60HZ:
+        case DISP_TV_MOD_1080P_24HZ:
+        case DISP_TV_MOD_1080P_50HZ:
+        case DISP_TV_MOD_1080P_60HZ:
+        case DISP_TV_MOD_1080P_24HZ_3D_FP:
+            screen->width   = 1920;
+            screen->height  = 1080;
+            break;
+        default:
+            break;
+    }
+    // a new mode gets an fb of its size
+    stub_node(screen == &g_stub.screen[0] ? 2 : 3, screen == &g_stub.screen[0] ? "graphics/fb0" : "graphics/fb1",
+              stub_fb_size(screen));
+    switch(mode)
+    {
+        case DISP_TV_MOD_720P_50HZ:
+        case DISP_TV_MOD_720P_50HZ_3D_FP:
+        case DISP_TV_MOD_1080I_50HZ:
+        case DISP_TV_MOD_1080P_50HZ:
+            screen->hz = 50;
+            break;
+        case DISP_TV_MOD_1080P_24HZ:
+        case DISP_TV_MOD_1080P_24HZ_3D_FP:
+            screen->hz = 24;
+            break;
+        default:
+            screen->hz = 60;
+            break;
+    }
+}
+
+static int stub_disp(unsigned long request, unsigned long *args)
+{
+    stub_screen_t               *screen;
+    stub_layer_t                *layer;
+
+    if(request == DISP_CMD_VERSION)
+    {
+        return SUNXI_DISP_VERSION;
+    }
+
+    screen = args ? stub_screen(args[0]) : NULL;
+    if(screen == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch(request)
+    {
+        case DISP_CMD_SCN_GET_WIDTH:
+            return screen->output != DISP_OUTPUT_TYPE_NONE ? screen->width : 0;
+        case DISP_CMD_SCN_GET_HEIGHT:
+            return screen->output != DISP_OUTPUT_TYPE_NONE ? screen->height : 0;
+        case DISP_CMD_GET_OUTPUT_TYPE:
+            return screen->output == DISP_OUTPUT_TYPE_HDMI && !screen->hdmi_on ? DISP_OUTPUT_TYPE_NONE : screen->output;
+        case DISP_CMD_HDMI_GET_MODE:
+            return screen->hdmi_mode;
+        case DISP_CMD_HDMI_SUPPORT_MODE:
+            return screen->output == DISP_OUTPUT_TYPE_HDMI && args[1] <= DISP_TV_MOD_1080P_60HZ;
+        case DISP_CMD_HDMI_GET_HPD_STATUS:
+            return screen->output == DISP_OUTPUT_TYPE_HDMI;
+        case DISP_CMD_HDMI_SET_MODE:
+            stub_hdmi_mode(screen, args[1]);
+            return 0;
+        case DISP_CMD_HDMI_ON:
+            screen->hdmi_on = true;
+            return 0;
+        case DISP_CMD_HDMI_OFF:
+            screen->hdmi_on = false;
+            return 0;
+        case DISP_CMD_TV_GET_MODE:
+            return 0;
+
+        case DISP_CMD_LAYER_REQUEST:
+            for(int i = 0; i < g_stub.layers; i++)
+            {
+                if(!screen->layer[i].used)
+                {
+                    memset(&screen->layer[i], 0, sizeof(stub_layer_t));
+                    screen->layer[i].used = true;
+                    g_stub.stats.layers_used[args[0]]++;
+                    if(g_stub.stats.layers_used[args[0]] > g_stub.stats.layers_peak[args[0]])
+                    {
+                        g_stub.stats.layers_peak[args[0]] = g_stub.stats.layers_used[args[0]];
+                    }
+                    return STUB_LAYER_HDL_BASE + i;
+                }
+            }
+            g_stub.stats.layers_denied++;
+            return 0;
+        default:
+            break;
+    }
+
+    // layer and video commands name a layer in args[1], the rest just succeed
+    if(!(request > DISP_CMD_LAYER_REQUEST && request < DISP_CMD_SCALER_REQUEST)
+       && !(request >= DISP_CMD_VIDEO_START && request < DISP_CMD_LCD_ON))
+    {
+        return 0;
+    }
+    layer = stub_layer(args[0], args[1]);
+    if(layer == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch(request)
+    {
+        case DISP_CMD_LAYER_RELEASE:
+            layer->used = false;
+            g_stub.stats.layers_used[args[0]]--;
+            return 0;
+        case DISP_CMD_LAYER_OPEN:
+            layer->open = true;
+            return 0;
+        case DISP_CMD_LAYER_CLOSE:
+            layer->open = false;
+            return 0;
+        case DISP_CMD_LAYER_SET_PARA:
+            memcpy(&layer->para, (void *)args[2], sizeof(__disp_layer_info_t));
+            return 0;
+        case DISP_CMD_LAYER_GET_PARA:
+            memcpy((void *)args[2], &layer->para, sizeof(__disp_layer_info_t));
+            return 0;
+        case DISP_CMD_VIDEO_SET_FB:
+            screen->frame_id = ((__disp_video_fb_t *)args[2])->id;
+            g_stub.stats.video_frames++;
+            return 0;
+        case DISP_CMD_VIDEO_GET_FRAME_ID:
+            return screen->frame_id;
+        default:
+            return 0;
+    }
+}
+
+static int64_t stub_g2d_cost(uint64_t bytes)
+{
+    g_stub.stats.g2d_ops++;
+    g_stub.stats.g2d_bytes += bytes;
+    return g_stub.g2d_bpus > 0 ? (int64_t)(bytes * 1000 / g_stub.g2d_bpus) : 0;
+}
+
+static int stub_g2d(unsigned long request, void *arg, int64_t *delay)
+{
+    switch(request)
+    {
+        case G2D_CMD_MEM_REQUEST:
+            if(g_stub.g2d_mem == STUB_G2D_MEM_NUM)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+            return g_stub.g2d_mem++;
+        case G2D_CMD_MEM_GETADR:
+            return STUB_G2D_MEM_BASE + (unsigned long)arg * 0x01000000;
+        case G2D_CMD_BITBLT:
+        {
+            g2d_blt             *blt = (g2d_blt *)arg;
+
+            // source read, destination read for blending and written back
+            *delay = stub_g2d_cost((uint64_t)blt->src_rect.w * blt->src_rect.h * 4 * 3);
+            return 0;
+        }
+        case G2D_CMD_STRETCHBLT:
+        {
+            g2d_stretchblt      *blt = (g2d_stretchblt *)arg;
+
+            *delay = stub_g2d_cost((uint64_t)blt->src_rect.w * blt->src_rect.h * 4
+                                   + (uint64_t)blt->dst_rect.w * blt->dst_rect.h * 4 * 2);
+            return 0;
+        }
+        case G2D_CMD_FILLRECT:
+        {
+            g2d_fillrect        *fill = (g2d_fillrect *)arg;
+
+            *delay = stub_g2d_cost((uint64_t)fill->dst_rect.w * fill->dst_rect.h * 4);
+            return 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+static int stub_fb(int fb, unsigned long request, void *arg, int64_t *delay)
+{
+    stub_screen_t               *screen = &g_stub.screen[fb];
+    struct fb_var_screeninfo    *var;
+    struct fb_fix_screeninfo    *fix;
+    uint64_t                    htotal;
+    uint64_t                    vtotal;
+    int64_t                     period;
+    int64_t                     now;
+
+    if(screen->output == DISP_OUTPUT_TYPE_NONE && request != FBIOGET_LAYER_HDL_0 && request != FBIOGET_LAYER_HDL_1)
+    {
+        errno = ENODEV;
+        return -1;
+    }
+
+    switch(request)
+    {
+        case FBIOGET_VSCREENINFO:
+            // blanking of about a tenth keeps the mode period at the refresh rate
+            var     = (struct fb_var_screeninfo *)arg;
+            htotal  = screen->width + screen->width / 10;
+            vtotal  = screen->height + screen->height / 20;
+            memset(var, 0, sizeof(*var));
+            var->xres           = screen->width;
+            var->yres           = screen->height;
+            var->xres_virtual   = screen->width;
+            var->yres_virtual   = screen->height * 2;
+            var->yoffset        = screen->yoffset;
+            var->bits_per_pixel = screen->bpp;
+            if(screen->bpp == 16)
+            {
+                var->red.offset     = 11;
+                var->red.length     = 5;
+                var->green.offset   = 5;
+                var->green.length   = 6;
+                var->blue.length    = 5;
+            }
+            else
+            {
+                var->red.offset     = 16;
+                var->red.length     = 8;
+                var->green.offset   = 8;
+                var->green.length   = 8;
+                var->blue.length    = 8;
+            }
+            var->right_margin   = htotal - screen->width;
+            var->lower_margin   = vtotal - screen->height;
+            var->pixclock       = (uint32_t)(1000000000000ULL / (htotal * vtotal * screen->hz));
+            return 0;
+        case FBIOGET_FSCREENINFO:
+            fix = (struct fb_fix_screeninfo *)arg;
+            memset(fix, 0, sizeof(*fix));
+            fix->smem_start     = STUB_FB_MEM_BASE + fb * 0x04000000;
+            fix->smem_len       = stub_fb_size(screen);
+            fix->line_length    = screen->width * (screen->bpp / 8);
+            return 0;
+        case FBIOPAN_DISPLAY:
+        case FBIOPUT_VSCREENINFO:
+            var = (struct fb_var_screeninfo *)arg;
+            if(var->yoffset + screen->height > screen->height * 2)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            screen->yoffset = var->yoffset;
+            g_stub.stats.pans[fb]++;
+            return 0;
+        case FBIO_WAITFORVSYNC:
+            period  = 1000000000LL / screen->hz;
+            now     = stub_now();
+            *delay  = (now / period + 1) * period - now;
+            return 0;
+        case FBIOGET_LAYER_HDL_0:
+        case FBIOGET_LAYER_HDL_1:
+            *(unsigned long *)arg = STUB_LAYER_HDL_BASE;
+            return 0;
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list                     ap;
+    void                        *arg;
+    int64_t                     delay = 0;
+    int                         node;
+    int                         driver;
+    int                         ret;
+    int                         err;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    pthread_once(&g_stub_once, stub_init);
+
+    node = stub_node_of(fd);
+    if(node < 0)
+    {
+        return syscall(SYS_ioctl, fd, request, arg);
+    }
+
+    pthread_mutex_lock(&g_stub.lock);
+    errno = 0;
+    switch(node)
+    {
+        case 0:
+            driver  = STUB_DISP;
+            ret     = stub_disp(request, (unsigned long *)arg);
+            break;
+        case 1:
+            driver  = STUB_G2D;
+            ret     = stub_g2d(request, arg, &delay);
+            break;
+        default:
+            driver  = STUB_FB;
+            ret     = stub_fb(node - 2, request, arg, &delay);
+            break;
+    }
+    if(driver != STUB_G2D && request != FBIO_WAITFORVSYNC)
+    {
+        delay += g_stub.latency;
+    }
+    stub_count(driver, request, ret);
+    if(request != FBIO_WAITFORVSYNC)
+    {
+        g_stub.stats.ioctl_ns += delay;
+    }
+    err = errno;
+    pthread_mutex_unlock(&g_stub.lock);
+
+    stub_sleep(delay);
+
+    errno = err;
+    return ret;
+}
+
+extern "C" void sunxi_stub_stats(sunxi_stub_stats_t *stats)
+{
+    pthread_once(&g_stub_once, stub_init);
+    pthread_mutex_lock(&g_stub.lock);
+    *stats = g_stub.stats;
+    pthread_mutex_unlock(&g_stub.lock);
+}
+
+extern "C" void sunxi_stub_reset_stats(void)
+{
+    pthread_once(&g_stub_once, stub_init);
+    pthread_mutex_lock(&g_stub.lock);
+    g_stub.stats.cmd_num        = 0;
+    g_stub.stats.layers_denied  = 0;
+    g_stub.stats.video_frames   = 0;
+    g_stub.stats.pans[0]        = 0;
+    g_stub.stats.pans[1]        = 0;
+    g_stub.stats.g2d_ops        = 0;
+    g_stub.stats.g2d_bytes      = 0;
+    g_stub.stats.ioctl_ns       = 0;
+    g_stub.stats.layers_peak[0] = g_stub.stats.layers_used[0];
+    g_stub.stats.layers_peak[1] = g_stub.stats.layers_used[1];
+    pthread_mutex_unlock(&g_stub.lock);
+}
+
+extern "C" const char *sunxi_stub_root(void)
+{
+    pthread_once(&g_stub_once, stub_init);
+    return g_stub.root;
+}
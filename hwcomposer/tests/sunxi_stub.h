@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * userspace stand-in for the sun4i disp, g2d and fb drivers, see
+ * sunxi_stub.cpp. these let a test or benchmark linked against it read
+ * back what the driver was asked to do.
+ */
+
+#ifndef __SUNXI_STUB_H__
+#define __SUNXI_STUB_H__
+
+#include <stdint.h>
+
+#define  SUNXI_STUB_MAX_LAYERS     8
+#define  SUNXI_STUB_CMD_SLOTS      128
+
+typedef struct sunxi_stub_cmd
+{
+    int                 driver;         /* 0 disp, 1 g2d, 2 fb */
+    unsigned long       cmd;
+    uint32_t            count;
+    uint32_t            errors;
+} sunxi_stub_cmd_t;
+
+typedef struct sunxi_stub_stats
+{
+    sunxi_stub_cmd_t    cmd[SUNXI_STUB_CMD_SLOTS];
+    int                 cmd_num;
+    uint32_t            layers_used[2];     /* DE layers requested now */
+    uint32_t            layers_peak[2];
+    uint32_t            layers_denied;      /* requests past the layer limit */
+    uint32_t            video_frames;       /* DISP_CMD_VIDEO_SET_FB */
+    uint32_t            pans[2];
+    uint32_t            g2d_ops;
+    uint64_t            g2d_bytes;
+    int64_t             ioctl_ns;           /* time spent in modelled latency */
+} sunxi_stub_stats_t;
+
+extern "C" void sunxi_stub_stats(sunxi_stub_stats_t *stats);
+extern "C" void sunxi_stub_reset_stats(void);
+extern "C" const char *sunxi_stub_root(void);
+
+#endif
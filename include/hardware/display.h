@@ -35,6 +35,13 @@ __BEGIN_DECLS
  */
 #define DISPLAY_HARDWARE_DISPLAY0 "display0"
 
+/**
+ * The output mode and master screen as "<DISPLAY_MODE_*> <master>", set by
+ * the display hal on every change. The hwc reads it to know whether fb1 and
+ * screen 1 are its own to drive, unset reads as single mode on screen 0.
+ */
+#define DISPLAY_MODE_PROPERTY "sys.display.mode"
+
 enum
 {
     DISPLAY_FALSE = 0,
@@ -152,7 +159,10 @@ enum
 	DISPLAY_APP_WIDTH               = 9,
 	DISPLAY_APP_HEIGHT              = 10,
 	DISPLAY_VALID_WIDTH            = 11,
-	DISPLAY_VALID_HEIGHT           = 12
+	DISPLAY_VALID_HEIGHT           = 12,
+	DISPLAY_MIRROR_FRAMES          = 13,   /* dual same frames mirrored */
+	DISPLAY_MIRROR_DROPPED         = 14,   /* primary frames never mirrored */
+	DISPLAY_MIRROR_LATENCY         = 15    /* average us, primary vsync to secondary latch */
 };
 
 
@@ -168,6 +168,12 @@ typedef struct tag_LIBHWCLAYERPARA
     unsigned char  pre_frame_valid;
 } libhwclayerpara_t;
 
+typedef struct tag_HWCQueueFramePara
+{
+    libhwclayerpara_t           frame;
+    int64_t                     present_time;       // CLOCK_MONOTONIC ns the frame is due at, 0 for the next vsync
+} hwcqueueframepara_t;
+
 /*****************************************************************************/
 /* End Allwinner additions */
 
@@ -177,6 +183,7 @@ enum {
     HWC_LAYER_ROTATION_DEG  	= 1,
     /* enable or disable dithering */
     HWC_LAYER_DITHER        	= 3,
+    /* display mode of screen <value> changed behind hwc's back */
     HWC_LAYER_SETMODE = 9,
     /* transformation applied (this is a superset of COPYBIT_ROTATION_DEG) */
     HWC_LAYER_SETINITPARA,
@@ -212,6 +219,16 @@ enum {
 
     HWC_LAYER_SETBLACKEXTEN,
     HWC_LAYER_GETBLACKEXTEN,
+
+    /* queue frames to be shown on the vsync matching their timestamp */
+    HWC_LAYER_SETFRAMEQUEUE,
+    HWC_LAYER_QUEUEFRAME,
+    /* frame queue statistics, for getParameter() */
+    HWC_LAYER_GETDROPPEDFRAMES,
+    HWC_LAYER_GETREPEATEDFRAMES,
+    /* hand SETFRAMEPARA frames to the vsync thread, only the newest is shown */
+    HWC_LAYER_SETFRAMEMAILBOX,
+    HWC_LAYER_GETCOALESCEDFRAMES,
 };
 
 /* possible overlay formats */
@@ -27,6 +27,11 @@
 #include <hardware/lights.h>
 #include <sunxi_disp_ioctl.h>
 
+/* device node root, point it at stand-in nodes to run off target */
+#ifndef SUNXI_DEV_ROOT
+#define SUNXI_DEV_ROOT      "/dev"
+#endif
+
 static pthread_once_t g_init = PTHREAD_ONCE_INIT;
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -65,7 +70,7 @@ static int set_light_backlight(struct light_device_t *dev,
 
 	pthread_mutex_lock(&g_lock);
 
-	fd = open("/dev/disp", O_RDONLY);
+	fd = open(SUNXI_DEV_ROOT "/disp", O_RDONLY);
 	if (fd < 0)
 	{
 		ALOGE("Failed to open display device fd = %x\n", fd);